@@ -0,0 +1,497 @@
+//
+// db_bench：在进程内直接调用 db.h 跑固定的负载，结果以 JSON 输出到标准输出，方便不同版本之间对比
+// 负载：seq_insert 顺序插入、rand_insert 乱序插入、scan 全表扫描、lookup 按 id 点查、mixed 多线程读写混合
+// scan、lookup、mixed 在 seq_insert 建好的文件上跑，文件不存在时先建
+//
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "db.h"
+
+//每个负载单独的文件，跑之前删掉
+#define BENCH_DEFAULT_FILE "bench.db"
+#define BENCH_MAX_THREADS 64
+
+typedef struct {
+    const char *filename;
+    uint32_t num_rows;          //插入负载的行数
+    uint32_t num_lookups;       //点查次数，mixed 的总操作数
+    uint32_t scan_passes;       //全表扫描遍数
+    uint32_t num_threads;       //mixed 的线程数
+    uint32_t read_percent;      //mixed 里点查所占的百分比，其余是插入
+    uint32_t username_length;   //生成的行里字段的长度
+    uint32_t email_length;
+    uint32_t seed;
+    DbOptions options;
+} BenchConfig;
+
+///proc/self/io 里的计数：rchar/wchar 是系统调用读写的字节，read_bytes/write_bytes 是真正到达存储的
+typedef struct {
+    uint64_t rchar;
+    uint64_t wchar;
+    uint64_t read_bytes;
+    uint64_t write_bytes;
+} IoCounters;
+
+//一个负载的结果，latencies 是每个操作的耗时（纳秒）
+typedef struct {
+    const char *name;
+    uint64_t num_ops;
+    uint64_t *latencies;
+    uint64_t num_latencies;
+    double seconds;
+    IoCounters io;
+    uint64_t rows;              //scan 读到的总行数，其他负载为 0
+} BenchResult;
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static void read_io_counters(IoCounters *io) {
+    memset(io, 0, sizeof(*io));
+    FILE *file = fopen("/proc/self/io", "r");
+    if (file == NULL) {
+        return;
+    }
+    char name[32];
+    unsigned long long value;
+    while (fscanf(file, "%31[^:]: %llu\n", name, &value) == 2) {
+        if (strcmp(name, "rchar") == 0) {
+            io->rchar = value;
+        } else if (strcmp(name, "wchar") == 0) {
+            io->wchar = value;
+        } else if (strcmp(name, "read_bytes") == 0) {
+            io->read_bytes = value;
+        } else if (strcmp(name, "write_bytes") == 0) {
+            io->write_bytes = value;
+        }
+    }
+    fclose(file);
+}
+
+//xorshift，每个线程一个状态
+static uint32_t next_random(uint32_t *state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+//按配置的长度生成第 id 行的 username 和 email，用 id 开头保证不同行内容不同
+static void fill_row(const BenchConfig *config, uint32_t id, char *username, char *email) {
+    int length = snprintf(username, COLUMN_USERNAME_SIZE + 1, "u%u", id);
+    while ((uint32_t) length < config->username_length) {
+        username[length++] = 'a' + id % 26;
+    }
+    username[length] = '\0';
+    length = snprintf(email, COLUMN_EMAIL_SIZE + 1, "%u@", id);
+    while ((uint32_t) length + 4 < config->email_length) {
+        email[length++] = 'a' + id % 26;
+    }
+    strcpy(email + length, ".org");
+}
+
+static void remove_db_file(const char *filename) {
+    char wal_name[4096];
+    char journal_name[4096];
+    snprintf(wal_name, sizeof(wal_name), "%s-wal", filename);
+    snprintf(journal_name, sizeof(journal_name), "%s-journal", filename);
+    unlink(filename);
+    unlink(wal_name);
+    unlink(journal_name);
+}
+
+static void prepare_or_die(Table *table, const char *text, PreparedStatement *prepared) {
+    if (db_prepare(table, text, prepared) != PREPARE_SUCCESS) {
+        fprintf(stderr, "Could not prepare '%s'.\n", text);
+        exit(EXIT_FAILURE);
+    }
+}
+
+//用预编译的 insert 插入一行，返回耗时
+static uint64_t timed_insert(const BenchConfig *config, Table *table, PreparedStatement *prepared, uint32_t id) {
+    char username[COLUMN_USERNAME_SIZE + 1];
+    char email[COLUMN_EMAIL_SIZE + 1];
+    fill_row(config, id, username, email);
+    uint64_t start = now_ns();
+    db_bind_int(prepared, 1, id);
+    db_bind_text(prepared, 2, username);
+    db_bind_text(prepared, 3, email);
+    ExecuteResult result = db_execute(table, prepared);
+    uint64_t elapsed = now_ns() - start;
+    if (result != EXECUTE_SUCCESS) {
+        fprintf(stderr, "Insert of id %u failed: %d\n", id, result);
+        exit(EXIT_FAILURE);
+    }
+    return elapsed;
+}
+
+//按 id 点查一行，行不存在时退出，返回耗时
+static uint64_t timed_lookup(Table *table, uint32_t id) {
+    uint64_t start = now_ns();
+    Cursor *cursor = db_scan(table, id);
+    Row row;
+    bool found = db_cursor_next(cursor, &row) && row.id == id;
+    db_cursor_close(cursor);
+    uint64_t elapsed = now_ns() - start;
+    if (!found) {
+        fprintf(stderr, "Lookup of id %u found nothing.\n", id);
+        exit(EXIT_FAILURE);
+    }
+    return elapsed;
+}
+
+static void result_begin(BenchResult *result, const char *name, uint64_t capacity) {
+    memset(result, 0, sizeof(*result));
+    result->name = name;
+    result->latencies = malloc(sizeof(uint64_t) * (capacity > 0 ? capacity : 1));
+    read_io_counters(&result->io);
+    result->seconds = now_ns() / 1e9;
+}
+
+//结束计时，I/O 计数换成这个负载期间的增量；关闭表的检查点也算在里面
+static void result_end(BenchResult *result) {
+    result->seconds = now_ns() / 1e9 - result->seconds;
+    IoCounters end;
+    read_io_counters(&end);
+    result->io.rchar = end.rchar - result->io.rchar;
+    result->io.wchar = end.wchar - result->io.wchar;
+    result->io.read_bytes = end.read_bytes - result->io.read_bytes;
+    result->io.write_bytes = end.write_bytes - result->io.write_bytes;
+}
+
+static void run_insert(const BenchConfig *config, BenchResult *result, const char *name, bool random_order) {
+    char filename[4096];
+    snprintf(filename, sizeof(filename), "%s%s", config->filename, random_order ? ".rand" : "");
+    remove_db_file(filename);
+
+    uint32_t *ids = malloc(sizeof(uint32_t) * config->num_rows);
+    for (uint32_t i = 0; i < config->num_rows; i++) {
+        ids[i] = i + 1;
+    }
+    if (random_order) {
+        uint32_t state = config->seed;
+        for (uint32_t i = config->num_rows; i > 1; i--) {
+            uint32_t j = next_random(&state) % i;
+            uint32_t tmp = ids[i - 1];
+            ids[i - 1] = ids[j];
+            ids[j] = tmp;
+        }
+    }
+
+    result_begin(result, name, config->num_rows);
+    Table *table = db_open(filename, &config->options);
+    PreparedStatement prepared;
+    prepare_or_die(table, "insert ? ? ?", &prepared);
+    for (uint32_t i = 0; i < config->num_rows; i++) {
+        result->latencies[result->num_latencies++] = timed_insert(config, table, &prepared, ids[i]);
+    }
+    db_close(table);
+    result_end(result);
+    result->num_ops = config->num_rows;
+    free(ids);
+    if (random_order) {
+        remove_db_file(filename);
+    }
+}
+
+//scan、lookup、mixed 用的文件：seq_insert 没跑过时先不计时地建好
+static void ensure_loaded(const BenchConfig *config) {
+    if (access(config->filename, F_OK) == 0) {
+        return;
+    }
+    BenchResult unused;
+    run_insert(config, &unused, "load", false);
+    free(unused.latencies);
+}
+
+static void run_scan(const BenchConfig *config, BenchResult *result) {
+    ensure_loaded(config);
+    result_begin(result, "scan", config->scan_passes);
+    Table *table = db_open(config->filename, &config->options);
+    for (uint32_t pass = 0; pass < config->scan_passes; pass++) {
+        uint64_t start = now_ns();
+        Cursor *cursor = db_scan(table, 0);
+        Row row;
+        while (db_cursor_next(cursor, &row)) {
+            result->rows++;
+        }
+        db_cursor_close(cursor);
+        result->latencies[result->num_latencies++] = now_ns() - start;
+    }
+    db_close(table);
+    result_end(result);
+    result->num_ops = config->scan_passes;
+}
+
+static void run_lookup(const BenchConfig *config, BenchResult *result) {
+    ensure_loaded(config);
+    result_begin(result, "lookup", config->num_lookups);
+    Table *table = db_open(config->filename, &config->options);
+    uint32_t state = config->seed;
+    for (uint32_t i = 0; i < config->num_lookups; i++) {
+        uint32_t id = next_random(&state) % config->num_rows + 1;
+        result->latencies[result->num_latencies++] = timed_lookup(table, id);
+    }
+    db_close(table);
+    result_end(result);
+    result->num_ops = config->num_lookups;
+}
+
+typedef struct {
+    const BenchConfig *config;
+    Table *table;
+    uint32_t thread_id;
+    uint32_t num_ops;
+    uint32_t first_new_id;      //这个线程插入的 id 从这里开始，线程之间不重叠
+    uint64_t *latencies;
+} MixedWorker;
+
+static void *mixed_worker_main(void *arg) {
+    MixedWorker *worker = arg;
+    const BenchConfig *config = worker->config;
+    PreparedStatement prepared;
+    prepare_or_die(worker->table, "insert ? ? ?", &prepared);
+    uint32_t state = config->seed + worker->thread_id * 7919 + 1;
+    uint32_t next_id = worker->first_new_id;
+    for (uint32_t i = 0; i < worker->num_ops; i++) {
+        if (next_random(&state) % 100 < config->read_percent) {
+            uint32_t id = next_random(&state) % config->num_rows + 1;
+            worker->latencies[i] = timed_lookup(worker->table, id);
+        } else {
+            worker->latencies[i] = timed_insert(config, worker->table, &prepared, next_id++);
+        }
+    }
+    return NULL;
+}
+
+//mixed 插入的行不留在文件里：在副本上跑，之后删掉
+static void run_mixed(const BenchConfig *config, BenchResult *result) {
+    ensure_loaded(config);
+    char filename[4096];
+    char command[8300];
+    snprintf(filename, sizeof(filename), "%s.mixed", config->filename);
+    snprintf(command, sizeof(command), "cp '%s' '%s'", config->filename, filename);
+    remove_db_file(filename);
+    if (system(command) != 0) {
+        fprintf(stderr, "Could not copy %s.\n", config->filename);
+        exit(EXIT_FAILURE);
+    }
+
+    uint32_t num_threads = config->num_threads;
+    uint32_t ops_per_thread = config->num_lookups / num_threads;
+    result_begin(result, "mixed", (uint64_t) ops_per_thread * num_threads);
+    Table *table = db_open(filename, &config->options);
+    pthread_t threads[BENCH_MAX_THREADS];
+    MixedWorker workers[BENCH_MAX_THREADS];
+    for (uint32_t i = 0; i < num_threads; i++) {
+        workers[i] = (MixedWorker) {
+                .config = config,
+                .table = table,
+                .thread_id = i,
+                .num_ops = ops_per_thread,
+                .first_new_id = config->num_rows + 1 + i * ops_per_thread,
+                .latencies = result->latencies + (uint64_t) i * ops_per_thread
+        };
+        pthread_create(&threads[i], NULL, mixed_worker_main, &workers[i]);
+    }
+    for (uint32_t i = 0; i < num_threads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    db_close(table);
+    result_end(result);
+    result->num_ops = (uint64_t) ops_per_thread * num_threads;
+    result->num_latencies = result->num_ops;
+    remove_db_file(filename);
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+//排好序的耗时里取第 permille / 1000 分位
+static uint64_t percentile(const uint64_t *sorted, uint64_t count, uint32_t permille) {
+    if (count == 0) {
+        return 0;
+    }
+    uint64_t index = (count * permille + 999) / 1000;
+    return sorted[index > 0 ? index - 1 : 0];
+}
+
+static void print_result(const BenchResult *result, bool last) {
+    qsort(result->latencies, result->num_latencies, sizeof(uint64_t), compare_u64);
+    uint64_t max = result->num_latencies > 0 ? result->latencies[result->num_latencies - 1] : 0;
+    printf("    {\"workload\": \"%s\", \"ops\": %llu, \"seconds\": %.6f, \"ops_per_sec\": %.1f,\n",
+           result->name, (unsigned long long) result->num_ops, result->seconds,
+           result->seconds > 0 ? result->num_ops / result->seconds : 0.0);
+    printf("     \"latency_ns\": {\"p50\": %llu, \"p99\": %llu, \"p999\": %llu, \"max\": %llu},\n",
+           (unsigned long long) percentile(result->latencies, result->num_latencies, 500),
+           (unsigned long long) percentile(result->latencies, result->num_latencies, 990),
+           (unsigned long long) percentile(result->latencies, result->num_latencies, 999),
+           (unsigned long long) max);
+    if (result->rows > 0) {
+        printf("     \"rows\": %llu, \"rows_per_sec\": %.1f,\n", (unsigned long long) result->rows,
+               result->seconds > 0 ? result->rows / result->seconds : 0.0);
+    }
+    printf("     \"io\": {\"rchar\": %llu, \"wchar\": %llu, \"read_bytes\": %llu, \"write_bytes\": %llu}}%s\n",
+           (unsigned long long) result->io.rchar, (unsigned long long) result->io.wchar,
+           (unsigned long long) result->io.read_bytes, (unsigned long long) result->io.write_bytes,
+           last ? "" : ",");
+}
+
+static void print_config(const BenchConfig *config, const char *workloads) {
+    printf("{\n  \"config\": {\"file\": \"%s\", \"workloads\": \"%s\", \"rows\": %u, \"lookups\": %u, "
+           "\"scan_passes\": %u, \"threads\": %u, \"read_percent\": %u,\n", config->filename, workloads,
+           config->num_rows, config->num_lookups, config->scan_passes, config->num_threads, config->read_percent);
+    printf("             \"username_length\": %u, \"email_length\": %u, \"seed\": %u, \"frames\": %u, "
+           "\"mmap\": %s, \"compress\": %s, \"io_uring\": %s},\n", config->username_length, config->email_length,
+           config->seed, config->options.num_frames, config->options.use_mmap ? "true" : "false",
+           config->options.compress_pages ? "true" : "false", config->options.use_io_uring ? "true" : "false");
+}
+
+int main(int argc, char *argv[]) {
+    BenchConfig config = {
+            .filename = BENCH_DEFAULT_FILE,
+            .num_rows = 100000,
+            .num_lookups = 100000,
+            .scan_passes = 10,
+            .num_threads = 4,
+            .read_percent = 90,
+            .username_length = 8,
+            .email_length = 20,
+            .seed = 42,
+            .options = {
+                    .num_frames = PAGER_DEFAULT_FRAMES,
+                    .use_mmap = false,
+                    .wal_group_window_us = WAL_DEFAULT_GROUP_WINDOW_US,
+                    .wal_group_max_records = WAL_DEFAULT_GROUP_MAX_RECORDS,
+                    .scan_threads = 1,
+                    .read_ahead_pages = PAGER_DEFAULT_READ_AHEAD,
+                    .use_io_uring = true,
+                    .compress_pages = false
+            }
+    };
+    const char *workloads = "seq_insert,rand_insert,scan,lookup,mixed";
+
+    //-f 文件名 -n 行数 -l 点查次数 -p 扫描遍数 -t 线程数 -R 读百分比 -u/-e 字段长度 -S 随机种子
+    //-W 逗号分隔的负载列表；-c -m -w -g -s -z 和 db 的选项一样
+    int opt;
+    while ((opt = getopt(argc, argv, "f:n:l:p:t:R:u:e:S:W:c:mw:g:sz")) != -1) {
+        switch (opt) {
+            case 'f':
+                config.filename = optarg;
+                break;
+            case 'n':
+                config.num_rows = strtoul(optarg, NULL, 10);
+                break;
+            case 'l':
+                config.num_lookups = strtoul(optarg, NULL, 10);
+                break;
+            case 'p':
+                config.scan_passes = strtoul(optarg, NULL, 10);
+                break;
+            case 't':
+                config.num_threads = strtoul(optarg, NULL, 10);
+                break;
+            case 'R':
+                config.read_percent = strtoul(optarg, NULL, 10);
+                break;
+            case 'u':
+                config.username_length = strtoul(optarg, NULL, 10);
+                break;
+            case 'e':
+                config.email_length = strtoul(optarg, NULL, 10);
+                break;
+            case 'S':
+                config.seed = strtoul(optarg, NULL, 10);
+                break;
+            case 'W':
+                workloads = optarg;
+                break;
+            case 'c':
+                config.options.num_frames = strtoul(optarg, NULL, 10);
+                break;
+            case 'm':
+                config.options.use_mmap = true;
+                break;
+            case 'w':
+                config.options.wal_group_window_us = strtoul(optarg, NULL, 10);
+                break;
+            case 'g':
+                config.options.wal_group_max_records = strtoul(optarg, NULL, 10);
+                break;
+            case 's':
+                config.options.use_io_uring = false;
+                break;
+            case 'z':
+                config.options.compress_pages = true;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-f file] [-n rows] [-l lookups] [-p scan_passes] [-t threads] "
+                                "[-R read_percent] [-u username_length] [-e email_length] [-S seed] "
+                                "[-W workload,...] [-c frames] [-m] [-w group_window_us] [-g group_records] [-s] [-z]\n", argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+    if (config.num_rows == 0 || config.num_threads == 0 || config.num_threads > BENCH_MAX_THREADS ||
+        config.read_percent > 100 || config.seed == 0) {
+        fprintf(stderr, "Need rows > 0, 1..%d threads, read_percent <= 100 and a nonzero seed.\n",
+                BENCH_MAX_THREADS);
+        exit(EXIT_FAILURE);
+    }
+    if (config.username_length > COLUMN_USERNAME_SIZE) {
+        config.username_length = COLUMN_USERNAME_SIZE;
+    }
+    if (config.email_length > COLUMN_EMAIL_SIZE) {
+        config.email_length = COLUMN_EMAIL_SIZE;
+    }
+
+    //seq_insert 总是重建文件，其他负载在它建好的文件上跑
+    remove_db_file(config.filename);
+    char *list = strdup(workloads);
+    BenchResult results[16];
+    uint32_t num_results = 0;
+    for (char *name = strtok(list, ","); name != NULL && num_results < 16; name = strtok(NULL, ",")) {
+        BenchResult *result = &results[num_results];
+        if (strcmp(name, "seq_insert") == 0) {
+            remove_db_file(config.filename);
+            run_insert(&config, result, "seq_insert", false);
+        } else if (strcmp(name, "rand_insert") == 0) {
+            run_insert(&config, result, "rand_insert", true);
+        } else if (strcmp(name, "scan") == 0) {
+            run_scan(&config, result);
+        } else if (strcmp(name, "lookup") == 0) {
+            run_lookup(&config, result);
+        } else if (strcmp(name, "mixed") == 0) {
+            run_mixed(&config, result);
+        } else {
+            fprintf(stderr, "Unknown workload '%s'.\n", name);
+            exit(EXIT_FAILURE);
+        }
+        num_results++;
+    }
+
+    print_config(&config, workloads);
+    printf("  \"results\": [\n");
+    for (uint32_t i = 0; i < num_results; i++) {
+        print_result(&results[i], i + 1 == num_results);
+        free(results[i].latencies);
+    }
+    printf("  ]\n}\n");
+    free(list);
+    remove_db_file(config.filename);
+    return 0;
+}
@@ -13,16 +13,37 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include "clog.h"
 
-#if 1
+//clog 自身的调试输出跟随编译期级别
+#if CLOG_MIN_LEVEL <= CLOG_LEVEL_DEBUG
 #define LOGD(fmt, args...)   printf("[%s-%s-%d] " fmt, __FILE__, __func__, __LINE__, ##args)
-#define LOGE(info) perror(info)
 #else
 #define LOGD(fmt, args...)
+#endif
+#if CLOG_MIN_LEVEL <= CLOG_LEVEL_ERROR
+#define LOGE(info) perror(info)
+#else
 #define LOGE(info)
 #endif
 
+//所有记录器合计的记录数和字节数，CLogStats 读取；记录器按值传递也不会丢计数
+static atomic_ulong g_logRecords;
+static atomic_ulong g_logBytes;
+
+static void CountRecord(int len)
+{
+    if (0 < len) {
+        atomic_fetch_add_explicit(&g_logRecords, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&g_logBytes, len, memory_order_relaxed);
+    }
+}
+
 //滚动日志文件，达到限制就另记一个日志文件
 static void RollLogFile(CLogger_t *logger)
 {
@@ -69,6 +90,283 @@ static void RollLogFile(CLogger_t *logger)
     }
 }
 
+/*
+ * 异步模式
+ * 多个生产者、一个消费者的有界无锁队列：每个槽有一个序号，生产者 CAS 抢 tail，
+ * 写完记录后把槽的序号置为 pos+1 发布；后台线程按序号顺序取出。
+ * 生产者只记下秒级时间戳并格式化到槽里，时间前缀由后台线程按秒缓存后拼接，
+ * 攒成大块再 write，文件滚动也在后台线程里做。
+ */
+#define DEFAULT_LOG_RING_SIZE		(1024)
+#define LOG_BATCH_SIZE				(64*1024)
+#define LOG_IDLE_WAIT_MS			(100)
+
+typedef struct {
+    atomic_size_t seq;		//等于 pos 时可写，等于 pos+1 时可读
+    time_t time;
+    int len;
+    char data[];
+} CLogSlot_t;
+
+typedef struct {
+    CLogger_t file;			//后台线程独占的文件状态
+    CLogOverflow_e overflow;
+    char *slots;
+    size_t slotSize;
+    size_t mask;
+    atomic_size_t tail;		//生产者下一个要抢的位置
+    size_t head;			//消费者下一个要读的位置
+    atomic_ulong dropped;
+    unsigned long reported;	//已经写进日志的丢弃数
+    atomic_int sleeping;	//后台线程在等待，生产者需要唤醒
+    atomic_int stop;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+    char *batch;
+    int batchSize;	//至少能放下一整条记录加前缀
+    int batchLen;
+    time_t cachedTime;
+    char cachedPrefix[32];
+    int prefixLen;
+} CLogRing_t;
+
+static CLogSlot_t *RingSlot(CLogRing_t *ring, size_t pos)
+{
+    return (CLogSlot_t *)(ring->slots + (pos & ring->mask) * ring->slotSize);
+}
+
+static void RingWake(CLogRing_t *ring)
+{
+    pthread_mutex_lock(&ring->lock);
+    pthread_cond_signal(&ring->cond);
+    pthread_mutex_unlock(&ring->lock);
+}
+
+//抢一个空槽，满了按策略丢弃（返回 NULL）或等待
+static CLogSlot_t *RingAcquire(CLogRing_t *ring, size_t *pos)
+{
+    size_t p = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    for (;;) {
+        CLogSlot_t *slot = RingSlot(ring, p);
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)p;
+        if (0 == diff) {
+            if (atomic_compare_exchange_weak_explicit(&ring->tail, &p, p+1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                *pos = p;
+                return slot;
+            }
+        } else if (0 > diff) {
+            //缓冲满
+            if (CLOG_OVERFLOW_DROP == ring->overflow) {
+                atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+                return NULL;
+            }
+            if (atomic_load(&ring->sleeping)) {
+                RingWake(ring);
+            }
+            sched_yield();
+            p = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        } else {
+            p = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        }
+    }
+}
+
+static void RingPublish(CLogRing_t *ring, CLogSlot_t *slot, size_t pos)
+{
+    atomic_store_explicit(&slot->seq, pos+1, memory_order_release);
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&ring->sleeping, memory_order_relaxed)) {
+        RingWake(ring);
+    }
+}
+
+//攒下的数据写进文件，写满就滚动
+static void RingFlush(CLogRing_t *ring)
+{
+    int written = 0;
+    while (written < ring->batchLen) {
+        int wLen = write(ring->file.fd, ring->batch+written, ring->batchLen-written);
+        if (0 > wLen) {
+            if (EINTR == errno) {
+                continue;
+            }
+            LOGE("write fail error:");
+            break;
+        }
+        written += wLen;
+    }
+    ring->file.currSize += written;
+    ring->batchLen = 0;
+    RollLogFile(&ring->file);
+}
+
+static void RingAppend(CLogRing_t *ring, const char *data, int len)
+{
+    if (ring->batchLen + len > ring->batchSize ||
+        (0 < ring->batchLen && ring->file.currSize + ring->batchLen + len > ring->file.maxSize)) {
+        RingFlush(ring);
+    }
+    memcpy(ring->batch+ring->batchLen, data, len);
+    ring->batchLen += len;
+}
+
+static void RingEmit(CLogRing_t *ring, CLogSlot_t *slot)
+{
+    if (slot->time != ring->cachedTime) {
+        struct tm tmTime = {0};
+        gmtime_r(&slot->time, &tmTime);
+        ring->prefixLen = snprintf(ring->cachedPrefix, sizeof(ring->cachedPrefix),
+                                   "#%02d-%02d-%02d %02d:%02d:%02d->",
+                                   (1900+tmTime.tm_year), tmTime.tm_mon+1, tmTime.tm_mday,
+                                   tmTime.tm_hour, tmTime.tm_min, tmTime.tm_sec);
+        ring->cachedTime = slot->time;
+    }
+    RingAppend(ring, ring->cachedPrefix, ring->prefixLen);
+    RingAppend(ring, slot->data, slot->len);
+}
+
+//取出所有已发布的记录，返回条数
+static int RingDrain(CLogRing_t *ring)
+{
+    int n = 0;
+    for (;;) {
+        CLogSlot_t *slot = RingSlot(ring, ring->head);
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        if (seq != ring->head+1) {
+            break;
+        }
+        RingEmit(ring, slot);
+        atomic_store_explicit(&slot->seq, ring->head+ring->mask+1, memory_order_release);
+        ring->head++;
+        n++;
+    }
+
+    unsigned long dropped = atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+    if (dropped != ring->reported) {
+        char note[64];
+        int len = snprintf(note, sizeof(note), "#clog dropped %lu records\n", dropped-ring->reported);
+        RingAppend(ring, note, len);
+        ring->reported = dropped;
+    }
+    return n;
+}
+
+static int RingEmpty(CLogRing_t *ring)
+{
+    CLogSlot_t *slot = RingSlot(ring, ring->head);
+    return atomic_load_explicit(&slot->seq, memory_order_acquire) != ring->head+1;
+}
+
+static void *RingThreadMain(void *arg)
+{
+    CLogRing_t *ring = arg;
+    for (;;) {
+        if (0 < RingDrain(ring)) {
+            continue;
+        }
+        //没有新记录了，把攒下的写出去
+        if (0 < ring->batchLen) {
+            RingFlush(ring);
+        }
+
+        pthread_mutex_lock(&ring->lock);
+        atomic_store(&ring->sleeping, 1);
+        if (RingEmpty(ring)) {
+            if (atomic_load(&ring->stop)) {
+                pthread_mutex_unlock(&ring->lock);
+                break;
+            }
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += LOG_IDLE_WAIT_MS * 1000000L;
+            ts.tv_sec += ts.tv_nsec / 1000000000L;
+            ts.tv_nsec %= 1000000000L;
+            pthread_cond_timedwait(&ring->cond, &ring->lock, &ts);
+        }
+        atomic_store(&ring->sleeping, 0);
+        pthread_mutex_unlock(&ring->lock);
+    }
+    return NULL;
+}
+
+//异步模式：文件交给后台线程，logger 里只留下环形缓冲
+static CLogAck_e RingStart(CLogger_t *logger)
+{
+    size_t size = 1;
+    size_t i;
+    CLogRing_t *ring = calloc(1, sizeof(CLogRing_t));
+    if (NULL == ring) {
+        return CLOG_ACK_FAIL;
+    }
+
+    logger->ringSize = (0 >= logger->ringSize)?DEFAULT_LOG_RING_SIZE:logger->ringSize;
+    while (size < (size_t)logger->ringSize) {
+        size <<= 1;
+    }
+    //槽按 64 字节对齐，相邻的槽不共享缓存行
+    ring->slotSize = (sizeof(CLogSlot_t) + logger->bufSize + 63) & ~(size_t)63;
+    ring->mask = size-1;
+    ring->slots = malloc(size * ring->slotSize);
+    //一个槽最多 bufSize 字节，批量缓冲区不能比一条记录还小
+    ring->batchSize = LOG_BATCH_SIZE;
+    if (ring->batchSize < logger->bufSize + (int)sizeof(ring->cachedPrefix)) {
+        ring->batchSize = logger->bufSize + (int)sizeof(ring->cachedPrefix);
+    }
+    ring->batch = malloc(ring->batchSize);
+    if (NULL == ring->slots || NULL == ring->batch) {
+        free(ring->slots);
+        free(ring->batch);
+        free(ring);
+        return CLOG_ACK_FAIL;
+    }
+    for (i = 0; i < size; i++) {
+        atomic_init(&RingSlot(ring, i)->seq, i);
+    }
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->dropped, 0);
+    atomic_init(&ring->sleeping, 0);
+    atomic_init(&ring->stop, 0);
+    ring->overflow = logger->overflow;
+    ring->cachedTime = -1;
+    ring->file = *logger;
+    pthread_mutex_init(&ring->lock, NULL);
+    pthread_cond_init(&ring->cond, NULL);
+
+    if (0 != pthread_create(&ring->thread, NULL, RingThreadMain, ring)) {
+        pthread_mutex_destroy(&ring->lock);
+        pthread_cond_destroy(&ring->cond);
+        free(ring->slots);
+        free(ring->batch);
+        free(ring);
+        return CLOG_ACK_FAIL;
+    }
+    logger->fd = -1;
+    logger->ring = ring;
+    return CLOG_ACK_OK;
+}
+
+//写完缓冲里剩下的记录后停止后台线程
+static void RingStop(CLogRing_t *ring)
+{
+    pthread_mutex_lock(&ring->lock);
+    atomic_store(&ring->stop, 1);
+    pthread_cond_signal(&ring->cond);
+    pthread_mutex_unlock(&ring->lock);
+    pthread_join(ring->thread, NULL);
+
+    if (0 <= ring->file.fd) {
+        close(ring->file.fd);
+    }
+    pthread_mutex_destroy(&ring->lock);
+    pthread_cond_destroy(&ring->cond);
+    free(ring->slots);
+    free(ring->batch);
+    free(ring);
+}
+
 //初始化日志记录器
 CLogAck_e CLogInitLogger(CLogger_t *logger, const char* path)
 {
@@ -103,12 +401,21 @@ CLogAck_e CLogInitLogger(CLogger_t *logger, const char* path)
 
     RollLogFile(logger);
 
+    logger->ring = NULL;
+    if (logger->async) {
+        return RingStart(logger);
+    }
     return CLOG_ACK_OK;
 }
 
 //释放日志记录器
 void CLogUninitLogger(CLogger_t *logger)
 {
+    if (NULL != logger->ring) {
+        RingStop(logger->ring);
+        logger->ring = NULL;
+    }
+
     if (0 < logger->fd) {
         close(logger->fd);
         logger->fd = -1;
@@ -121,32 +428,11 @@ void CLogUninitLogger(CLogger_t *logger)
     memset(logger, 0x0, sizeof(CLogger_t));
 }
 
-//记录日志信息接口
-int CLog(CLogger_t *logger, const char *fmt, ...)
+//同步模式：写入 buf 中的 buf_len 字节，写到文件上限时分两次写并滚动
+static int SyncWrite(CLogger_t *logger, int buf_len)
 {
-    int wLen;
-    int buf_len;
+    int wLen = buf_len;
     int tmp_len;
-    time_t timep = {0};
-    struct tm tmTime = {0};
-
-    time(&timep);
-    gmtime_r(&timep, &tmTime);
-
-    snprintf(logger->buf, logger->bufSize, "#%02d-%02d-%02d %02d:%02d:%02d->",
-             (1900+tmTime.tm_year), tmTime.tm_mon+1, tmTime.tm_mday,
-             tmTime.tm_hour, tmTime.tm_min, tmTime.tm_sec);
-    buf_len = strlen(logger->buf);
-
-    va_list arglist;
-    va_start(arglist, fmt);
-    wLen = vsnprintf((char*)logger->buf+buf_len, logger->bufSize-buf_len, fmt, arglist);
-    va_end(arglist);
-    if (0 < wLen) {
-        buf_len += wLen;
-    } else {
-        wLen = buf_len;
-    }
 
     tmp_len = logger->maxSize - logger->currSize;//剩余空间, 可能会分两次写入
     if (0 < tmp_len && buf_len > tmp_len) {
@@ -171,4 +457,121 @@ int CLog(CLogger_t *logger, const char *fmt, ...)
     }
 
     return wLen;
-}
\ No newline at end of file
+}
+
+//同步模式：时间前缀写进 buf，返回长度
+static int SyncPrefix(CLogger_t *logger)
+{
+    time_t timep = {0};
+    struct tm tmTime = {0};
+
+    time(&timep);
+    gmtime_r(&timep, &tmTime);
+
+    snprintf(logger->buf, logger->bufSize, "#%02d-%02d-%02d %02d:%02d:%02d->",
+             (1900+tmTime.tm_year), tmTime.tm_mon+1, tmTime.tm_mday,
+             tmTime.tm_hour, tmTime.tm_min, tmTime.tm_sec);
+    return strlen(logger->buf);
+}
+
+//记录日志信息接口
+int CLog(CLogger_t *logger, const char *fmt, ...)
+{
+    int wLen;
+    int buf_len;
+    va_list arglist;
+
+    if (NULL != logger->ring) {
+        //异步模式：直接格式化进槽里，不做系统调用
+        size_t pos;
+        CLogSlot_t *slot = RingAcquire(logger->ring, &pos);
+        if (NULL == slot) {
+            return 0;
+        }
+        slot->time = time(NULL);
+        va_start(arglist, fmt);
+        wLen = vsnprintf(slot->data, logger->bufSize, fmt, arglist);
+        va_end(arglist);
+        if (0 > wLen) {
+            wLen = 0;
+        } else if (wLen >= logger->bufSize) {
+            wLen = logger->bufSize-1;
+        }
+        slot->len = wLen;
+        RingPublish(logger->ring, slot, pos);
+        CountRecord(wLen);
+        return wLen;
+    }
+
+    buf_len = SyncPrefix(logger);
+
+    va_start(arglist, fmt);
+    wLen = vsnprintf((char*)logger->buf+buf_len, logger->bufSize-buf_len, fmt, arglist);
+    va_end(arglist);
+    if (0 < wLen) {
+        buf_len += wLen;
+    }
+    if (buf_len >= logger->bufSize) {
+        buf_len = logger->bufSize-1;
+    }
+
+    wLen = SyncWrite(logger, buf_len);
+    CountRecord(wLen);
+    return wLen;
+}
+
+//记录已经格式化好的日志
+int CLogWrite(CLogger_t *logger, const void *data, int len)
+{
+    int buf_len;
+
+    if (0 > len) {
+        return CLOG_ACK_FAIL;
+    }
+    if (NULL != logger->ring) {
+        size_t pos;
+        CLogSlot_t *slot = RingAcquire(logger->ring, &pos);
+        if (NULL == slot) {
+            return 0;
+        }
+        slot->time = time(NULL);
+        slot->len = (len < logger->bufSize)?len:logger->bufSize;
+        memcpy(slot->data, data, slot->len);
+        len = slot->len;
+        RingPublish(logger->ring, slot, pos);
+        CountRecord(len);
+        return len;
+    }
+
+    buf_len = SyncPrefix(logger);
+    if (len > logger->bufSize-buf_len) {
+        len = logger->bufSize-buf_len;
+    }
+    memcpy((char*)logger->buf+buf_len, data, len);
+    len = SyncWrite(logger, buf_len+len);
+    CountRecord(len);
+    return len;
+}
+
+//异步模式下丢弃的记录数
+unsigned long CLogDropped(CLogger_t *logger)
+{
+    if (NULL == logger->ring) {
+        return 0;
+    }
+    return atomic_load(&((CLogRing_t *)logger->ring)->dropped);
+}
+
+//所有记录器合计的记录数和字节数
+void CLogStats(unsigned long *records, unsigned long *bytes)
+{
+    *records = atomic_load_explicit(&g_logRecords, memory_order_relaxed);
+    *bytes = atomic_load_explicit(&g_logBytes, memory_order_relaxed);
+}
+
+//计数清零
+void CLogResetStats(void)
+{
+    atomic_store_explicit(&g_logRecords, 0, memory_order_relaxed);
+    atomic_store_explicit(&g_logBytes, 0, memory_order_relaxed);
+}
@@ -11,11 +11,28 @@ extern "C" {
 
 #include <limits.h>
 
+//日志级别，低于 CLogger_t.level 的记录在格式化之前就被跳过
+#define CLOG_LEVEL_DEBUG	0
+#define CLOG_LEVEL_INFO		1
+#define CLOG_LEVEL_WARN		2
+#define CLOG_LEVEL_ERROR	3
+#define CLOG_LEVEL_OFF		4
+
+//编译期最低级别，低于它的 CLOGx 宏不生成代码，参数也不会求值，由 CMake 选项 CLOG_MIN_LEVEL 设置
+#ifndef CLOG_MIN_LEVEL
+#define CLOG_MIN_LEVEL CLOG_LEVEL_DEBUG
+#endif
+
 typedef enum {
     CLOG_ACK_FAIL = -1,		//操作失败
     CLOG_ACK_OK = 0,		//操作成功
 } CLogAck_e;
 
+typedef enum {
+    CLOG_OVERFLOW_DROP = 0,		//异步模式缓冲满时丢弃新记录
+    CLOG_OVERFLOW_BLOCK = 1,	//异步模式缓冲满时等待后台线程腾出位置
+} CLogOverflow_e;
+
 typedef struct {
     int fd;
     int fileCnt;			//滚动记录多少个日志文件, 如5个日志文件 a.log(当前正在记录的文件) a.log.1 a.log.2 a.log.3 a.log.4 按时间排序， 最新-->最旧
@@ -24,8 +41,39 @@ typedef struct {
     char path[PATH_MAX];	//用户无需关心，日志文件路径
     int bufSize;			//每次写入日志数据最大的大小，
     void *buf;				//用户无需关心, 每次写入日志数据的缓冲区
+    int async;				//非0时由后台线程写文件和滚动，调用者只把记录放进无锁环形缓冲
+    int ringSize;			//异步模式环形缓冲能放多少条记录，取整到2的幂
+    CLogOverflow_e overflow;	//异步模式缓冲满时的处理方式
+    void *ring;				//用户无需关心，异步模式的环形缓冲和后台线程
+    int level;				//运行时级别阈值，CLOG_LEVEL_xxx，默认 0 全部记录
 } CLogger_t;
 
+#define CLOG_AT(logger, lvl, fmt, ...) \
+    do { if ((lvl) >= (logger)->level) CLog((logger), fmt, ##__VA_ARGS__); } while (0)
+//编译期去掉的级别：if (0) 里的调用不会生成代码，但参数和格式串照样做类型检查
+#define CLOG_ELIDED(logger, fmt, ...) do { if (0) CLog((logger), fmt, ##__VA_ARGS__); } while (0)
+
+#if CLOG_MIN_LEVEL <= CLOG_LEVEL_DEBUG
+#define CLOGD(logger, fmt, ...) CLOG_AT(logger, CLOG_LEVEL_DEBUG, fmt, ##__VA_ARGS__)
+#else
+#define CLOGD(logger, fmt, ...) CLOG_ELIDED(logger, fmt, ##__VA_ARGS__)
+#endif
+#if CLOG_MIN_LEVEL <= CLOG_LEVEL_INFO
+#define CLOGI(logger, fmt, ...) CLOG_AT(logger, CLOG_LEVEL_INFO, fmt, ##__VA_ARGS__)
+#else
+#define CLOGI(logger, fmt, ...) CLOG_ELIDED(logger, fmt, ##__VA_ARGS__)
+#endif
+#if CLOG_MIN_LEVEL <= CLOG_LEVEL_WARN
+#define CLOGW(logger, fmt, ...) CLOG_AT(logger, CLOG_LEVEL_WARN, fmt, ##__VA_ARGS__)
+#else
+#define CLOGW(logger, fmt, ...) CLOG_ELIDED(logger, fmt, ##__VA_ARGS__)
+#endif
+#if CLOG_MIN_LEVEL <= CLOG_LEVEL_ERROR
+#define CLOGE(logger, fmt, ...) CLOG_AT(logger, CLOG_LEVEL_ERROR, fmt, ##__VA_ARGS__)
+#else
+#define CLOGE(logger, fmt, ...) CLOG_ELIDED(logger, fmt, ##__VA_ARGS__)
+#endif
+
 /******************************************
 * 函数: CLogInitLogger
 * 功能: 初始化日志记录器
@@ -62,6 +110,43 @@ void CLogUninitLogger(CLogger_t *logger);
 ******************************************/
 int CLog(CLogger_t *logger, const char *fmt, ...);
 
+/******************************************
+* 函数: CLogWrite
+* 功能: 记录一条已经格式化好的日志，内容可以是二进制
+* 参数: CLogger_t *logger：
+*       const void *data：
+*       int len：超过 bufSize 的部分被截掉
+* 输入:
+* 输出:
+* 返回: int 成功返回：记录的字节数;其它返回：
+* 说明: 异步模式下只拷贝进环形缓冲，不做系统调用
+******************************************/
+int CLogWrite(CLogger_t *logger, const void *data, int len);
+
+/******************************************
+* 函数: CLogDropped
+* 功能: 异步模式下因缓冲满被丢弃的记录数
+* 参数: CLogger_t *logger：
+* 输入:
+* 输出:
+* 返回: unsigned long
+* 说明:
+******************************************/
+unsigned long CLogDropped(CLogger_t *logger);
+
+/******************************************
+* 函数: CLogStats / CLogResetStats
+* 功能: 读取或清零所有记录器合计的记录数和字节数
+* 参数: unsigned long *records：
+*       unsigned long *bytes：
+* 输入:
+* 输出:
+* 返回: void
+* 说明: 异步模式按放进缓冲的字节计，不含时间前缀；同步模式按写进文件的字节计
+******************************************/
+void CLogStats(unsigned long *records, unsigned long *bytes);
+void CLogResetStats(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,7086 @@
+//pthread_rwlockattr_setkind_np
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <limits.h>
+#include <ctype.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#define DB_HAVE_IO_URING 1
+#endif
+#include "db.h"
+
+#define size_of_attribute(Struct, Attribute) sizeof(((Struct*)0)->Attribute)
+//最近预编译过的语句文本缓存多少条
+#define STATEMENT_CACHE_SIZE 16
+//帧数下限，同一时刻可能有多个页被钉住
+#define PAGER_MIN_FRAMES 8
+//mmap 模式下映射每次至少扩大到 1M，旧映射保留到关闭
+#define PAGER_MIN_MAP_LENGTH (1024 * 1024)
+#define PAGER_MAX_RETIRED_MAPS 48
+//并行扫描时每块大约包含的叶子数
+#define PARALLEL_SCAN_CHUNK_LEAVES 16
+//pwritev 一次最多合并的页数
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+#define WAL_BUFFER_INITIAL_SIZE (64 * 1024)
+#define WAL_RECORD_HEADER_SIZE 6
+#define WAL_RECORD_INSERT 1
+#define WAL_RECORD_DELETE 2
+#define WAL_RECORD_UPDATE 3
+#define WAL_RECORD_MAX_SIZE (WAL_RECORD_HEADER_SIZE + 1 + 4 + \
+                             1 + COLUMN_USERNAME_SIZE + 1 + COLUMN_EMAIL_SIZE)
+//B+树最大层数，扇出 500+ 时远远够用
+#define BTREE_MAX_DEPTH 16
+//select 结果先格式化进输出块，16 块 * 64k 写满后一次 writev
+#define OUTPUT_BLOCK_SIZE (64 * 1024)
+#define OUTPUT_MAX_BLOCKS 16
+//一行格式化后的最大长度，csv 最坏情况下每个字符都要转义
+#define OUTPUT_ROW_MAX_SIZE 1024
+//剩余不到 2 块时扫描先放掉叶子再写出，一个叶子的结果远小于一块
+#define OUTPUT_YIELD_BLOCKS 2
+//.import 每次读 1M；构造好的页攒够 256 页追加写一次
+#define IMPORT_READ_SIZE (1024 * 1024)
+#define IMPORT_STAGE_PAGES 256
+//版本表初始容量；两次清理之间至少间隔 20ms
+#define VERSION_MIN_CAPACITY 1024
+#define VERSION_CLEAN_INTERVAL_MS 20
+//delete/update 每改这么多行追加一次日志
+#define MODIFY_LOG_BATCH 256
+//.vacuum 合并相邻叶子时，合并后最多占叶子空间的 90%，留出之后插入的余地
+#define VACUUM_FILL_PERCENT 90
+//username、email 各可以建一个哈希索引
+#define NUM_INDEX_COLUMNS 2
+//哈希索引平均每个桶装到 75% 就分裂一个桶，溢出页很少出现
+#define HASH_INDEX_FILL_PERCENT 75
+//线性哈希的段数，段 s 有 2^(s-1) 个桶
+#define HASH_MAX_SEGMENTS 32
+//io_uring 提交队列长度，同时在途的读写不超过完成队列长度
+#define PAGER_IO_RING_ENTRIES 64
+//一次最多预读的页数
+#define PAGER_MAX_READ_AHEAD 256
+//压缩文件里的页按 256 字节对齐存放，一页最多占 16 个单位；压缩后省不下一个单位就原样存
+#define PAGER_EXTENT_UNIT 256
+//页压缩的哈希表 2^12 项
+#define PAGE_COMPRESS_HASH_BITS 12
+
+typedef struct {
+    char *text;                 //NULL 表示空位
+    PreparedStatement prepared; //未绑定参数的解析结果
+    uint64_t last_used;
+} StatementCacheEntry;
+
+typedef enum {
+    NODE_INTERNAL,
+    NODE_LEAF,
+    NODE_FREE,      //空闲页，串在空闲页链表里
+    NODE_HASH_META, //哈希索引的元数据页
+    NODE_HASH_BUCKET    //哈希索引的桶页和溢出页
+} NodeType;
+
+//缓冲池中的一帧，缓存一个页
+typedef struct {
+    uint32_t page_num;
+    uint32_t pin_count;     //被钉住的次数，大于0时不能被淘汰
+    bool in_use;            //帧中是否缓存了页
+    bool dirty;             //页被修改过，淘汰或关闭时需要写回
+    bool referenced;        //CLOCK 引用位
+    bool io_pending;        //正在从文件读入，读完之前内容无效，也不能淘汰
+    int32_t hash_next;      //页号哈希表冲突链
+    pthread_rwlock_t latch; //页闩：读路径共享持有，写路径独占持有，钉住期间一直持有
+    void *data;
+} Frame;
+
+//一次提交的读或写，覆盖页号连续的几个帧
+typedef struct {
+    bool write;
+    bool done;              //写请求完成后由提交者释放，读请求在收割时释放
+    int32_t result;
+    uint32_t num_frames;
+    Frame **frames;
+    struct iovec *iov;
+} IoRequest;
+
+//io_uring 的提交队列和完成队列，三块内存都映射自 ring_fd
+typedef struct {
+    int ring_fd;
+    uint32_t sq_entries;
+    uint32_t cq_entries;
+    uint32_t *sq_head;
+    uint32_t *sq_tail;
+    uint32_t *sq_mask;
+    uint32_t *sq_array;
+    struct io_uring_sqe *sqes;
+    uint32_t *cq_head;
+    uint32_t *cq_tail;
+    uint32_t *cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    uint32_t num_pending;   //已经提交、还没收割的请求数
+} IoRing;
+
+//压缩文件里一页的位置：offset 以 PAGER_EXTENT_UNIT 为单位，length 是存放的字节数，0 表示这一页还没写过
+typedef struct {
+    uint32_t offset;
+    uint16_t length;
+    uint16_t flags;
+} PageExtent;
+
+#define PAGE_EXTENT_RAW 1       //没压缩，原样存放
+#define PAGE_EXTENT_FRESH 2     //上次检查点之后分配的位置，文件里的页位置表还不知道；只在内存里
+
+//一段连续的单位
+typedef struct {
+    uint32_t offset;
+    uint32_t units;
+} ExtentRun;
+
+//一种操作的耗时分布，多个线程同时累加，读的时候不加锁；对外是 LatencyStats
+typedef struct {
+    atomic_uint_fast64_t count;
+    atomic_uint_fast64_t total_ns;
+    atomic_uint_fast64_t max_ns;
+    atomic_uint_fast64_t buckets[STATS_LATENCY_BUCKETS];
+} LatencyCounters;
+
+typedef struct {
+    int file_descriptor;
+    off_t file_length;
+    uint32_t num_pages;     //逻辑页数，包括还未写回文件的新页
+    uint32_t free_head;     //空闲页链表头，0 表示没有空闲页
+    uint32_t num_free_pages;
+    uint32_t num_frames;
+    Frame *frames;
+    int32_t *buckets;       //页号 -> 帧下标
+    uint32_t num_buckets;
+    uint32_t clock_hand;
+    bool use_mmap;          //只读访问直接读 MAP_SHARED 映射
+    void *map;
+    size_t map_length;
+    int map_advice;
+    //扩大映射时旧映射不能立即释放，已经返回出去的指针还在用
+    void *retired_maps[PAGER_MAX_RETIRED_MAPS];
+    size_t retired_map_lengths[PAGER_MAX_RETIRED_MAPS];
+    uint32_t num_retired_maps;
+    //写者修改过、还没 checkpoint 的页在文件里会被原地改写，这期间不把映射交给读者
+    bool map_reads_enabled;
+    uint32_t mapped_readers;    //正在读映射页的次数，写者开始前等它归零
+    pthread_cond_t map_cond;
+    //异步 I/O：ring 为 NULL 时同步 pread，读盘期间同样不持有 lock
+    IoRing *ring;
+    bool io_waiting;            //有线程在内核里等完成事件，其他线程等 io_cond
+    pthread_cond_t io_cond;     //有读写完成
+    //顺序预读：连续缺页或有顺序扫描时，读缺的页的同时预读后面的页
+    uint32_t read_ahead_pages;
+    uint32_t last_miss_page;
+    bool last_miss_valid;
+    uint32_t read_ahead_end;    //同步模式下已经交给内核预读到的页
+    //页压缩：compressed 时页按 extents 记录的位置存放，不用 mmap 和 io_uring
+    bool compressed;
+    PageExtent *extents;        //页号 -> 文件里的位置，页 0 固定原样放在文件开头
+    uint32_t extents_capacity;
+    bool extents_dirty;         //有页换了位置，下次检查点要写新的页位置表
+    uint32_t end_units;         //文件末尾，以单位计
+    uint32_t map_offset;        //文件里当前的页位置表
+    uint32_t map_units;
+    uint32_t map_num_pages;
+    ExtentRun *free_runs;       //空闲位置按偏移排好序，相邻的合并成一段，不含文件末尾
+    uint32_t num_free_runs;
+    uint32_t free_runs_capacity;
+    ExtentRun *pending_runs;    //文件里的页位置表还引用着的旧位置，下次检查点之后才能重用
+    uint32_t num_pending_runs;
+    uint32_t pending_capacity;
+    //回滚日志：不压缩的文件原地写回页之前，先存下这一页在上次检查点时的内容
+    int journal_descriptor;     //压缩文件没有回滚日志，为 -1
+    off_t journal_length;
+    uint32_t checkpoint_pages;  //上次检查点时文件的页数，之后才分配的页不用存
+    uint8_t *journaled;         //位图：检查点之后已经存进回滚日志的页
+    //运行时计数，含义见 DbStats
+    atomic_uint_fast64_t page_hits;
+    atomic_uint_fast64_t page_misses;
+    atomic_uint_fast64_t page_evictions;
+    atomic_uint_fast64_t page_map_reads;
+    atomic_uint_fast64_t flush_calls;
+    atomic_uint_fast64_t flush_pages;
+    atomic_uint_fast64_t flush_bytes;
+    //保护帧表、页号哈希、钉计数、映射和页位置表，多个读线程可以同时取页
+    pthread_mutex_t lock;
+} Pager;
+
+//预写日志
+typedef struct {
+    int file_descriptor;
+    off_t file_length;          //已经落盘的日志长度
+    char *buffer;               //当前组已追加、还未写盘的记录
+    uint32_t buffer_length;
+    uint32_t buffer_capacity;
+    char *spare_buffer;         //写盘期间与 buffer 交换
+    uint32_t spare_capacity;
+    uint32_t pending_records;   //当前组的记录数
+    uint64_t group_start_us;    //当前组第一条记录的时间
+    uint32_t group_window_us;
+    uint32_t group_max_records;
+    uint64_t append_lsn;        //追加过的记录总字节数，检查点清空日志也不回退
+    uint64_t durable_lsn;       //append_lsn 中已经落盘（或已经进了检查点）的部分
+    bool syncing;
+    bool stop;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t flusher;
+} Wal;
+
+typedef void (*ThreadPoolJob)(void *arg, uint32_t worker_id);
+
+typedef struct {
+    pthread_t *threads;
+    void *workers;
+    uint32_t num_threads;
+    pthread_mutex_t lock;
+    pthread_cond_t work_cond;
+    pthread_cond_t done_cond;
+    ThreadPoolJob job;
+    void *job_arg;
+    uint64_t generation;        //每提交一个任务加一
+    uint32_t num_running;       //还没做完当前任务的线程数
+    bool stop;
+} ThreadPool;
+
+//被 update 覆盖、或删除后又插入的旧内容，[commit_ts, delete_ts) 之间的快照看到它
+typedef struct OldVersion {
+    Row row;
+    uint64_t commit_ts;
+    uint64_t delete_ts;
+    struct OldVersion *next;    //更早的版本
+} OldVersion;
+
+//版本表的一项：叶子里这个 id 的最新内容何时提交、何时删除，commit_ts 和 delete_ts 都为 0 表示空位
+typedef struct {
+    uint32_t id;
+    uint64_t commit_ts;     //0 表示很早就提交了
+    uint64_t delete_ts;     //不为 0 时叶子里是已删除的行
+    OldVersion *older;
+} RowVersion;
+
+//行版本：只记录还有快照可能看不到的行，id -> 版本，开放寻址；不在表里的行对所有快照可见
+typedef struct {
+    atomic_uint_fast64_t commit_clock;  //最近一次提交的时间戳
+    atomic_uint_fast64_t newest_ts;     //表里出现过的最大时间戳，快照不小于它时不用查表
+    atomic_uint_fast64_t visible_from;  //空表批量导入的提交时间戳，更早的快照看不到导入的行
+    RowVersion *versions;
+    uint32_t capacity;                  //2 的幂
+    uint32_t count;
+    pthread_rwlock_t lock;              //保护 versions
+    struct Snapshot *active;            //活动快照链表
+    pthread_mutex_t snapshot_lock;
+    pthread_cond_t cleaner_cond;        //和 snapshot_lock 配合，唤醒清理线程
+    pthread_t cleaner;
+    bool dirty;                         //有可以清理的版本
+    bool cleaner_idle;                  //清理线程在等新的版本，只有这时才需要唤醒
+    bool stop;
+} VersionStore;
+
+//读快照：能看到时间戳不超过 ts 的提交
+typedef struct Snapshot {
+    VersionStore *store;
+    uint64_t ts;
+    struct Snapshot *prev;
+    struct Snapshot *next;
+} Snapshot;
+
+struct Table {
+    Pager* pager;
+    Wal* wal;
+    ThreadPool* scan_pool;      //并行扫描线程池，单线程时为 NULL
+    OutputMode output_mode;
+    StatementCacheEntry *statement_cache;   //最近预编译的语句，按最久未用淘汰
+    uint64_t statement_cache_clock;
+    pthread_mutex_t statement_cache_lock;
+    pthread_mutex_t scan_pool_lock;         //线程池一次只跑一个扫描，忙时其他读者串行扫描
+    pthread_mutex_t write_lock;             //同一时刻只有一个写者，读者不拿这把锁
+    uint64_t write_ts;                      //当前写操作的提交时间戳，持有写者锁时有效
+    VersionStore versions;
+    uint32_t root_page_num;
+    atomic_uint num_rows;
+    atomic_uint num_tombstones;             //叶子里还留着的已删除行
+    bool header_clean;                      //文件头上记着正常关闭，这次打开后还没有写过
+    atomic_uint index_pages[NUM_INDEX_COLUMNS];         //username、email 上哈希索引的元数据页，0 表示没有
+    atomic_uint_fast64_t index_ts[NUM_INDEX_COLUMNS];   //建索引的提交时间戳，更早的快照不用索引
+    //运行时计数，含义见 DbStats
+    atomic_uint_fast64_t statement_cache_hits;
+    LatencyCounters prepare_latency;
+    LatencyCounters statement_latency[STATEMENT_CREATE_INDEX + 1];
+};
+
+//B+树游标，持有当前叶子页的钉
+struct Cursor {
+    Table *table;
+    uint32_t page_num;
+    uint32_t cell_num;
+    void *node;
+    bool read_only;     //只读游标，mmap 模式下直接读映射
+    bool end_of_table;  // Indicates a position one past the last element
+    //从根到叶子经过的内部节点，以及在每层进入的孩子下标
+    uint32_t path_pages[BTREE_MAX_DEPTH];
+    uint32_t path_slots[BTREE_MAX_DEPTH];
+    uint32_t depth;
+    //公开的行迭代器：叶子拷贝一份后马上放掉，按快照过滤
+    Snapshot *snapshot;
+    void *leaf_copy;
+    uint8_t *visible;   //拷贝里每个 cell 对快照的 VersionVisibility
+    Row *older_rows;    //要看旧内容的 cell 的旧内容，用到时才分配
+};
+
+//row 在叶子里的变长记录，id 是 key，存在槽里
+//field	        size (bytes)
+//ulen	        1
+//username	    ulen
+//elen	        1
+//email	        elen
+static const uint32_t ROW_MIN_RECORD_SIZE = 2;
+//页大小 4k
+static const uint32_t PAGE_SIZE = 4096;
+
+//Common Node Header Layout
+static const uint32_t NODE_TYPE_SIZE = sizeof(uint8_t);
+static const uint32_t NODE_TYPE_OFFSET = 0;
+static const uint32_t IS_ROOT_SIZE = sizeof(uint8_t);
+static const uint32_t IS_ROOT_OFFSET = NODE_TYPE_SIZE;
+static const uint32_t COMMON_NODE_HEADER_SIZE = NODE_TYPE_SIZE + IS_ROOT_SIZE;
+
+//Leaf Node Header Layout
+static const uint32_t LEAF_NODE_NUM_CELLS_SIZE = sizeof(uint32_t);
+static const uint32_t LEAF_NODE_NUM_CELLS_OFFSET = COMMON_NODE_HEADER_SIZE;
+static const uint32_t LEAF_NODE_NEXT_LEAF_SIZE = sizeof(uint32_t);
+static const uint32_t LEAF_NODE_NEXT_LEAF_OFFSET =
+        LEAF_NODE_NUM_CELLS_OFFSET + LEAF_NODE_NUM_CELLS_SIZE;
+//记录区的起始偏移，记录从页尾往前长
+static const uint32_t LEAF_NODE_CONTENT_START_SIZE = sizeof(uint32_t);
+static const uint32_t LEAF_NODE_CONTENT_START_OFFSET =
+        LEAF_NODE_NEXT_LEAF_OFFSET + LEAF_NODE_NEXT_LEAF_SIZE;
+//页头补齐到 4 字节，后面的 key 数组对齐
+static const uint32_t LEAF_NODE_HEADER_SIZE =
+        (COMMON_NODE_HEADER_SIZE + LEAF_NODE_NUM_CELLS_SIZE + LEAF_NODE_NEXT_LEAF_SIZE +
+         LEAF_NODE_CONTENT_START_SIZE + 3) & ~3u;
+
+//Leaf Node Body Layout: 按列分组（PAX），页头之后是 n 个 key 连续存放，再是 n 个 (记录偏移, 记录长度)，
+//记录从页尾往前长。二分查找、过滤 id 和 id 上的聚合只读 key 数组，每行 4 字节，不碰槽和记录
+static const uint32_t LEAF_NODE_KEY_SIZE = sizeof(uint32_t);
+static const uint32_t LEAF_NODE_RECORD_OFFSET_SIZE = sizeof(uint16_t);
+static const uint32_t LEAF_NODE_RECORD_OFFSET_OFFSET = 0;
+static const uint32_t LEAF_NODE_RECORD_LENGTH_SIZE = sizeof(uint16_t);
+static const uint32_t LEAF_NODE_RECORD_LENGTH_OFFSET =
+        LEAF_NODE_RECORD_OFFSET_OFFSET + LEAF_NODE_RECORD_OFFSET_SIZE;
+static const uint32_t LEAF_NODE_RECORD_SLOT_SIZE = LEAF_NODE_RECORD_OFFSET_SIZE + LEAF_NODE_RECORD_LENGTH_SIZE;
+//每行在记录之外占的字节数
+static const uint32_t LEAF_NODE_SLOT_SIZE = LEAF_NODE_KEY_SIZE + LEAF_NODE_RECORD_SLOT_SIZE;
+//记录长度的最高位标记已删除的行：记录原样留着，删除前开始的快照还要读它
+static const uint16_t LEAF_NODE_TOMBSTONE = 0x8000;
+static const uint32_t LEAF_NODE_SPACE_FOR_CELLS = PAGE_SIZE - LEAF_NODE_HEADER_SIZE;
+//一个叶子最多能放的 cell 数，全是最短记录时 (4096 - 16) / 10 = 408，只用来定数组大小
+static const uint32_t LEAF_NODE_MAX_CELLS =
+        LEAF_NODE_SPACE_FOR_CELLS / (LEAF_NODE_SLOT_SIZE + ROW_MIN_RECORD_SIZE);
+
+//Internal Node Header Layout
+static const uint32_t INTERNAL_NODE_NUM_KEYS_SIZE = sizeof(uint32_t);
+static const uint32_t INTERNAL_NODE_NUM_KEYS_OFFSET = COMMON_NODE_HEADER_SIZE;
+static const uint32_t INTERNAL_NODE_RIGHT_CHILD_SIZE = sizeof(uint32_t);
+static const uint32_t INTERNAL_NODE_RIGHT_CHILD_OFFSET =
+        INTERNAL_NODE_NUM_KEYS_OFFSET + INTERNAL_NODE_NUM_KEYS_SIZE;
+static const uint32_t INTERNAL_NODE_HEADER_SIZE =
+        COMMON_NODE_HEADER_SIZE + INTERNAL_NODE_NUM_KEYS_SIZE + INTERNAL_NODE_RIGHT_CHILD_SIZE;
+
+//Internal Node Body Layout: cell = child page + key
+static const uint32_t INTERNAL_NODE_CHILD_SIZE = sizeof(uint32_t);
+static const uint32_t INTERNAL_NODE_KEY_SIZE = sizeof(uint32_t);
+static const uint32_t INTERNAL_NODE_CELL_SIZE = INTERNAL_NODE_CHILD_SIZE + INTERNAL_NODE_KEY_SIZE;
+//每个内部节点 (4096 - 10) / 8 = 510 个 key
+static const uint32_t INTERNAL_NODE_MAX_KEYS =
+        (PAGE_SIZE - INTERNAL_NODE_HEADER_SIZE) / INTERNAL_NODE_CELL_SIZE;
+
+//Free Page Layout: 公共头之后是链表里下一个空闲页
+static const uint32_t FREE_PAGE_NEXT_OFFSET = COMMON_NODE_HEADER_SIZE;
+
+//页0 是文件头，打开时读一次就知道表的根、行数和空闲页链表，不用扫描文件；B+树的根固定在页1
+//格式变了就升 DB_FORMAT_VERSION，旧版本的文件打开时报错，不会按新格式误读
+typedef struct {
+    char magic[8];
+    uint32_t format_version;
+    uint32_t page_size;
+    uint32_t num_pages;
+    uint32_t root_page_num;
+    uint32_t num_rows;
+    uint32_t num_tombstones;
+    uint32_t free_head;
+    uint32_t num_free_pages;
+    uint32_t clean;     //正常关闭时为 1，打开后第一次写之前改成 0
+    uint32_t index_pages[NUM_INDEX_COLUMNS];    //没有索引的旧文件这里是 0
+} FileHeader;
+
+static const char DB_FILE_MAGIC[8] = "USERDB";
+static const uint32_t DB_FORMAT_VERSION = 2;
+static const uint32_t HEADER_PAGE_NUM = 0;
+static const uint32_t ROOT_PAGE_NUM = 1;
+
+//Hash Index Meta Layout: 公共头之后是列、level、分裂指针、项数和各段第一个桶页的页号
+static const uint32_t HASH_META_COLUMN_OFFSET = COMMON_NODE_HEADER_SIZE;
+static const uint32_t HASH_META_LEVEL_OFFSET = HASH_META_COLUMN_OFFSET + sizeof(uint32_t);
+static const uint32_t HASH_META_SPLIT_OFFSET = HASH_META_LEVEL_OFFSET + sizeof(uint32_t);
+static const uint32_t HASH_META_NUM_ENTRIES_OFFSET = HASH_META_SPLIT_OFFSET + sizeof(uint32_t);
+static const uint32_t HASH_META_SEGMENTS_OFFSET = HASH_META_NUM_ENTRIES_OFFSET + sizeof(uint32_t);
+
+//Hash Bucket Layout: 公共头之后是项数、溢出页，然后是 (列值哈希, 行 id) 数组
+typedef struct {
+    uint32_t hash;
+    uint32_t id;
+} HashEntry;
+
+static const uint32_t HASH_BUCKET_NUM_ENTRIES_OFFSET = COMMON_NODE_HEADER_SIZE;
+static const uint32_t HASH_BUCKET_OVERFLOW_OFFSET = HASH_BUCKET_NUM_ENTRIES_OFFSET + sizeof(uint32_t);
+static const uint32_t HASH_BUCKET_HEADER_SIZE = HASH_BUCKET_OVERFLOW_OFFSET + sizeof(uint32_t);
+static const uint32_t HASH_BUCKET_MAX_ENTRIES = (PAGE_SIZE - HASH_BUCKET_HEADER_SIZE) / sizeof(HashEntry);
+
+static ExecuteResult table_insert(Table *table, Row *row);
+static bool table_delete(Table *table, uint32_t id);
+static bool table_update(Table *table, Row *row);
+
+static void pager_flush(Pager* pager, uint32_t page_num, uint32_t size);
+static uint32_t crc32(const uint8_t *data, uint32_t length);
+
+/*
+ * 运行时计数
+ * 计数用 relaxed 原子加，不加锁也不排序，读出来的是近似的一致值；.stats 查看，db_reset_stats 清零。
+ * 耗时按 2 的幂分桶，分位数只精确到桶的上界。
+ */
+
+static void stat_add(atomic_uint_fast64_t *counter, uint64_t n) {
+    atomic_fetch_add_explicit(counter, n, memory_order_relaxed);
+}
+
+static uint64_t stat_load(atomic_uint_fast64_t *counter) {
+    return atomic_load_explicit(counter, memory_order_relaxed);
+}
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static void latency_record(LatencyCounters *latency, uint64_t ns) {
+    uint32_t bucket = ns == 0 ? 0 : 64 - __builtin_clzll(ns);
+    if (bucket >= STATS_LATENCY_BUCKETS) {
+        bucket = STATS_LATENCY_BUCKETS - 1;
+    }
+    stat_add(&latency->count, 1);
+    stat_add(&latency->total_ns, ns);
+    stat_add(&latency->buckets[bucket], 1);
+    uint64_t max = stat_load(&latency->max_ns);
+    while (ns > max && !atomic_compare_exchange_weak_explicit(&latency->max_ns, &max, ns,
+                                                              memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+static void latency_read(LatencyCounters *latency, LatencyStats *stats) {
+    stats->count = stat_load(&latency->count);
+    stats->total_ns = stat_load(&latency->total_ns);
+    stats->max_ns = stat_load(&latency->max_ns);
+    for (uint32_t i = 0; i < STATS_LATENCY_BUCKETS; i++) {
+        stats->buckets[i] = stat_load(&latency->buckets[i]);
+    }
+}
+
+static void latency_reset(LatencyCounters *latency) {
+    atomic_store_explicit(&latency->count, 0, memory_order_relaxed);
+    atomic_store_explicit(&latency->total_ns, 0, memory_order_relaxed);
+    atomic_store_explicit(&latency->max_ns, 0, memory_order_relaxed);
+    for (uint32_t i = 0; i < STATS_LATENCY_BUCKETS; i++) {
+        atomic_store_explicit(&latency->buckets[i], 0, memory_order_relaxed);
+    }
+}
+
+/*
+ * 页 I/O
+ * 内核支持时用 io_uring：缺的页和后面的预读一次提交，调用者只等自己要的页，预读的页在后台读完；
+ * checkpoint 把所有连续脏页段一次提交，然后等全部写完。不依赖 liburing，直接用系统调用。
+ * 不支持时退回 pread/pwritev，预读交给内核的 posix_fadvise。
+ * 两种方式读写文件时都不持有 pager->lock，其他线程照常命中缓冲池里的页。
+ */
+
+#ifdef DB_HAVE_IO_URING
+static IoRing *io_ring_open(uint32_t entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int ring_fd = (int) syscall(__NR_io_uring_setup, entries, &params);
+    if (ring_fd < 0) {
+        return NULL;
+    }
+
+    IoRing *ring = calloc(1, sizeof(IoRing));
+    ring->ring_fd = ring_fd;
+    ring->sq_entries = params.sq_entries;
+    ring->cq_entries = params.cq_entries;
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         ring_fd, IORING_OFF_SQ_RING);
+    ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         ring_fd, IORING_OFF_CQ_RING);
+    ring->sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+    if (ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        if (ring->sq_ring != MAP_FAILED) {
+            munmap(ring->sq_ring, ring->sq_ring_size);
+        }
+        if (ring->cq_ring != MAP_FAILED) {
+            munmap(ring->cq_ring, ring->cq_ring_size);
+        }
+        if (ring->sqes != MAP_FAILED) {
+            munmap(ring->sqes, params.sq_entries * sizeof(struct io_uring_sqe));
+        }
+        close(ring_fd);
+        free(ring);
+        return NULL;
+    }
+
+    char *sq = ring->sq_ring;
+    ring->sq_head = (uint32_t *) (sq + params.sq_off.head);
+    ring->sq_tail = (uint32_t *) (sq + params.sq_off.tail);
+    ring->sq_mask = (uint32_t *) (sq + params.sq_off.ring_mask);
+    ring->sq_array = (uint32_t *) (sq + params.sq_off.array);
+    char *cq = ring->cq_ring;
+    ring->cq_head = (uint32_t *) (cq + params.cq_off.head);
+    ring->cq_tail = (uint32_t *) (cq + params.cq_off.tail);
+    ring->cq_mask = (uint32_t *) (cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+    return ring;
+}
+
+static void io_ring_close(IoRing *ring) {
+    munmap(ring->sqes, ring->sq_entries * sizeof(struct io_uring_sqe));
+    munmap(ring->cq_ring, ring->cq_ring_size);
+    munmap(ring->sq_ring, ring->sq_ring_size);
+    close(ring->ring_fd);
+    free(ring);
+}
+
+//在提交队列里放一个 readv/writev，之后由 io_ring_submit 交给内核
+static void io_ring_prepare(IoRing *ring, int file_descriptor, IoRequest *request, off_t offset) {
+    uint32_t tail = *ring->sq_tail;
+    uint32_t index = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = request->write ? IORING_OP_WRITEV : IORING_OP_READV;
+    sqe->fd = file_descriptor;
+    sqe->off = offset;
+    sqe->addr = (uint64_t) (uintptr_t) request->iov;
+    sqe->len = request->num_frames;
+    sqe->user_data = (uint64_t) (uintptr_t) request;
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->num_pending++;
+}
+
+static void io_ring_submit(IoRing *ring, uint32_t count) {
+    while (count > 0) {
+        int submitted = (int) syscall(__NR_io_uring_enter, ring->ring_fd, count, 0, 0, NULL, 0);
+        if (submitted < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+                continue;
+            }
+            printf("Error submitting io: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+        count -= submitted;
+    }
+}
+
+//在内核里等到至少有一个完成事件
+static void io_ring_wait(IoRing *ring) {
+    if (syscall(__NR_io_uring_enter, ring->ring_fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 &&
+        errno != EINTR) {
+        printf("Error waiting for io: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+}
+
+//取出一个完成的请求，没有时返回 NULL
+static IoRequest *io_ring_next_completion(IoRing *ring) {
+    uint32_t head = *ring->cq_head;
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+    IoRequest *request = (IoRequest *) (uintptr_t) cqe->user_data;
+    request->result = cqe->res;
+    __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+    ring->num_pending--;
+    return request;
+}
+#else
+static IoRing *io_ring_open(uint32_t entries) {
+    (void) entries;
+    return NULL;
+}
+
+static void io_ring_close(IoRing *ring) {
+    (void) ring;
+}
+
+static void io_ring_prepare(IoRing *ring, int file_descriptor, IoRequest *request, off_t offset) {
+    (void) ring;
+    (void) file_descriptor;
+    (void) request;
+    (void) offset;
+}
+
+static void io_ring_submit(IoRing *ring, uint32_t count) {
+    (void) ring;
+    (void) count;
+}
+
+static void io_ring_wait(IoRing *ring) {
+    (void) ring;
+}
+
+static IoRequest *io_ring_next_completion(IoRing *ring) {
+    (void) ring;
+    return NULL;
+}
+#endif
+
+//覆盖 num_frames 个页号连续的帧
+static IoRequest *io_request_new(bool write, Frame **frames, uint32_t num_frames) {
+    IoRequest *request = malloc(sizeof(IoRequest) + num_frames * (sizeof(struct iovec) + sizeof(Frame *)));
+    request->write = write;
+    request->done = false;
+    request->result = 0;
+    request->num_frames = num_frames;
+    request->iov = (struct iovec *) (request + 1);
+    request->frames = (Frame **) (request->iov + num_frames);
+    for (uint32_t i = 0; i < num_frames; i++) {
+        request->frames[i] = frames[i];
+        request->iov[i].iov_base = frames[i]->data;
+        request->iov[i].iov_len = PAGE_SIZE;
+    }
+    return request;
+}
+
+//收割已经完成的读写：读完的帧变为可用，写请求标记完成，调用时持有 pager->lock
+static uint32_t pager_reap_io(Pager* pager) {
+    uint32_t reaped = 0;
+    IoRequest *request;
+    while ((request = io_ring_next_completion(pager->ring)) != NULL) {
+        reaped++;
+        if (request->result < 0 ||
+            (request->write && request->result != (int32_t) (request->num_frames * PAGE_SIZE))) {
+            printf("Error %s page %d: %d\n", request->write ? "writing" : "reading",
+                   request->frames[0]->page_num, request->result);
+            exit(EXIT_FAILURE);
+        }
+        if (request->write) {
+            request->done = true;
+            continue;
+        }
+        //读到文件末尾时没读到的部分已经清零
+        for (uint32_t i = 0; i < request->num_frames; i++) {
+            request->frames[i]->io_pending = false;
+        }
+        free(request);
+    }
+    if (reaped > 0) {
+        pthread_cond_broadcast(&pager->io_cond);
+    }
+    return reaped;
+}
+
+//等待有读写完成，调用时持有 pager->lock，等待期间释放
+//同一时刻只有一个线程在内核里等完成事件，收割后唤醒其他等 io_cond 的线程
+static void pager_io_progress(Pager* pager) {
+    if (pager->ring == NULL || pager->io_waiting) {
+        pthread_cond_wait(&pager->io_cond, &pager->lock);
+        return;
+    }
+    if (pager_reap_io(pager) > 0) {
+        return;
+    }
+    pager->io_waiting = true;
+    pthread_mutex_unlock(&pager->lock);
+    io_ring_wait(pager->ring);
+    pthread_mutex_lock(&pager->lock);
+    pager->io_waiting = false;
+    pager_reap_io(pager);
+    pthread_cond_broadcast(&pager->io_cond);
+}
+
+//提交 count 个请求之前保证完成队列放得下
+static void pager_reserve_io(Pager* pager, uint32_t count) {
+    while (pager->ring->num_pending + count > pager->ring->cq_entries) {
+        pager_io_progress(pager);
+    }
+}
+
+//等所有在途的读写完成，关闭前调用
+static void pager_drain_io(Pager* pager) {
+    pthread_mutex_lock(&pager->lock);
+    while (pager->ring != NULL && pager->ring->num_pending > 0) {
+        pager_io_progress(pager);
+    }
+    pthread_mutex_unlock(&pager->lock);
+}
+
+static uint32_t pager_hash(Pager* pager, uint32_t page_num) {
+    return (page_num * 2654435761u) % pager->num_buckets;
+}
+
+//在缓冲池中查找页，返回帧下标，不在池中返回 -1
+static int32_t pager_find_frame(Pager* pager, uint32_t page_num) {
+    int32_t i = pager->buckets[pager_hash(pager, page_num)];
+    while (i != -1 && pager->frames[i].page_num != page_num) {
+        i = pager->frames[i].hash_next;
+    }
+    return i;
+}
+
+static void pager_hash_remove(Pager* pager, int32_t frame_num) {
+    int32_t *link = &pager->buckets[pager_hash(pager, pager->frames[frame_num].page_num)];
+    while (*link != frame_num) {
+        link = &pager->frames[*link].hash_next;
+    }
+    *link = pager->frames[frame_num].hash_next;
+}
+
+//CLOCK 算法挑选一个空闲帧或淘汰一个未钉住的页，脏页先写回
+static int32_t pager_evict(Pager* pager) {
+    //转两圈：第一圈清引用位，第二圈一定能找到未钉住的帧
+    for (uint32_t n = 0; n < pager->num_frames * 2; n++) {
+        int32_t i = pager->clock_hand;
+        Frame* frame = &pager->frames[i];
+        pager->clock_hand = (pager->clock_hand + 1) % pager->num_frames;
+
+        if (!frame->in_use) {
+            return i;
+        }
+        if (frame->pin_count > 0 || frame->io_pending) {
+            continue;
+        }
+        if (frame->referenced) {
+            frame->referenced = false;
+            continue;
+        }
+        //压缩文件的文件头只在检查点写，和文件里的页位置表一致
+        if (pager->compressed && frame->page_num == HEADER_PAGE_NUM) {
+            continue;
+        }
+
+        if (frame->dirty) {
+            pager_flush(pager, frame->page_num, PAGE_SIZE);
+        }
+        pager_hash_remove(pager, i);
+        frame->in_use = false;
+        stat_add(&pager->page_evictions, 1);
+        return i;
+    }
+
+    printf("Buffer pool exhausted: all %d frames are pinned.\n", pager->num_frames);
+    exit(EXIT_FAILURE);
+}
+
+//返回页在映射中的地址，页不在文件里或映射失败返回 NULL
+static void *pager_mapped_page(Pager* pager, uint32_t page_num) {
+    off_t offset = (off_t) page_num * PAGE_SIZE;
+    if (!pager->use_mmap || offset + PAGE_SIZE > pager->file_length) {
+        return NULL;
+    }
+
+    if (offset + PAGE_SIZE > pager->map_length) {
+        //文件变大了，映射按倍数扩大，映射超过文件末尾的部分不会被访问
+        if (pager->num_retired_maps == PAGER_MAX_RETIRED_MAPS) {
+            return NULL;
+        }
+        size_t new_length = pager->map_length * 2;
+        if (new_length < PAGER_MIN_MAP_LENGTH) {
+            new_length = PAGER_MIN_MAP_LENGTH;
+        }
+        while (new_length < (size_t) pager->file_length) {
+            new_length *= 2;
+        }
+        void *map = mmap(NULL, new_length, PROT_READ, MAP_SHARED,
+                         pager->file_descriptor, 0);
+        if (map == MAP_FAILED) {
+            return NULL;
+        }
+        madvise(map, new_length, pager->map_advice);
+        if (pager->map != NULL) {
+            pager->retired_maps[pager->num_retired_maps] = pager->map;
+            pager->retired_map_lengths[pager->num_retired_maps] = pager->map_length;
+            pager->num_retired_maps++;
+        }
+        pager->map = map;
+        pager->map_length = new_length;
+    }
+    return pager->map + offset;
+}
+
+//全表扫描前提示内核顺序预读，扫描后恢复
+static void pager_advise_sequential(Pager* pager, bool sequential) {
+    pthread_mutex_lock(&pager->lock);
+    pager->map_advice = sequential ? MADV_SEQUENTIAL : MADV_NORMAL;
+    if (pager->map != NULL) {
+        madvise(pager->map, pager->map_length, pager->map_advice);
+    }
+    pthread_mutex_unlock(&pager->lock);
+}
+
+//淘汰一帧用来放 page_num，内容清零，调用时持有 pager->lock
+static Frame* pager_claim_frame(Pager* pager, uint32_t page_num) {
+    int32_t i = pager_evict(pager);
+    Frame* frame = &pager->frames[i];
+    memset(frame->data, 0, PAGE_SIZE);
+    frame->page_num = page_num;
+    frame->pin_count = 0;
+    frame->in_use = true;
+    frame->dirty = false;
+    frame->referenced = true;
+    frame->io_pending = false;
+    uint32_t bucket = pager_hash(pager, page_num);
+    frame->hash_next = pager->buckets[bucket];
+    pager->buckets[bucket] = i;
+    return frame;
+}
+
+//顺序读时缺页紧跟着上次缺的页（预读进来的页不缺，算在上次里），返回要预读的页数
+static uint32_t pager_read_ahead_count(Pager* pager, uint32_t page_num, uint32_t file_pages) {
+    bool sequential = pager->last_miss_valid && page_num == pager->last_miss_page + 1;
+    pager->last_miss_valid = true;
+    pager->last_miss_page = page_num;
+    if (!sequential || pager->read_ahead_pages == 0) {
+        return 0;
+    }
+    //预读的帧不能挤掉太多缓存
+    uint32_t limit = pager->read_ahead_pages;
+    if (limit > pager->num_frames / 4) {
+        limit = pager->num_frames / 4;
+    }
+    uint32_t count = 0;
+    while (count < limit && page_num + 1 + count < file_pages &&
+           pager_find_frame(pager, page_num + 1 + count) == -1) {
+        count++;
+    }
+    return count;
+}
+
+/*
+ * 页压缩
+ * 用 compress_pages 新建的文件里，页 0 原样放在文件开头，其他页压缩后按 PAGER_EXTENT_UNIT 对齐存放，
+ * 每页的位置记在页位置表里，页 0 末尾的 PageMapRoot 指向文件里的页位置表。
+ * 页写回时总是写到上次检查点没有引用的位置，检查点先写页，再把新的页位置表写到新位置，
+ * fdatasync 之后才改根指针，所以崩溃后文件里总有上一个检查点完整的一份，再重放日志。
+ */
+
+//页 0 最后 16 字节，只在压缩文件里使用
+typedef struct {
+    char magic[4];
+    uint32_t map_offset;    //页位置表的位置，以单位计
+    uint32_t num_pages;     //页位置表的项数
+    uint32_t reserved;
+} PageMapRoot;
+
+static const char PAGE_MAP_MAGIC[4] = {'P', 'G', 'Z', '1'};
+
+//压缩后的长度写不下时返回 false
+static bool page_put_length(uint8_t *dst, uint32_t *out, uint32_t limit, uint32_t length) {
+    while (length >= 255) {
+        if (*out >= limit) {
+            return false;
+        }
+        dst[(*out)++] = 255;
+        length -= 255;
+    }
+    if (*out >= limit) {
+        return false;
+    }
+    dst[(*out)++] = length;
+    return true;
+}
+
+//输出一个序列：token(高 4 位字面量数，低 4 位匹配长度 - 4，15 表示后面还有长度字节)、字面量、2 字节偏移
+//match_length 为 0 表示最后一个序列，只有字面量
+static bool page_put_sequence(uint8_t *dst, uint32_t *out, uint32_t limit, const uint8_t *literals,
+                              uint32_t num_literals, uint32_t offset, uint32_t match_length) {
+    if (*out >= limit) {
+        return false;
+    }
+    uint32_t token_at = (*out)++;
+    uint32_t extra_match = match_length > 0 ? match_length - 4 : 0;
+    dst[token_at] = (num_literals < 15 ? num_literals : 15) << 4 | (extra_match < 15 ? extra_match : 15);
+    if (num_literals >= 15 && !page_put_length(dst, out, limit, num_literals - 15)) {
+        return false;
+    }
+    if (num_literals > limit - *out) {
+        return false;
+    }
+    memcpy(dst + *out, literals, num_literals);
+    *out += num_literals;
+    if (match_length == 0) {
+        return true;
+    }
+    if (limit - *out < 2) {
+        return false;
+    }
+    dst[(*out)++] = offset & 0xff;
+    dst[(*out)++] = offset >> 8;
+    return extra_match < 15 || page_put_length(dst, out, limit, extra_match - 15);
+}
+
+//LZ77 压缩一页，结果超过 limit 字节时返回 0
+static uint32_t page_compress(const uint8_t *src, uint8_t *dst, uint32_t limit) {
+    uint16_t table[1 << PAGE_COMPRESS_HASH_BITS];   //4 字节序列的哈希 -> 位置 + 1
+    memset(table, 0, sizeof(table));
+    uint32_t anchor = 0;
+    uint32_t out = 0;
+    uint32_t i = 0;
+    while (i + 4 <= PAGE_SIZE) {
+        uint32_t sequence;
+        memcpy(&sequence, src + i, 4);
+        uint32_t h = (sequence * 2654435761u) >> (32 - PAGE_COMPRESS_HASH_BITS);
+        uint32_t candidate = table[h];
+        table[h] = i + 1;
+        if (candidate == 0 || memcmp(src + candidate - 1, src + i, 4) != 0) {
+            i++;
+            continue;
+        }
+        uint32_t match = candidate - 1;
+        uint32_t length = 4;
+        while (i + length < PAGE_SIZE && src[match + length] == src[i + length]) {
+            length++;
+        }
+        if (!page_put_sequence(dst, &out, limit, src + anchor, i - anchor, i - match, length)) {
+            return 0;
+        }
+        i += length;
+        anchor = i;
+    }
+    if (!page_put_sequence(dst, &out, limit, src + anchor, PAGE_SIZE - anchor, 0, 0)) {
+        return 0;
+    }
+    return out;
+}
+
+//解压一页，数据不完整或越界时返回 false
+static bool page_decompress(const uint8_t *src, uint32_t length, uint8_t *dst) {
+    const uint8_t *in = src;
+    const uint8_t *end = src + length;
+    uint32_t out = 0;
+    while (in < end) {
+        uint8_t token = *in++;
+        uint32_t num_literals = token >> 4;
+        if (num_literals == 15) {
+            uint8_t byte;
+            do {
+                if (in >= end) {
+                    return false;
+                }
+                byte = *in++;
+                num_literals += byte;
+            } while (byte == 255);
+        }
+        if (num_literals > (uint32_t) (end - in) || num_literals > PAGE_SIZE - out) {
+            return false;
+        }
+        memcpy(dst + out, in, num_literals);
+        in += num_literals;
+        out += num_literals;
+        if (in == end) {
+            break;
+        }
+
+        if (end - in < 2) {
+            return false;
+        }
+        uint32_t offset = in[0] | (uint32_t) in[1] << 8;
+        in += 2;
+        uint32_t match_length = token & 15;
+        if (match_length == 15) {
+            uint8_t byte;
+            do {
+                if (in >= end) {
+                    return false;
+                }
+                byte = *in++;
+                match_length += byte;
+            } while (byte == 255);
+        }
+        match_length += 4;
+        if (offset == 0 || offset > out || match_length > PAGE_SIZE - out) {
+            return false;
+        }
+        //偏移小于长度时前后重叠：偏移 1 是同一字节重复，其他情况逐个拷贝
+        if (offset >= match_length) {
+            memcpy(dst + out, dst + out - offset, match_length);
+        } else if (offset == 1) {
+            memset(dst + out, dst[out - 1], match_length);
+        } else {
+            for (uint32_t k = 0; k < match_length; k++) {
+                dst[out + k] = dst[out - offset + k];
+            }
+        }
+        out += match_length;
+    }
+    return out == PAGE_SIZE;
+}
+
+//从压缩文件读一页并解压，调用时持有 pager->lock，读盘期间放开
+static void pager_read_compressed(Pager* pager, Frame* frame) {
+    PageExtent extent = pager->extents[frame->page_num];
+    frame->io_pending = true;
+    frame->pin_count++;
+    pthread_mutex_unlock(&pager->lock);
+    uint8_t packed[PAGE_SIZE];
+    bool raw = extent.flags & PAGE_EXTENT_RAW;
+    ssize_t bytes_read = pread(pager->file_descriptor, raw ? (void *) frame->data : packed, extent.length,
+                               (off_t) extent.offset * PAGER_EXTENT_UNIT);
+    bool ok = bytes_read == extent.length && (raw || page_decompress(packed, extent.length, (uint8_t *) frame->data));
+    pthread_mutex_lock(&pager->lock);
+    if (!ok) {
+        printf("Error reading compressed page %d.\n", frame->page_num);
+        exit(EXIT_FAILURE);
+    }
+    frame->io_pending = false;
+    frame->pin_count--;
+    pthread_cond_broadcast(&pager->io_cond);
+}
+
+//把缺的页读进 frame，顺序读时顺带预读后面的页；返回时 frame 已经读好
+static void pager_read_page(Pager* pager, Frame* frame, uint32_t file_pages) {
+    uint32_t page_num = frame->page_num;
+    off_t offset = (off_t) page_num * PAGE_SIZE;
+    frame->io_pending = true;
+    frame->pin_count++;
+
+    if (pager->ring != NULL) {
+        pager_reserve_io(pager, 2);
+        IoRequest *request = io_request_new(false, &frame, 1);
+        io_ring_prepare(pager->ring, pager->file_descriptor, request, offset);
+        uint32_t num_requests = 1;
+        uint32_t ahead = pager_read_ahead_count(pager, page_num, file_pages);
+        if (ahead > 0) {
+            //预读的页一个请求读完，不等它
+            Frame *frames[PAGER_MAX_READ_AHEAD];
+            for (uint32_t i = 0; i < ahead; i++) {
+                frames[i] = pager_claim_frame(pager, page_num + 1 + i);
+                frames[i]->io_pending = true;
+            }
+            IoRequest *ahead_request = io_request_new(false, frames, ahead);
+            io_ring_prepare(pager->ring, pager->file_descriptor, ahead_request, offset + PAGE_SIZE);
+            num_requests++;
+            pager->last_miss_page = page_num + ahead;
+        }
+        io_ring_submit(pager->ring, num_requests);
+        while (frame->io_pending) {
+            pager_io_progress(pager);
+        }
+        frame->pin_count--;
+        return;
+    }
+
+    uint32_t ahead = pager_read_ahead_count(pager, page_num, file_pages);
+    if (ahead > 0 && page_num + 1 + ahead > pager->read_ahead_end) {
+        uint32_t first = page_num + 1 > pager->read_ahead_end ? page_num + 1 : pager->read_ahead_end;
+        posix_fadvise(pager->file_descriptor, (off_t) first * PAGE_SIZE,
+                      (off_t) (page_num + 1 + ahead - first) * PAGE_SIZE, POSIX_FADV_WILLNEED);
+        pager->read_ahead_end = page_num + 1 + ahead;
+    }
+    pthread_mutex_unlock(&pager->lock);
+    ssize_t bytes_read = pread(pager->file_descriptor, frame->data, PAGE_SIZE, offset);
+    pthread_mutex_lock(&pager->lock);
+    if (bytes_read == -1) {
+        printf("Error reading file: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    frame->io_pending = false;
+    frame->pin_count--;
+    pthread_cond_broadcast(&pager->io_cond);
+}
+
+static void* get_page_locked(Pager* pager, uint32_t page_num) {
+    int32_t i = pager_find_frame(pager, page_num);
+    if (i != -1) {
+        //命中缓存，预读或其他线程读入的页可能还没读完
+        stat_add(&pager->page_hits, 1);
+        Frame* frame = &pager->frames[i];
+        frame->pin_count++;
+        frame->referenced = true;
+        while (frame->io_pending) {
+            pager_io_progress(pager);
+        }
+        return frame->data;
+    }
+
+    //计算目前文件页数量
+    uint32_t num_pages = pager->file_length / PAGE_SIZE;
+    if (pager->file_length % PAGE_SIZE) {
+        //最后一页不足14行
+        num_pages += 1;
+    }
+
+    //说明内存中目前没有加载这个页，找一个帧来放
+    stat_add(&pager->page_misses, 1);
+    Frame* frame = pager_claim_frame(pager, page_num);
+    void* mapped = pager_mapped_page(pager, page_num);
+    if (mapped != NULL) {
+        //mmap 模式直接从映射拷贝，省掉 read()
+        memcpy(frame->data, mapped, PAGE_SIZE);
+    } else if (pager->compressed) {
+        if (page_num < pager->extents_capacity && pager->extents[page_num].length != 0) {
+            pager_read_compressed(pager, frame);
+        }
+    } else if (page_num < num_pages) {
+        //如果文件中有对应的页，讲页内容读入缓存
+        pager_read_page(pager, frame, num_pages);
+    }
+
+    if (page_num >= pager->num_pages) {
+        pager->num_pages = page_num + 1;
+    }
+    frame->pin_count++;
+    return frame->data;
+}
+
+//页在缓冲池里时返回它所在的帧，映射中的页返回 NULL
+static Frame* pager_frame_of(Pager* pager, void* page) {
+    char* frames_begin = pager->frames[0].data;
+    char* frames_end = frames_begin + (size_t) pager->num_frames * PAGE_SIZE;
+    if ((char*) page < frames_begin || (char*) page >= frames_end) {
+        return NULL;
+    }
+    return &pager->frames[((char*) page - frames_begin) / PAGE_SIZE];
+}
+
+//等页闩不能持有 pager->lock，否则持有闩的线程取下一页时会卡住
+static void frame_latch(Frame* frame, bool exclusive) {
+    int result = exclusive ? pthread_rwlock_wrlock(&frame->latch) : pthread_rwlock_rdlock(&frame->latch);
+    if (result != 0) {
+        printf("Error latching page %d: %d\n", frame->page_num, result);
+        exit(EXIT_FAILURE);
+    }
+}
+
+//取得页并钉住，持有独占页闩，用完后必须调用 pager_unpin
+//写路径按从根到叶的顺序取页，持有孩子时不再回头取祖先，和读者的顺序一致，不会死锁
+static void* get_page(Pager* pager, uint32_t page_num) {
+    pthread_mutex_lock(&pager->lock);
+    void* page = get_page_locked(pager, page_num);
+    pthread_mutex_unlock(&pager->lock);
+    frame_latch(pager_frame_of(pager, page), true);
+    return page;
+}
+
+//释放页闩、解除钉住，之后页可以被淘汰
+static void pager_unpin(Pager* pager, uint32_t page_num) {
+    pthread_mutex_lock(&pager->lock);
+    int32_t i = pager_find_frame(pager, page_num);
+    if (i == -1 || pager->frames[i].pin_count == 0) {
+        printf("Tried to unpin page %d that is not pinned\n", page_num);
+        exit(EXIT_FAILURE);
+    }
+    pthread_rwlock_unlock(&pager->frames[i].latch);
+    pager->frames[i].pin_count--;
+    pthread_mutex_unlock(&pager->lock);
+}
+
+//只读地取得页：mmap 模式下不在缓冲池里的页直接返回映射中的地址，
+//不占用帧也不拷贝；缓冲池里的页可能比文件新，仍然从池里取并持有共享页闩
+//写者改过页之后到 checkpoint 之前映射不稳定，这期间都从池里取
+//返回的页不能修改，用完调用 pager_unpin_ro
+static void* get_page_ro(Pager* pager, uint32_t page_num) {
+    pthread_mutex_lock(&pager->lock);
+    void* page = NULL;
+    if (pager->map_reads_enabled && pager_find_frame(pager, page_num) == -1) {
+        page = pager_mapped_page(pager, page_num);
+        if (page != NULL) {
+            stat_add(&pager->page_map_reads, 1);
+            pager->mapped_readers++;
+        }
+    }
+    Frame* frame = NULL;
+    if (page == NULL) {
+        page = get_page_locked(pager, page_num);
+        frame = pager_frame_of(pager, page);
+    }
+    pthread_mutex_unlock(&pager->lock);
+    if (frame != NULL) {
+        frame_latch(frame, false);
+    }
+    return page;
+}
+
+static void pager_unpin_ro(Pager* pager, uint32_t page_num, void* page) {
+    if (pager_frame_of(pager, page) != NULL) {
+        pager_unpin(pager, page_num);
+        return;
+    }
+    pthread_mutex_lock(&pager->lock);
+    if (--pager->mapped_readers == 0) {
+        pthread_cond_broadcast(&pager->map_cond);
+    }
+    pthread_mutex_unlock(&pager->lock);
+}
+
+//写者修改页之前调用：停止把映射交给读者，等已经拿到映射页的读者用完
+static void pager_begin_write(Pager* pager) {
+    pthread_mutex_lock(&pager->lock);
+    pager->map_reads_enabled = false;
+    while (pager->mapped_readers > 0) {
+        pthread_cond_wait(&pager->map_cond, &pager->lock);
+    }
+    pthread_mutex_unlock(&pager->lock);
+}
+
+//脏页都已写回，文件和缓冲池一致，映射可以重新交给读者
+static void pager_end_write(Pager* pager) {
+    pthread_mutex_lock(&pager->lock);
+    pager->map_reads_enabled = pager->use_mmap;
+    pthread_mutex_unlock(&pager->lock);
+}
+
+//写路径修改页后调用，淘汰时会写回
+static void pager_mark_dirty(Pager* pager, uint32_t page_num) {
+    pthread_mutex_lock(&pager->lock);
+    int32_t i = pager_find_frame(pager, page_num);
+    if (i == -1) {
+        printf("Tried to mark page %d dirty that is not cached\n", page_num);
+        exit(EXIT_FAILURE);
+    }
+    pager->frames[i].dirty = true;
+    pthread_mutex_unlock(&pager->lock);
+}
+
+//code to convert to and from the compact representation
+static uint32_t row_record_size(Row *row) {
+    return ROW_MIN_RECORD_SIZE + strlen(row->username) + strlen(row->email);
+}
+
+//序列化row 的 username 和 email，返回记录长度；id 作为 key 另外存
+static uint32_t serialize_row(Row *source, void *destination) {
+    uint8_t *p = destination;
+    uint8_t username_length = strlen(source->username);
+    uint8_t email_length = strlen(source->email);
+    *p++ = username_length;
+    memcpy(p, source->username, username_length);
+    p += username_length;
+    *p++ = email_length;
+    memcpy(p, source->email, email_length);
+    p += email_length;
+    return p - (uint8_t *) destination;
+}
+
+//记录里的 username / email，返回字段地址，长度写到 length
+static const char *record_username(const void *record, uint32_t *length) {
+    const uint8_t *p = record;
+    *length = p[0];
+    return (const char *) p + 1;
+}
+
+static const char *record_email(const void *record, uint32_t *length) {
+    const uint8_t *p = record;
+    *length = p[1 + p[0]];
+    return (const char *) p + 2 + p[0];
+}
+
+//反序列化row 的 username 和 email
+static void deserialize_row(void *source, Row *destination) {
+    uint32_t length;
+    const char *field = record_username(source, &length);
+    memcpy(destination->username, field, length);
+    destination->username[length] = 0;
+    field = record_email(source, &length);
+    memcpy(destination->email, field, length);
+    destination->email[length] = 0;
+}
+
+/*
+ * B+树
+ * 叶子节点是分槽页：槽按 key 有序，记录变长，叶子之间用 next_leaf 串成链表，供范围扫描
+ * 内部节点存放 (child, key) 对和最右孩子，key 是对应孩子子树中的最大 key
+ */
+
+static uint32_t *leaf_node_num_cells(void *node) {
+    return node + LEAF_NODE_NUM_CELLS_OFFSET;
+}
+
+static uint32_t *leaf_node_next_leaf(void *node) {
+    return node + LEAF_NODE_NEXT_LEAF_OFFSET;
+}
+
+static uint32_t *leaf_node_content_start(void *node) {
+    return node + LEAF_NODE_CONTENT_START_OFFSET;
+}
+
+//key 数组，cell_num 个 key 连续存放
+static uint32_t *leaf_node_key(void *node, uint32_t cell_num) {
+    return node + LEAF_NODE_HEADER_SIZE + cell_num * LEAF_NODE_KEY_SIZE;
+}
+
+//(记录偏移, 记录长度) 数组紧跟在 key 数组后面，位置随 cell 数变化
+static void *leaf_node_record_slot(void *node, uint32_t cell_num) {
+    return node + LEAF_NODE_HEADER_SIZE + *leaf_node_num_cells(node) * LEAF_NODE_KEY_SIZE +
+           cell_num * LEAF_NODE_RECORD_SLOT_SIZE;
+}
+
+static uint16_t *leaf_node_record_offset(void *node, uint32_t cell_num) {
+    return leaf_node_record_slot(node, cell_num) + LEAF_NODE_RECORD_OFFSET_OFFSET;
+}
+
+//记录长度字段，最高位是删除标记
+static uint16_t *leaf_node_record_length(void *node, uint32_t cell_num) {
+    return leaf_node_record_slot(node, cell_num) + LEAF_NODE_RECORD_LENGTH_OFFSET;
+}
+
+//在第 cell_num 个位置空出一个 cell：后面的 key 后移一格，记录槽数组整体后移一个 key 的宽度，
+//cell_num 之后的记录槽再多移一格；先挪高地址的部分
+static void leaf_node_open_cell(void *node, uint32_t cell_num) {
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    char *keys = (char *) leaf_node_key(node, 0);
+    char *slots = (char *) leaf_node_record_slot(node, 0);
+    memmove(slots + LEAF_NODE_KEY_SIZE + (cell_num + 1) * LEAF_NODE_RECORD_SLOT_SIZE,
+            slots + cell_num * LEAF_NODE_RECORD_SLOT_SIZE,
+            (num_cells - cell_num) * LEAF_NODE_RECORD_SLOT_SIZE);
+    memmove(slots + LEAF_NODE_KEY_SIZE, slots, cell_num * LEAF_NODE_RECORD_SLOT_SIZE);
+    memmove(keys + (cell_num + 1) * LEAF_NODE_KEY_SIZE, keys + cell_num * LEAF_NODE_KEY_SIZE,
+            (num_cells - cell_num) * LEAF_NODE_KEY_SIZE);
+    *leaf_node_num_cells(node) = num_cells + 1;
+}
+
+//去掉第 cell_num 个 cell 的 key 和记录槽，和 leaf_node_open_cell 相反，先挪低地址的部分
+static void leaf_node_close_cell(void *node, uint32_t cell_num) {
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    char *keys = (char *) leaf_node_key(node, 0);
+    char *slots = (char *) leaf_node_record_slot(node, 0);
+    memmove(keys + cell_num * LEAF_NODE_KEY_SIZE, keys + (cell_num + 1) * LEAF_NODE_KEY_SIZE,
+            (num_cells - cell_num - 1) * LEAF_NODE_KEY_SIZE);
+    memmove(slots - LEAF_NODE_KEY_SIZE, slots, cell_num * LEAF_NODE_RECORD_SLOT_SIZE);
+    memmove(slots - LEAF_NODE_KEY_SIZE + cell_num * LEAF_NODE_RECORD_SLOT_SIZE,
+            slots + (cell_num + 1) * LEAF_NODE_RECORD_SLOT_SIZE,
+            (num_cells - cell_num - 1) * LEAF_NODE_RECORD_SLOT_SIZE);
+    *leaf_node_num_cells(node) = num_cells - 1;
+}
+
+static uint32_t leaf_node_record_size(void *node, uint32_t cell_num) {
+    return *leaf_node_record_length(node, cell_num) & ~LEAF_NODE_TOMBSTONE;
+}
+
+static bool leaf_node_is_deleted(void *node, uint32_t cell_num) {
+    return (*leaf_node_record_length(node, cell_num) & LEAF_NODE_TOMBSTONE) != 0;
+}
+
+//第 cell_num 行的记录
+static void *leaf_node_value(void *node, uint32_t cell_num) {
+    return node + *leaf_node_record_offset(node, cell_num);
+}
+
+//记录槽数组和记录区之间的空闲字节数
+static uint32_t leaf_node_free_space(void *node) {
+    return *leaf_node_content_start(node) -
+           (LEAF_NODE_HEADER_SIZE + *leaf_node_num_cells(node) * LEAF_NODE_SLOT_SIZE);
+}
+
+//读出第 cell_num 行
+static void leaf_node_read_row(void *node, uint32_t cell_num, Row *row) {
+    row->id = *leaf_node_key(node, cell_num);
+    deserialize_row(leaf_node_value(node, cell_num), row);
+}
+
+//在叶子末尾追加一个 cell，调用者保证 key 有序且空间够
+static void leaf_node_append(void *node, uint32_t key, const void *record, uint32_t length) {
+    uint32_t cell_num = *leaf_node_num_cells(node);
+    leaf_node_open_cell(node, cell_num);
+    *leaf_node_content_start(node) -= length;
+    memcpy(node + *leaf_node_content_start(node), record, length);
+    *leaf_node_key(node, cell_num) = key;
+    *leaf_node_record_offset(node, cell_num) = *leaf_node_content_start(node);
+    *leaf_node_record_length(node, cell_num) = length;
+}
+
+//把 source 的第 cell_num 个 cell 追加到 node 末尾，删除标记一起带过去
+static void leaf_node_append_cell(void *node, void *source, uint32_t cell_num) {
+    leaf_node_append(node, *leaf_node_key(source, cell_num), leaf_node_value(source, cell_num),
+                     leaf_node_record_size(source, cell_num));
+    *leaf_node_record_length(node, *leaf_node_num_cells(node) - 1) =
+            *leaf_node_record_length(source, cell_num);
+}
+
+//删掉第 cell_num 个 cell；记录在记录区最前面时直接还给空闲区，否则留下空洞，空间不够时再整理
+static void leaf_node_remove(void *node, uint32_t cell_num) {
+    if (*leaf_node_record_offset(node, cell_num) == *leaf_node_content_start(node)) {
+        *leaf_node_content_start(node) += leaf_node_record_size(node, cell_num);
+    }
+    leaf_node_close_cell(node, cell_num);
+}
+
+//槽和记录实际占用的字节数，不算空洞
+static uint32_t leaf_node_used_space(void *node) {
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    uint32_t used = num_cells * LEAF_NODE_SLOT_SIZE;
+    for (uint32_t i = 0; i < num_cells; i++) {
+        used += leaf_node_record_size(node, i);
+    }
+    return used;
+}
+
+//把 keep[i] 为真的 cell 重新紧凑地排进页里，空洞并回空闲区；keep 为 NULL 时保留所有 cell
+static void leaf_node_defragment(void *node, const uint8_t *keep) {
+    char *copy = malloc(PAGE_SIZE);
+    memcpy(copy, node, PAGE_SIZE);
+    uint32_t num_cells = *leaf_node_num_cells(copy);
+    *leaf_node_num_cells(node) = 0;
+    *leaf_node_content_start(node) = PAGE_SIZE;
+    for (uint32_t i = 0; i < num_cells; i++) {
+        if (keep == NULL || keep[i]) {
+            leaf_node_append_cell(node, copy, i);
+        }
+    }
+    free(copy);
+}
+
+static uint32_t *internal_node_num_keys(void *node) {
+    return node + INTERNAL_NODE_NUM_KEYS_OFFSET;
+}
+
+static uint32_t *internal_node_right_child(void *node) {
+    return node + INTERNAL_NODE_RIGHT_CHILD_OFFSET;
+}
+
+static void *internal_node_cell(void *node, uint32_t cell_num) {
+    return node + INTERNAL_NODE_HEADER_SIZE + cell_num * INTERNAL_NODE_CELL_SIZE;
+}
+
+//第 child_num 个孩子，child_num == num_keys 时是最右孩子
+static uint32_t *internal_node_child(void *node, uint32_t child_num) {
+    uint32_t num_keys = *internal_node_num_keys(node);
+    if (child_num > num_keys) {
+        printf("Tried to access child_num %d > num_keys %d\n", child_num, num_keys);
+        exit(EXIT_FAILURE);
+    }
+    if (child_num == num_keys) {
+        return internal_node_right_child(node);
+    }
+    return internal_node_cell(node, child_num);
+}
+
+static uint32_t *internal_node_key(void *node, uint32_t key_num) {
+    return internal_node_cell(node, key_num) + INTERNAL_NODE_CHILD_SIZE;
+}
+
+static NodeType get_node_type(void *node) {
+    uint8_t value = *((uint8_t *) (node + NODE_TYPE_OFFSET));
+    return (NodeType) value;
+}
+
+static void set_node_type(void *node, NodeType type) {
+    *((uint8_t *) (node + NODE_TYPE_OFFSET)) = (uint8_t) type;
+}
+
+static bool is_node_root(void *node) {
+    return *((uint8_t *) (node + IS_ROOT_OFFSET));
+}
+
+static void set_node_root(void *node, bool is_root) {
+    *((uint8_t *) (node + IS_ROOT_OFFSET)) = (uint8_t) is_root;
+}
+
+static void initialize_leaf_node(void *node) {
+    set_node_type(node, NODE_LEAF);
+    set_node_root(node, false);
+    *leaf_node_num_cells(node) = 0;
+    *leaf_node_next_leaf(node) = 0;  // 0 表示没有右兄弟，页0 是文件头
+    *leaf_node_content_start(node) = PAGE_SIZE;
+}
+
+static void initialize_internal_node(void *node) {
+    set_node_type(node, NODE_INTERNAL);
+    set_node_root(node, false);
+    *internal_node_num_keys(node) = 0;
+}
+
+static uint32_t *free_page_next(void *node) {
+    return node + FREE_PAGE_NEXT_OFFSET;
+}
+
+//新页优先从空闲页链表里取，没有空闲页时追加在文件末尾；只有写者分配页
+static uint32_t get_unused_page_num(Pager *pager) {
+    if (pager->free_head == 0) {
+        return pager->num_pages;
+    }
+    uint32_t page_num = pager->free_head;
+    void *node = get_page(pager, page_num);
+    pager->free_head = *free_page_next(node);
+    pager->num_free_pages--;
+    pager_unpin(pager, page_num);
+    return page_num;
+}
+
+//上次没有正常关闭时按页号顺序把所有空闲页重新串起来：
+//检查点之后释放或重新用掉的页，文件头里的链表不知道
+static void pager_rebuild_free_list(Pager *pager) {
+    pager->free_head = 0;
+    pager->num_free_pages = 0;
+    for (uint32_t page_num = pager->num_pages; page_num-- > 1;) {
+        void *node = get_page_ro(pager, page_num);
+        bool is_free = get_node_type(node) == NODE_FREE;
+        bool linked = is_free && *free_page_next(node) == pager->free_head;
+        pager_unpin_ro(pager, page_num, node);
+        if (!is_free) {
+            continue;
+        }
+        if (!linked) {
+            node = get_page(pager, page_num);
+            *free_page_next(node) = pager->free_head;
+            pager_mark_dirty(pager, page_num);
+            pager_unpin(pager, page_num);
+        }
+        pager->free_head = page_num;
+        pager->num_free_pages++;
+    }
+}
+
+//不再使用的页放进空闲页链表，调用者已经放掉这一页
+static void pager_free_page(Pager *pager, uint32_t page_num) {
+    void *node = get_page(pager, page_num);
+    memset(node, 0, PAGE_SIZE);
+    set_node_type(node, NODE_FREE);
+    *free_page_next(node) = pager->free_head;
+    pager_mark_dirty(pager, page_num);
+    pager_unpin(pager, page_num);
+    pager->free_head = page_num;
+    pager->num_free_pages++;
+}
+
+//叶子中第一个 key >= 目标 key 的位置
+static uint32_t leaf_node_find_cell(void *node, uint32_t key) {
+    uint32_t min_index = 0;
+    uint32_t one_past_max_index = *leaf_node_num_cells(node);
+    while (one_past_max_index != min_index) {
+        uint32_t index = (min_index + one_past_max_index) / 2;
+        uint32_t key_at_index = *leaf_node_key(node, index);
+        if (key == key_at_index) {
+            return index;
+        }
+        if (key < key_at_index) {
+            one_past_max_index = index;
+        } else {
+            min_index = index + 1;
+        }
+    }
+    return min_index;
+}
+
+//内部节点中应该进入的孩子下标：第一个 key >= 目标 key 的孩子，都小于则进最右孩子
+static uint32_t internal_node_find_child(void *node, uint32_t key) {
+    uint32_t min_index = 0;
+    uint32_t max_index = *internal_node_num_keys(node);
+    while (min_index != max_index) {
+        uint32_t index = (min_index + max_index) / 2;
+        if (*internal_node_key(node, index) >= key) {
+            max_index = index;
+        } else {
+            min_index = index + 1;
+        }
+    }
+    return min_index;
+}
+
+/*
+ * 多版本读
+ * 写操作开始时分配时间戳 commit_clock + 1，写完再把 commit_clock 推进到这个时间戳；
+ * 一次批量插入或导入共用一个时间戳，读者同时看到整批。
+ * 叶子里每个 id 只有一个槽，放最新的内容：插入的行先登记提交时间戳再放进 B+树；
+ * 删除的行只在槽上打删除标记、登记删除时间戳，记录原样留着；
+ * update 和删除后重新插入时，被覆盖的内容连同它可见的时间区间挂在版本表里这一项下面。
+ * 读操作开始时取 commit_clock 作快照，只看时间戳不超过它的提交，扫描期间提交的修改被跳过，
+ * 所以扫描可以中途放掉叶子、之后从下一个 id 重新定位，结果仍是同一时刻的表。
+ * 后台线程把所有活动快照都看到最新内容的版本从表里删掉，没有长扫描时版本表基本是空的；
+ * 版本清掉之后删除标记对谁都生效，写者整理叶子或 .vacuum 时把这样的行真正删掉。
+ * 时间戳只在内存里，打开时文件和日志里已有的行对所有快照可见，已删除的行对所有快照不可见。
+ */
+
+static uint32_t version_slot(uint32_t id, uint32_t capacity) {
+    return (id * 2654435761u) & (capacity - 1);
+}
+
+static bool version_is_empty(const RowVersion *version) {
+    return version->commit_ts == 0 && version->delete_ts == 0;
+}
+
+//版本表里 id 的那一项，没有时返回它该放的空位
+static RowVersion *version_probe(RowVersion *versions, uint32_t capacity, uint32_t id) {
+    uint32_t mask = capacity - 1;
+    for (uint32_t i = version_slot(id, capacity);; i = (i + 1) & mask) {
+        if (version_is_empty(&versions[i]) || versions[i].id == id) {
+            return &versions[i];
+        }
+    }
+}
+
+//查行的版本，不在表里返回 NULL，调用时持有读锁
+static RowVersion *version_find(VersionStore *store, uint32_t id) {
+    if (store->count == 0) {
+        return NULL;
+    }
+    RowVersion *version = version_probe(store->versions, store->capacity, id);
+    return version_is_empty(version) ? NULL : version;
+}
+
+//最新内容在 horizon 之后才提交或删除，还有快照看不到它
+static bool version_survives(const RowVersion *version, uint64_t horizon) {
+    return version->commit_ts > horizon || version->delete_ts > horizon;
+}
+
+static void old_versions_free(OldVersion *old) {
+    while (old != NULL) {
+        OldVersion *next = old->next;
+        free(old);
+        old = next;
+    }
+}
+
+//只保留还有快照看不到的版本，重新散列到 capacity 个位置，调用时持有写锁
+//旧内容在 horizon 之前就被覆盖的，所有快照都看新的，一起释放
+static void version_rebuild(VersionStore *store, uint32_t capacity, uint64_t horizon) {
+    RowVersion *versions = calloc(capacity, sizeof(RowVersion));
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < store->capacity; i++) {
+        RowVersion *version = &store->versions[i];
+        if (version_is_empty(version)) {
+            continue;
+        }
+        if (!version_survives(version, horizon)) {
+            old_versions_free(version->older);
+            continue;
+        }
+        OldVersion **link = &version->older;
+        while (*link != NULL && (*link)->delete_ts > horizon) {
+            link = &(*link)->next;
+        }
+        old_versions_free(*link);
+        *link = NULL;
+        *version_probe(versions, capacity, version->id) = *version;
+        count++;
+    }
+    free(store->versions);
+    store->versions = versions;
+    store->capacity = capacity;
+    store->count = count;
+}
+
+//取 id 的版本项，没有就新占一个位置，调用时持有写锁
+static RowVersion *version_get(VersionStore *store, uint32_t id) {
+    if ((store->count + 1) * 2 > store->capacity) {
+        version_rebuild(store, store->capacity * 2, 0);
+    }
+    RowVersion *version = version_probe(store->versions, store->capacity, id);
+    if (version_is_empty(version)) {
+        version->id = id;
+        version->older = NULL;
+        store->count++;
+    }
+    return version;
+}
+
+//写者把行放进 B+树之前先登记版本
+static void version_add(VersionStore *store, uint32_t id, uint64_t commit_ts) {
+    pthread_rwlock_wrlock(&store->lock);
+    RowVersion *version = version_get(store, id);
+    version->commit_ts = commit_ts;
+    version->delete_ts = 0;
+    atomic_store(&store->newest_ts, commit_ts);
+    pthread_rwlock_unlock(&store->lock);
+}
+
+//写者给槽打删除标记之前先登记删除时间戳；没登记过的行提交时间戳记为 0
+static void version_delete(VersionStore *store, uint32_t id, uint64_t delete_ts) {
+    pthread_rwlock_wrlock(&store->lock);
+    RowVersion *version = version_get(store, id);
+    version->delete_ts = delete_ts;
+    atomic_store(&store->newest_ts, delete_ts);
+    pthread_rwlock_unlock(&store->lock);
+}
+
+//写者覆盖叶子里的内容之前，把旧内容 old_row 挂到版本下面，新内容的提交时间戳是 commit_ts
+//旧内容已经删除时可见到删除为止，否则可见到这次覆盖为止；
+//已删除的行没有版本时删除对所有快照都生效了，旧内容不用留
+static void version_replace(VersionStore *store, uint32_t id, const Row *old_row, bool deleted,
+                            uint64_t commit_ts) {
+    pthread_rwlock_wrlock(&store->lock);
+    RowVersion *version = version_get(store, id);
+    if (!deleted || !version_is_empty(version)) {
+        OldVersion *old = malloc(sizeof(OldVersion));
+        old->row = *old_row;
+        old->commit_ts = version->commit_ts;
+        old->delete_ts = version->delete_ts != 0 ? version->delete_ts : commit_ts;
+        old->next = version->older;
+        version->older = old;
+    }
+    version->commit_ts = commit_ts;
+    version->delete_ts = 0;
+    atomic_store(&store->newest_ts, commit_ts);
+    pthread_rwlock_unlock(&store->lock);
+}
+
+//空表批量导入的行不逐行登记，早于 commit_ts 的快照把不在版本表里的行都当作看不到
+static void version_add_bulk(VersionStore *store, uint64_t commit_ts) {
+    atomic_store(&store->newest_ts, commit_ts);
+    atomic_store(&store->visible_from, commit_ts);
+}
+
+//写操作结束，之后开始的快照能看到它
+static void version_commit(VersionStore *store, uint64_t commit_ts) {
+    atomic_store(&store->commit_clock, commit_ts);
+    if (atomic_load(&store->newest_ts) == commit_ts) {
+        pthread_mutex_lock(&store->snapshot_lock);
+        store->dirty = true;
+        if (store->cleaner_idle) {
+            pthread_cond_signal(&store->cleaner_cond);
+        }
+        pthread_mutex_unlock(&store->snapshot_lock);
+    }
+}
+
+//最老的活动快照的时间戳，没有活动快照时是 commit_clock；调用时持有 snapshot_lock
+//不晚于它的提交和删除对所有快照都生效了
+static uint64_t version_horizon_locked(VersionStore *store) {
+    uint64_t horizon = atomic_load(&store->commit_clock);
+    for (Snapshot *snapshot = store->active; snapshot != NULL; snapshot = snapshot->next) {
+        horizon = snapshot->ts < horizon ? snapshot->ts : horizon;
+    }
+    return horizon;
+}
+
+static uint64_t version_horizon(VersionStore *store) {
+    pthread_mutex_lock(&store->snapshot_lock);
+    uint64_t horizon = version_horizon_locked(store);
+    pthread_mutex_unlock(&store->snapshot_lock);
+    return horizon;
+}
+
+static void *version_cleaner(void *arg) {
+    VersionStore *store = arg;
+    pthread_mutex_lock(&store->snapshot_lock);
+    while (!store->stop) {
+        if (!store->dirty) {
+            store->cleaner_idle = true;
+            pthread_cond_wait(&store->cleaner_cond, &store->snapshot_lock);
+            store->cleaner_idle = false;
+            continue;
+        }
+        store->dirty = false;
+        uint64_t horizon = version_horizon_locked(store);
+        pthread_mutex_unlock(&store->snapshot_lock);
+
+        pthread_rwlock_wrlock(&store->lock);
+        uint32_t survivors = 0;
+        for (uint32_t i = 0; i < store->capacity; i++) {
+            survivors += !version_is_empty(&store->versions[i]) &&
+                         version_survives(&store->versions[i], horizon);
+        }
+        if (survivors < store->count) {
+            uint32_t capacity = VERSION_MIN_CAPACITY;
+            while (capacity < survivors * 2) {
+                capacity *= 2;
+            }
+            version_rebuild(store, capacity, horizon);
+        }
+        pthread_rwlock_unlock(&store->lock);
+
+        //插入很密时不会每次提交都重建一遍
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += VERSION_CLEAN_INTERVAL_MS * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_mutex_lock(&store->snapshot_lock);
+        while (!store->stop &&
+               pthread_cond_timedwait(&store->cleaner_cond, &store->snapshot_lock, &deadline) != ETIMEDOUT) {
+        }
+    }
+    pthread_mutex_unlock(&store->snapshot_lock);
+    return NULL;
+}
+
+static void version_store_init(VersionStore *store) {
+    atomic_init(&store->commit_clock, 0);
+    atomic_init(&store->newest_ts, 0);
+    atomic_init(&store->visible_from, 0);
+    store->capacity = VERSION_MIN_CAPACITY;
+    store->versions = calloc(store->capacity, sizeof(RowVersion));
+    store->count = 0;
+    store->active = NULL;
+    store->dirty = false;
+    store->cleaner_idle = false;
+    store->stop = false;
+    //读者每个叶子都要拿一次读锁，默认的读者优先会让逐行登记的写者一直等
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+#ifdef __GLIBC__
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+    pthread_rwlock_init(&store->lock, &attr);
+    pthread_rwlockattr_destroy(&attr);
+    pthread_mutex_init(&store->snapshot_lock, NULL);
+    pthread_cond_init(&store->cleaner_cond, NULL);
+    pthread_create(&store->cleaner, NULL, version_cleaner, store);
+}
+
+static void version_store_destroy(VersionStore *store) {
+    pthread_mutex_lock(&store->snapshot_lock);
+    store->stop = true;
+    pthread_cond_signal(&store->cleaner_cond);
+    pthread_mutex_unlock(&store->snapshot_lock);
+    pthread_join(store->cleaner, NULL);
+    pthread_cond_destroy(&store->cleaner_cond);
+    pthread_mutex_destroy(&store->snapshot_lock);
+    pthread_rwlock_destroy(&store->lock);
+    for (uint32_t i = 0; i < store->capacity; i++) {
+        old_versions_free(store->versions[i].older);
+    }
+    free(store->versions);
+}
+
+//在 snapshot_lock 里取时间戳，清理线程算出的界限不会越过还没登记的快照
+static void snapshot_begin(VersionStore *store, Snapshot *snapshot) {
+    snapshot->store = store;
+    snapshot->prev = NULL;
+    pthread_mutex_lock(&store->snapshot_lock);
+    snapshot->ts = atomic_load(&store->commit_clock);
+    snapshot->next = store->active;
+    if (store->active != NULL) {
+        store->active->prev = snapshot;
+    }
+    store->active = snapshot;
+    pthread_mutex_unlock(&store->snapshot_lock);
+}
+
+static void snapshot_end(Snapshot *snapshot) {
+    VersionStore *store = snapshot->store;
+    pthread_mutex_lock(&store->snapshot_lock);
+    if (snapshot->prev != NULL) {
+        snapshot->prev->next = snapshot->next;
+    } else {
+        store->active = snapshot->next;
+    }
+    if (snapshot->next != NULL) {
+        snapshot->next->prev = snapshot->prev;
+    }
+    //这个快照之后还有提交，它留住的版本可能可以清理了
+    if (atomic_load(&store->newest_ts) > snapshot->ts) {
+        store->dirty = true;
+        if (store->cleaner_idle) {
+            pthread_cond_signal(&store->cleaner_cond);
+        }
+    }
+    pthread_mutex_unlock(&store->snapshot_lock);
+}
+
+//快照之后没有登记过新版本，叶子里的最新内容都可见、已删除的行都不可见，不用查表
+static bool snapshot_sees_all(const Snapshot *snapshot) {
+    return snapshot->ts >= atomic_load(&snapshot->store->newest_ts);
+}
+
+//快照看到一行的哪个版本
+typedef enum {
+    VERSION_HIDDEN,     //看不到
+    VERSION_CURRENT,    //叶子里的内容
+    VERSION_OLDER       //被覆盖的旧内容，在版本表里
+} VersionVisibility;
+
+//commit_ts 为 0 的提交早于所有快照，除非快照早于空表批量导入
+static bool snapshot_sees_commit(const Snapshot *snapshot, uint64_t commit_ts) {
+    if (commit_ts != 0) {
+        return commit_ts <= snapshot->ts;
+    }
+    return snapshot->ts >= atomic_load(&snapshot->store->visible_from);
+}
+
+//调用时持有版本表读锁，VERSION_OLDER 时 *older 指向看到的旧内容
+//已删除的行没有版本时，删除对所有快照都生效了
+static VersionVisibility snapshot_sees_locked(const Snapshot *snapshot, uint32_t id, bool deleted,
+                                              const Row **older) {
+    RowVersion *version = version_find(snapshot->store, id);
+    if (version == NULL) {
+        return !deleted && snapshot_sees_commit(snapshot, 0) ? VERSION_CURRENT : VERSION_HIDDEN;
+    }
+    if (snapshot_sees_commit(snapshot, version->commit_ts) &&
+        (!deleted || version->delete_ts > snapshot->ts)) {
+        return VERSION_CURRENT;
+    }
+    for (OldVersion *old = version->older; old != NULL; old = old->next) {
+        if (old->delete_ts > snapshot->ts && snapshot_sees_commit(snapshot, old->commit_ts)) {
+            *older = &old->row;
+            return VERSION_OLDER;
+        }
+    }
+    return VERSION_HIDDEN;
+}
+
+//清掉叶子里快照看不到的行，match[i] 对应第 first_cell + i 个 cell，返回剩下的匹配数
+//有行要看旧内容时 *needs_view 置 true，where 条件是按叶子里的新内容求的值，调用者要改用 snapshot_leaf_view
+//整个叶子只拿一次读锁
+static uint32_t snapshot_filter_leaf(const Snapshot *snapshot, void *node, uint32_t first_cell,
+                                     uint8_t *match, uint32_t num_matched, bool *needs_view) {
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    if (snapshot_sees_all(snapshot)) {
+        for (uint32_t i = first_cell; i < num_cells && num_matched > 0; i++) {
+            if (match[i - first_cell] && leaf_node_is_deleted(node, i)) {
+                match[i - first_cell] = 0;
+                num_matched--;
+            }
+        }
+        return num_matched;
+    }
+    pthread_rwlock_rdlock(&snapshot->store->lock);
+    for (uint32_t i = first_cell; i < num_cells; i++) {
+        const Row *older;
+        VersionVisibility visibility = snapshot_sees_locked(snapshot, *leaf_node_key(node, i),
+                                                            leaf_node_is_deleted(node, i), &older);
+        if (visibility == VERSION_OLDER) {
+            *needs_view = true;
+        }
+        if (match[i - first_cell] && visibility != VERSION_CURRENT) {
+            match[i - first_cell] = 0;
+            num_matched--;
+        }
+    }
+    pthread_rwlock_unlock(&snapshot->store->lock);
+    return num_matched;
+}
+
+//按快照拼出叶子从 first_cell 开始的拷贝：看不到的行去掉，要看旧内容的行换成旧内容，不带删除标记
+//旧内容比新内容长时拷贝可能放不下，放满就停，返回下一个还没放进去的 cell
+static uint32_t snapshot_leaf_view(const Snapshot *snapshot, void *node, uint32_t first_cell, void *view) {
+    uint8_t old_record[2 + COLUMN_USERNAME_SIZE + COLUMN_EMAIL_SIZE];
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    initialize_leaf_node(view);
+    *leaf_node_next_leaf(view) = *leaf_node_next_leaf(node);
+    pthread_rwlock_rdlock(&snapshot->store->lock);
+    uint32_t i = first_cell;
+    for (; i < num_cells; i++) {
+        const Row *older;
+        VersionVisibility visibility = snapshot_sees_locked(snapshot, *leaf_node_key(node, i),
+                                                            leaf_node_is_deleted(node, i), &older);
+        if (visibility == VERSION_HIDDEN) {
+            continue;
+        }
+        const void *record = leaf_node_value(node, i);
+        uint32_t length = leaf_node_record_size(node, i);
+        if (visibility == VERSION_OLDER) {
+            record = old_record;
+            length = serialize_row((Row *) older, old_record);
+        }
+        if (leaf_node_free_space(view) < LEAF_NODE_SLOT_SIZE + length) {
+            break;
+        }
+        leaf_node_append(view, *leaf_node_key(node, i), record, length);
+    }
+    pthread_rwlock_unlock(&snapshot->store->lock);
+    return i;
+}
+
+static void *cursor_get_node(Cursor *cursor, uint32_t page_num) {
+    if (cursor->read_only) {
+        return get_page_ro(cursor->table->pager, page_num);
+    }
+    return get_page(cursor->table->pager, page_num);
+}
+
+static void cursor_release_node(Cursor *cursor, uint32_t page_num, void *node) {
+    if (cursor->read_only) {
+        pager_unpin_ro(cursor->table->pager, page_num, node);
+    } else {
+        pager_unpin(cursor->table->pager, page_num);
+    }
+}
+
+//从根下降到 key 所在的叶子，沿途记录路径供分裂时回溯
+//返回的游标钉住了叶子页，用完调用 cursor_close
+static Cursor *table_descend(Table *table, uint32_t key, bool read_only) {
+    Cursor *cursor = malloc(sizeof(Cursor));
+    cursor->table = table;
+    cursor->depth = 0;
+    cursor->read_only = read_only;
+    cursor->snapshot = NULL;
+    cursor->leaf_copy = NULL;
+    cursor->older_rows = NULL;
+
+    uint32_t page_num = table->root_page_num;
+    void *node = cursor_get_node(cursor, page_num);
+    while (get_node_type(node) == NODE_INTERNAL) {
+        if (cursor->depth == BTREE_MAX_DEPTH) {
+            printf("B+tree deeper than %d levels\n", BTREE_MAX_DEPTH);
+            exit(EXIT_FAILURE);
+        }
+        uint32_t child_index = internal_node_find_child(node, key);
+        uint32_t child_page_num = *internal_node_child(node, child_index);
+        cursor->path_pages[cursor->depth] = page_num;
+        cursor->path_slots[cursor->depth] = child_index;
+        cursor->depth++;
+
+        //先取孩子再放父节点，读者沿途不会看到分裂到一半的孩子
+        void *child = cursor_get_node(cursor, child_page_num);
+        cursor_release_node(cursor, page_num, node);
+        page_num = child_page_num;
+        node = child;
+    }
+
+    cursor->page_num = page_num;
+    cursor->node = node;
+    cursor->cell_num = leaf_node_find_cell(node, key);
+    cursor->end_of_table = false;
+    return cursor;
+}
+
+//写游标：定位到 key 的插入位置
+static Cursor *table_find(Table *table, uint32_t key) {
+    return table_descend(table, key, false);
+}
+
+static uint32_t cursor_key(Cursor *cursor) {
+    return *leaf_node_key(cursor->node, cursor->cell_num);
+}
+
+//游标越过叶子末尾时移动到下一个非空叶子
+static void cursor_settle(Cursor *cursor) {
+    while (cursor->cell_num >= *leaf_node_num_cells(cursor->node)) {
+        uint32_t next_page_num = *leaf_node_next_leaf(cursor->node);
+        if (next_page_num == 0) {
+            cursor->end_of_table = true;
+            return;
+        }
+        void *next_node = cursor_get_node(cursor, next_page_num);
+        cursor_release_node(cursor, cursor->page_num, cursor->node);
+        cursor->page_num = next_page_num;
+        cursor->node = next_node;
+        cursor->cell_num = 0;
+    }
+}
+
+//只读游标指向表的第一行
+static Cursor *table_start(Table *table) {
+    Cursor *cursor = table_descend(table, 0, true);
+    cursor_settle(cursor);
+    return cursor;
+}
+
+//只读游标指向第一个 id >= key 的行
+//写者分裂叶子后、更新父节点前，按旧分隔 key 下降会落在偏左的叶子上，沿叶子链表向右找
+static Cursor *table_seek(Table *table, uint32_t key) {
+    Cursor *cursor = table_descend(table, key, true);
+    cursor_settle(cursor);
+    while (!cursor->end_of_table && cursor_key(cursor) < key) {
+        cursor->cell_num = leaf_node_find_cell(cursor->node, key);
+        cursor_settle(cursor);
+    }
+    return cursor;
+}
+
+static void cursor_close(Cursor *cursor) {
+    //写游标的叶子分裂后已经放掉了；迭代器读的是叶子的拷贝
+    if (cursor->leaf_copy != NULL) {
+        snapshot_end(cursor->snapshot);
+        free(cursor->snapshot);
+        free(cursor->leaf_copy);
+        free(cursor->visible);
+        free(cursor->older_rows);
+    } else if (cursor->node != NULL) {
+        cursor_release_node(cursor, cursor->page_num, cursor->node);
+    }
+    free(cursor);
+}
+
+//逐个 cell 记下快照看到哪个版本，旧内容在放掉版本表的锁之前拷出来
+static void iterator_filter_leaf(Cursor *iterator) {
+    void *node = iterator->leaf_copy;
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    const Snapshot *snapshot = iterator->snapshot;
+    if (snapshot_sees_all(snapshot)) {
+        for (uint32_t i = 0; i < num_cells; i++) {
+            iterator->visible[i] = leaf_node_is_deleted(node, i) ? VERSION_HIDDEN : VERSION_CURRENT;
+        }
+        return;
+    }
+    pthread_rwlock_rdlock(&snapshot->store->lock);
+    for (uint32_t i = 0; i < num_cells; i++) {
+        const Row *older;
+        iterator->visible[i] = snapshot_sees_locked(snapshot, *leaf_node_key(node, i),
+                                                    leaf_node_is_deleted(node, i), &older);
+        if (iterator->visible[i] == VERSION_OLDER) {
+            if (iterator->older_rows == NULL) {
+                iterator->older_rows = malloc(sizeof(Row) * LEAF_NODE_MAX_CELLS);
+            }
+            iterator->older_rows[i] = *older;
+        }
+    }
+    pthread_rwlock_unlock(&snapshot->store->lock);
+}
+
+//迭代器定位到第一个 id >= key 的行：拷贝叶子后放掉，不挡写者
+static void iterator_seek(Cursor *iterator, uint32_t key) {
+    Cursor *cursor = table_seek(iterator->table, key);
+    iterator->end_of_table = cursor->end_of_table;
+    if (!cursor->end_of_table) {
+        memcpy(iterator->leaf_copy, cursor->node, PAGE_SIZE);
+        iterator->page_num = cursor->page_num;
+        iterator->cell_num = cursor->cell_num;
+        iterator_filter_leaf(iterator);
+    }
+    cursor_close(cursor);
+}
+
+//公开的行迭代器：开始时取快照，之后提交的行不出现；每次读完一个叶子的拷贝再按下一个 id 重新定位
+Cursor *db_scan(Table *table, uint32_t first_id) {
+    Cursor *iterator = malloc(sizeof(Cursor));
+    iterator->table = table;
+    iterator->read_only = true;
+    iterator->depth = 0;
+    iterator->snapshot = malloc(sizeof(Snapshot));
+    iterator->leaf_copy = malloc(PAGE_SIZE);
+    iterator->visible = malloc(LEAF_NODE_MAX_CELLS);
+    iterator->older_rows = NULL;
+    iterator->node = iterator->leaf_copy;
+    snapshot_begin(&table->versions, iterator->snapshot);
+    iterator_seek(iterator, first_id);
+    return iterator;
+}
+
+bool db_cursor_next(Cursor *cursor, Row *row) {
+    while (!cursor->end_of_table) {
+        void *node = cursor->leaf_copy;
+        uint32_t num_cells = *leaf_node_num_cells(node);
+        if (cursor->cell_num >= num_cells) {
+            uint32_t last_key = *leaf_node_key(node, num_cells - 1);
+            if (*leaf_node_next_leaf(node) == 0 || last_key == UINT32_MAX) {
+                cursor->end_of_table = true;
+                break;
+            }
+            iterator_seek(cursor, last_key + 1);
+            continue;
+        }
+        uint32_t cell_num = cursor->cell_num++;
+        if (cursor->visible[cell_num] == VERSION_CURRENT) {
+            leaf_node_read_row(node, cell_num, row);
+            return true;
+        }
+        if (cursor->visible[cell_num] == VERSION_OLDER) {
+            *row = cursor->older_rows[cell_num];
+            return true;
+        }
+    }
+    return false;
+}
+
+void db_cursor_close(Cursor *cursor) {
+    cursor_close(cursor);
+}
+
+//把整个节点搬到新页，根节点分裂时用，保证根始终在同一页
+static uint32_t btree_move_root_out(Table *table) {
+    Pager *pager = table->pager;
+    uint32_t new_page_num = get_unused_page_num(pager);
+    void *root = get_page(pager, table->root_page_num);
+    void *new_node = get_page(pager, new_page_num);
+    memcpy(new_node, root, PAGE_SIZE);
+    set_node_root(new_node, false);
+    pager_mark_dirty(pager, new_page_num);
+    pager_unpin(pager, new_page_num);
+    pager_unpin(pager, table->root_page_num);
+    return new_page_num;
+}
+
+//根分裂后重建根：左右两个孩子，一个 key
+static void btree_create_new_root(Table *table, uint32_t left_page_num,
+                                  uint32_t key, uint32_t right_page_num) {
+    Pager *pager = table->pager;
+    void *root = get_page(pager, table->root_page_num);
+    initialize_internal_node(root);
+    set_node_root(root, true);
+    *internal_node_num_keys(root) = 1;
+    *internal_node_child(root, 0) = left_page_num;
+    *internal_node_key(root, 0) = key;
+    *internal_node_right_child(root) = right_page_num;
+    pager_mark_dirty(pager, table->root_page_num);
+    pager_unpin(pager, table->root_page_num);
+}
+
+//孩子 path_slots[level] 分裂成 (左, 右)，把分隔 key 插入路径上第 level 层的内部节点
+static void internal_node_insert(Cursor *cursor, uint32_t level,
+                                 uint32_t left_page_num, uint32_t key,
+                                 uint32_t right_page_num) {
+    Table *table = cursor->table;
+    Pager *pager = table->pager;
+    uint32_t page_num = cursor->path_pages[level];
+    uint32_t index = cursor->path_slots[level];
+    void *node = get_page(pager, page_num);
+    uint32_t num_keys = *internal_node_num_keys(node);
+
+    if (num_keys < INTERNAL_NODE_MAX_KEYS) {
+        if (index == num_keys) {
+            //分裂的是最右孩子
+            *internal_node_num_keys(node) = num_keys + 1;
+            *internal_node_child(node, num_keys) = left_page_num;
+            *internal_node_key(node, num_keys) = key;
+            *internal_node_right_child(node) = right_page_num;
+        } else {
+            memmove(internal_node_cell(node, index + 1),
+                    internal_node_cell(node, index),
+                    (num_keys - index) * INTERNAL_NODE_CELL_SIZE);
+            *internal_node_num_keys(node) = num_keys + 1;
+            *internal_node_child(node, index) = left_page_num;
+            *internal_node_key(node, index) = key;
+            *internal_node_child(node, index + 1) = right_page_num;
+        }
+        pager_mark_dirty(pager, page_num);
+        pager_unpin(pager, page_num);
+        return;
+    }
+
+    //节点已满：先在临时数组里插入，再对半分
+    uint32_t total = num_keys + 1;
+    uint32_t *children = malloc(sizeof(uint32_t) * (total + 1));
+    uint32_t *keys = malloc(sizeof(uint32_t) * total);
+    for (uint32_t i = 0, j = 0; i <= num_keys; i++) {
+        if (i == index) {
+            children[j] = left_page_num;
+            keys[j] = key;
+            j++;
+            children[j] = right_page_num;
+            if (i < num_keys) {
+                keys[j] = *internal_node_key(node, i);
+            }
+            j++;
+        } else {
+            children[j] = *internal_node_child(node, i);
+            if (i < num_keys) {
+                keys[j] = *internal_node_key(node, i);
+            }
+            j++;
+        }
+    }
+
+    bool splitting_root = (page_num == table->root_page_num);
+    uint32_t left_node_page_num = page_num;
+    if (splitting_root) {
+        pager_unpin(pager, page_num);
+        left_node_page_num = btree_move_root_out(table);
+        node = get_page(pager, left_node_page_num);
+    }
+    uint32_t new_page_num = get_unused_page_num(pager);
+    void *new_node = get_page(pager, new_page_num);
+    initialize_internal_node(new_node);
+
+    //左边保留 children[0..split]，keys[split] 上移到父节点
+    uint32_t split = total / 2;
+    *internal_node_num_keys(node) = split;
+    for (uint32_t i = 0; i < split; i++) {
+        *internal_node_child(node, i) = children[i];
+        *internal_node_key(node, i) = keys[i];
+    }
+    *internal_node_right_child(node) = children[split];
+
+    *internal_node_num_keys(new_node) = total - split - 1;
+    for (uint32_t i = split + 1; i < total; i++) {
+        *internal_node_child(new_node, i - split - 1) = children[i];
+        *internal_node_key(new_node, i - split - 1) = keys[i];
+    }
+    *internal_node_right_child(new_node) = children[total];
+    uint32_t up_key = keys[split];
+    free(children);
+    free(keys);
+
+    pager_mark_dirty(pager, left_node_page_num);
+    pager_mark_dirty(pager, new_page_num);
+    pager_unpin(pager, left_node_page_num);
+    pager_unpin(pager, new_page_num);
+
+    if (splitting_root) {
+        btree_create_new_root(table, left_node_page_num, up_key, new_page_num);
+    } else {
+        internal_node_insert(cursor, level - 1, left_node_page_num, up_key, new_page_num);
+    }
+}
+
+//叶子放不下新行，一分为二后再插入。按字节数而不是行数对半分
+static void leaf_node_split_and_insert(Cursor *cursor, uint32_t key, Row *value) {
+    Table *table = cursor->table;
+    Pager *pager = table->pager;
+    void *old_node = cursor->node;
+    uint32_t old_page_num = cursor->page_num;
+
+    bool splitting_root = (old_page_num == table->root_page_num);
+    if (splitting_root) {
+        //根页保持不动，先把根的内容搬到新页，再按普通叶子分裂
+        pager_unpin(pager, old_page_num);
+        old_page_num = btree_move_root_out(table);
+        old_node = get_page(pager, old_page_num);
+        cursor->page_num = old_page_num;
+        cursor->node = old_node;
+    }
+
+    uint32_t new_page_num = get_unused_page_num(pager);
+    void *new_node = get_page(pager, new_page_num);
+    initialize_leaf_node(new_node);
+    *leaf_node_next_leaf(new_node) = *leaf_node_next_leaf(old_node);
+
+    //旧节点先拷出来，再把原有 cell 和新 cell 按顺序重新排进左右两个节点
+    char *old_copy = malloc(PAGE_SIZE);
+    memcpy(old_copy, old_node, PAGE_SIZE);
+    uint8_t new_record[2 + COLUMN_USERNAME_SIZE + COLUMN_EMAIL_SIZE];
+    uint32_t new_length = serialize_row(value, new_record);
+
+    uint32_t old_cells = *leaf_node_num_cells(old_copy);
+    uint32_t total = old_cells + 1;
+    uint32_t total_bytes = LEAF_NODE_SLOT_SIZE + new_length;
+    for (uint32_t i = 0; i < old_cells; i++) {
+        total_bytes += LEAF_NODE_SLOT_SIZE + leaf_node_record_size(old_copy, i);
+    }
+
+    initialize_leaf_node(old_node);
+    *leaf_node_next_leaf(old_node) = new_page_num;
+    uint32_t left_bytes = 0;
+    bool to_left = true;
+    for (uint32_t i = 0; i < total; i++) {
+        uint32_t cell_key;
+        const void *record;
+        uint32_t length;
+        uint16_t deleted = 0;
+        if (i == cursor->cell_num) {
+            cell_key = key;
+            record = new_record;
+            length = new_length;
+        } else {
+            uint32_t source = i < cursor->cell_num ? i : i - 1;
+            cell_key = *leaf_node_key(old_copy, source);
+            record = leaf_node_value(old_copy, source);
+            length = leaf_node_record_size(old_copy, source);
+            deleted = *leaf_node_record_length(old_copy, source) & LEAF_NODE_TOMBSTONE;
+        }
+        //左边攒够一半就换到右边，最后一个 cell 一定在右边
+        if (left_bytes >= total_bytes / 2 || i == total - 1) {
+            to_left = false;
+        }
+        if (to_left) {
+            left_bytes += LEAF_NODE_SLOT_SIZE + length;
+        }
+        void *target = to_left ? old_node : new_node;
+        leaf_node_append(target, cell_key, record, length);
+        *leaf_node_record_length(target, *leaf_node_num_cells(target) - 1) |= deleted;
+    }
+    free(old_copy);
+    uint32_t separator = *leaf_node_key(old_node, *leaf_node_num_cells(old_node) - 1);
+
+    pager_mark_dirty(pager, old_page_num);
+    pager_mark_dirty(pager, new_page_num);
+    pager_unpin(pager, new_page_num);
+    //往上改父节点之前放掉叶子，持有孩子时不取祖先
+    pager_unpin(pager, old_page_num);
+    cursor->node = NULL;
+
+    if (splitting_root) {
+        btree_create_new_root(table, old_page_num, separator, new_page_num);
+    } else {
+        internal_node_insert(cursor, cursor->depth - 1, old_page_num, separator, new_page_num);
+    }
+}
+
+//清掉叶子里对所有快照都不可见了的已删除行，再把记录区整理紧凑，返回清掉的行数
+//调用时独占持有叶子
+static uint32_t leaf_node_purge(Table *table, void *node) {
+    VersionStore *store = &table->versions;
+    uint64_t horizon = version_horizon(store);
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    uint32_t num_kept = 0;
+    uint8_t keep[LEAF_NODE_MAX_CELLS];
+    pthread_rwlock_rdlock(&store->lock);
+    for (uint32_t i = 0; i < num_cells; i++) {
+        keep[i] = 1;
+        if (leaf_node_is_deleted(node, i)) {
+            RowVersion *version = version_find(store, *leaf_node_key(node, i));
+            if (version == NULL || version->delete_ts <= horizon) {
+                keep[i] = 0;
+                continue;
+            }
+        }
+        num_kept++;
+    }
+    pthread_rwlock_unlock(&store->lock);
+    if (num_kept < num_cells) {
+        atomic_fetch_sub(&table->num_tombstones, num_cells - num_kept);
+    }
+    leaf_node_defragment(node, keep);
+    return num_cells - num_kept;
+}
+
+//叶子里有空洞或已删除的行，整理一下可能就不用分裂
+static bool leaf_node_reclaimable(void *node) {
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    for (uint32_t i = 0; i < num_cells; i++) {
+        if (leaf_node_is_deleted(node, i)) {
+            return true;
+        }
+    }
+    return LEAF_NODE_HEADER_SIZE + leaf_node_used_space(node) + leaf_node_free_space(node) < PAGE_SIZE;
+}
+
+//在游标位置插入
+static void leaf_node_insert(Cursor *cursor, uint32_t key, Row *value) {
+    void *node = cursor->node;
+    uint32_t record_size = row_record_size(value);
+    if (leaf_node_free_space(node) < LEAF_NODE_SLOT_SIZE + record_size && leaf_node_reclaimable(node)) {
+        //先收回删除留下的空间，槽可能前移了，重新定位
+        leaf_node_purge(cursor->table, node);
+        cursor->cell_num = leaf_node_find_cell(node, key);
+    }
+    if (leaf_node_free_space(node) < LEAF_NODE_SLOT_SIZE + record_size) {
+        leaf_node_split_and_insert(cursor, key, value);
+        return;
+    }
+
+    //给新 cell 腾出 key 和记录槽的位置，记录本身不用动
+    leaf_node_open_cell(node, cursor->cell_num);
+    *leaf_node_content_start(node) -= record_size;
+    serialize_row(value, node + *leaf_node_content_start(node));
+    *leaf_node_key(node, cursor->cell_num) = key;
+    *leaf_node_record_offset(node, cursor->cell_num) = *leaf_node_content_start(node);
+    *leaf_node_record_length(node, cursor->cell_num) = record_size;
+    pager_mark_dirty(cursor->table->pager, cursor->page_num);
+}
+
+/*
+ * 哈希索引
+ * username / email 上的等值查找用线性哈希。元数据页记着 level、分裂指针和各段第一个桶页的页号，
+ * 段 0 是桶 0，段 s 是桶 [2^(s-1), 2^s)，同一段的桶页在文件里连续，桶号直接算出页号，
+ * 查找只读元数据页和一个桶页。平均装载超过 HASH_INDEX_FILL_PERCENT 时分裂分裂指针指向的桶。
+ * 桶里存列值的哈希和行 id，不存行在叶子里的位置：叶子分裂时行会移动，id 不变。
+ * delete 和 update 不删旧的项，查找时按快照核对行的内容，旧快照还能通过旧的项找到旧内容；
+ * 没有快照再需要的项由 .vacuum 清掉，所以索引里的项总是包含所有快照能看到的行。
+ * 页闩按元数据页、桶页、溢出页的顺序取；读者拿到桶页就放掉元数据页，回表核对之前放掉所有索引页。
+ * 只有写者改索引，写者持有元数据页期间读者进不了任何桶。
+ */
+
+static uint32_t *hash_meta_column(void *node) {
+    return node + HASH_META_COLUMN_OFFSET;
+}
+
+static uint32_t *hash_meta_level(void *node) {
+    return node + HASH_META_LEVEL_OFFSET;
+}
+
+static uint32_t *hash_meta_split(void *node) {
+    return node + HASH_META_SPLIT_OFFSET;
+}
+
+static uint32_t *hash_meta_num_entries(void *node) {
+    return node + HASH_META_NUM_ENTRIES_OFFSET;
+}
+
+static uint32_t *hash_meta_segment(void *node, uint32_t segment) {
+    return node + HASH_META_SEGMENTS_OFFSET + segment * sizeof(uint32_t);
+}
+
+static uint32_t *hash_bucket_num_entries(void *node) {
+    return node + HASH_BUCKET_NUM_ENTRIES_OFFSET;
+}
+
+static uint32_t *hash_bucket_overflow(void *node) {
+    return node + HASH_BUCKET_OVERFLOW_OFFSET;
+}
+
+static HashEntry *hash_bucket_entry(void *node, uint32_t index) {
+    return node + HASH_BUCKET_HEADER_SIZE + index * sizeof(HashEntry);
+}
+
+static void initialize_hash_bucket(void *node) {
+    set_node_type(node, NODE_HASH_BUCKET);
+    set_node_root(node, false);
+    *hash_bucket_num_entries(node) = 0;
+    *hash_bucket_overflow(node) = 0;
+}
+
+//FNV-1a
+static uint32_t text_hash(const char *text, uint32_t length) {
+    uint32_t h = 2166136261u;
+    for (uint32_t i = 0; i < length; i++) {
+        h = (h ^ (uint8_t) text[i]) * 16777619u;
+    }
+    return h;
+}
+
+static uint32_t row_column_hash(const Row *row, Column column) {
+    const char *text = column == COLUMN_USERNAME ? row->username : row->email;
+    return text_hash(text, strlen(text));
+}
+
+//哈希值落在哪个桶：先看低 level 位，那个桶已经分裂过就多看一位
+static uint32_t hash_meta_bucket(void *meta, uint32_t hash) {
+    uint32_t level = *hash_meta_level(meta);
+    uint32_t bucket = hash & ((1u << level) - 1);
+    if (bucket < *hash_meta_split(meta)) {
+        bucket = hash & ((2u << level) - 1);
+    }
+    return bucket;
+}
+
+static uint32_t hash_meta_num_buckets(void *meta) {
+    return (1u << *hash_meta_level(meta)) + *hash_meta_split(meta);
+}
+
+static uint32_t hash_bucket_segment(uint32_t bucket) {
+    return bucket == 0 ? 0 : 32 - __builtin_clz(bucket);
+}
+
+static uint32_t hash_bucket_page(void *meta, uint32_t bucket) {
+    uint32_t segment = hash_bucket_segment(bucket);
+    uint32_t first_bucket = segment == 0 ? 0 : 1u << (segment - 1);
+    return *hash_meta_segment(meta, segment) + (bucket - first_bucket);
+}
+
+//在文件末尾连续预留 count 页：文件先扩到新长度，没写过的页读出来是全 0；只有写者调用
+static uint32_t pager_reserve_pages(Pager *pager, uint32_t count) {
+    pthread_mutex_lock(&pager->lock);
+    uint32_t first_page = pager->num_pages;
+    off_t length = (off_t) (first_page + count) * PAGE_SIZE;
+    //压缩文件里没写过的页读出来就是全零，不用占位置
+    if (!pager->compressed && length > pager->file_length) {
+        if (ftruncate(pager->file_descriptor, length) == -1) {
+            printf("Error extending db file: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+        pager->file_length = length;
+    }
+    pager->num_pages = first_page + count;
+    pthread_mutex_unlock(&pager->lock);
+    return first_page;
+}
+
+//建一个空索引：元数据页和桶 0，返回元数据页号
+static uint32_t hash_index_create(Pager *pager, Column column) {
+    uint32_t meta_page_num = get_unused_page_num(pager);
+    void *meta = get_page(pager, meta_page_num);
+    memset(meta, 0, PAGE_SIZE);
+    set_node_type(meta, NODE_HASH_META);
+    *hash_meta_column(meta) = column;
+
+    uint32_t bucket_page_num = get_unused_page_num(pager);
+    void *bucket = get_page(pager, bucket_page_num);
+    initialize_hash_bucket(bucket);
+    *hash_meta_segment(meta, 0) = bucket_page_num;
+    pager_mark_dirty(pager, bucket_page_num);
+    pager_unpin(pager, bucket_page_num);
+    pager_mark_dirty(pager, meta_page_num);
+    pager_unpin(pager, meta_page_num);
+    return meta_page_num;
+}
+
+//读出整个桶链表的项，调用时独占持有元数据页
+static uint32_t hash_bucket_collect(Pager *pager, uint32_t page_num, HashEntry **entries) {
+    uint32_t count = 0;
+    uint32_t capacity = HASH_BUCKET_MAX_ENTRIES;
+    *entries = malloc(sizeof(HashEntry) * capacity);
+    while (page_num != 0) {
+        void *page = get_page(pager, page_num);
+        uint32_t num_entries = *hash_bucket_num_entries(page);
+        if (count + num_entries > capacity) {
+            capacity = count + num_entries;
+            *entries = realloc(*entries, sizeof(HashEntry) * capacity);
+        }
+        memcpy(*entries + count, hash_bucket_entry(page, 0), sizeof(HashEntry) * num_entries);
+        count += num_entries;
+        uint32_t next_page_num = *hash_bucket_overflow(page);
+        pager_unpin(pager, page_num);
+        page_num = next_page_num;
+    }
+    return count;
+}
+
+//把桶链表重写成 entries，不够放时接上溢出页，多出来的溢出页放回空闲页链表，返回释放的页数
+static uint32_t hash_bucket_rewrite(Pager *pager, uint32_t page_num, const HashEntry *entries, uint32_t count) {
+    void *page = get_page(pager, page_num);
+    while (true) {
+        uint32_t num_entries = count < HASH_BUCKET_MAX_ENTRIES ? count : HASH_BUCKET_MAX_ENTRIES;
+        memcpy(hash_bucket_entry(page, 0), entries, sizeof(HashEntry) * num_entries);
+        *hash_bucket_num_entries(page) = num_entries;
+        entries += num_entries;
+        count -= num_entries;
+        pager_mark_dirty(pager, page_num);
+        if (count == 0) {
+            break;
+        }
+        uint32_t next_page_num = *hash_bucket_overflow(page);
+        if (next_page_num == 0) {
+            next_page_num = get_unused_page_num(pager);
+            void *next = get_page(pager, next_page_num);
+            initialize_hash_bucket(next);
+            *hash_bucket_overflow(page) = next_page_num;
+            pager_unpin(pager, page_num);
+            page = next;
+        } else {
+            void *next = get_page(pager, next_page_num);
+            pager_unpin(pager, page_num);
+            page = next;
+        }
+        page_num = next_page_num;
+    }
+
+    uint32_t num_freed = 0;
+    uint32_t next_page_num = *hash_bucket_overflow(page);
+    *hash_bucket_overflow(page) = 0;
+    pager_unpin(pager, page_num);
+    while (next_page_num != 0) {
+        void *next = get_page(pager, next_page_num);
+        uint32_t after = *hash_bucket_overflow(next);
+        pager_unpin(pager, next_page_num);
+        pager_free_page(pager, next_page_num);
+        next_page_num = after;
+        num_freed++;
+    }
+    return num_freed;
+}
+
+//分裂指针指向的桶按多看一位哈希值拆成两个，调用时独占持有元数据页
+static void hash_index_split(Pager *pager, void *meta) {
+    uint32_t level = *hash_meta_level(meta);
+    uint32_t split = *hash_meta_split(meta);
+    if (level + 1 >= HASH_MAX_SEGMENTS) {
+        return;
+    }
+    uint32_t new_bucket = split + (1u << level);
+    if (split == 0) {
+        //开始新的一段：2^level 个桶页一次预留在文件末尾
+        *hash_meta_segment(meta, level + 1) = pager_reserve_pages(pager, 1u << level);
+    }
+    uint32_t old_page_num = hash_bucket_page(meta, split);
+    uint32_t new_page_num = hash_bucket_page(meta, new_bucket);
+
+    HashEntry *entries;
+    uint32_t count = hash_bucket_collect(pager, old_page_num, &entries);
+    HashEntry *moved = malloc(sizeof(HashEntry) * (count + 1));
+    uint32_t num_kept = 0;
+    uint32_t num_moved = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (entries[i].hash & (1u << level)) {
+            moved[num_moved++] = entries[i];
+        } else {
+            entries[num_kept++] = entries[i];
+        }
+    }
+    hash_bucket_rewrite(pager, old_page_num, entries, num_kept);
+    void *page = get_page(pager, new_page_num);
+    initialize_hash_bucket(page);
+    pager_unpin(pager, new_page_num);
+    hash_bucket_rewrite(pager, new_page_num, moved, num_moved);
+    free(entries);
+    free(moved);
+
+    if (++split == 1u << level) {
+        *hash_meta_level(meta) = level + 1;
+        split = 0;
+    }
+    *hash_meta_split(meta) = split;
+}
+
+//登记 (hash, id)，已经有这一项时什么都不做；调用时持有写者锁
+static void hash_index_add(Pager *pager, uint32_t meta_page_num, uint32_t hash, uint32_t id) {
+    void *meta = get_page(pager, meta_page_num);
+    uint32_t page_num = hash_bucket_page(meta, hash_meta_bucket(meta, hash));
+    void *page = get_page(pager, page_num);
+    while (true) {
+        uint32_t num_entries = *hash_bucket_num_entries(page);
+        for (uint32_t i = 0; i < num_entries; i++) {
+            HashEntry *entry = hash_bucket_entry(page, i);
+            if (entry->hash == hash && entry->id == id) {
+                pager_unpin(pager, page_num);
+                pager_unpin(pager, meta_page_num);
+                return;
+            }
+        }
+        uint32_t next_page_num = *hash_bucket_overflow(page);
+        if (next_page_num == 0) {
+            break;
+        }
+        void *next = get_page(pager, next_page_num);
+        pager_unpin(pager, page_num);
+        page_num = next_page_num;
+        page = next;
+    }
+
+    if (*hash_bucket_num_entries(page) == HASH_BUCKET_MAX_ENTRIES) {
+        uint32_t overflow_page_num = get_unused_page_num(pager);
+        void *overflow = get_page(pager, overflow_page_num);
+        initialize_hash_bucket(overflow);
+        *hash_bucket_overflow(page) = overflow_page_num;
+        pager_mark_dirty(pager, page_num);
+        pager_unpin(pager, page_num);
+        page_num = overflow_page_num;
+        page = overflow;
+    }
+    uint32_t index = (*hash_bucket_num_entries(page))++;
+    hash_bucket_entry(page, index)->hash = hash;
+    hash_bucket_entry(page, index)->id = id;
+    pager_mark_dirty(pager, page_num);
+    pager_unpin(pager, page_num);
+
+    uint64_t num_entries = ++*hash_meta_num_entries(meta);
+    uint64_t capacity = (uint64_t) hash_meta_num_buckets(meta) * HASH_BUCKET_MAX_ENTRIES;
+    if (num_entries * 100 > capacity * HASH_INDEX_FILL_PERCENT) {
+        hash_index_split(pager, meta);
+    }
+    pager_mark_dirty(pager, meta_page_num);
+    pager_unpin(pager, meta_page_num);
+}
+
+//哈希值为 hash 的所有 id，可能包括已经删除或改过这一列的行，调用者按快照核对；返回个数
+static uint32_t hash_index_lookup(Pager *pager, uint32_t meta_page_num, uint32_t hash, uint32_t **ids) {
+    uint32_t count = 0;
+    uint32_t capacity = 16;
+    *ids = malloc(sizeof(uint32_t) * capacity);
+    void *meta = get_page_ro(pager, meta_page_num);
+    uint32_t page_num = hash_bucket_page(meta, hash_meta_bucket(meta, hash));
+    void *page = get_page_ro(pager, page_num);
+    pager_unpin_ro(pager, meta_page_num, meta);
+    while (true) {
+        uint32_t num_entries = *hash_bucket_num_entries(page);
+        for (uint32_t i = 0; i < num_entries; i++) {
+            HashEntry *entry = hash_bucket_entry(page, i);
+            if (entry->hash != hash) {
+                continue;
+            }
+            if (count == capacity) {
+                capacity *= 2;
+                *ids = realloc(*ids, sizeof(uint32_t) * capacity);
+            }
+            (*ids)[count++] = entry->id;
+        }
+        uint32_t next_page_num = *hash_bucket_overflow(page);
+        if (next_page_num == 0) {
+            break;
+        }
+        void *next = get_page_ro(pager, next_page_num);
+        pager_unpin_ro(pager, page_num, page);
+        page_num = next_page_num;
+        page = next;
+    }
+    pager_unpin_ro(pager, page_num, page);
+    return count;
+}
+
+//写路径上每放进一行内容调用一次，登记进所有索引
+static void table_index_row(Table *table, const Row *row) {
+    for (uint32_t i = 0; i < NUM_INDEX_COLUMNS; i++) {
+        uint32_t meta_page_num = atomic_load(&table->index_pages[i]);
+        if (meta_page_num != 0) {
+            hash_index_add(table->pager, meta_page_num, row_column_hash(row, COLUMN_USERNAME + i), row->id);
+        }
+    }
+}
+
+//把表里现有的行登记进第 slot 个索引，调用时持有写者锁，没有别的写者，叶子里的内容就是当前已提交的内容
+static void table_index_existing(Table *table, uint32_t slot) {
+    uint32_t meta_page_num = atomic_load(&table->index_pages[slot]);
+    if (meta_page_num == 0) {
+        return;
+    }
+    Cursor *cursor = table_start(table);
+    while (!cursor->end_of_table) {
+        if (!leaf_node_is_deleted(cursor->node, cursor->cell_num)) {
+            Row row;
+            leaf_node_read_row(cursor->node, cursor->cell_num, &row);
+            hash_index_add(table->pager, meta_page_num, row_column_hash(&row, COLUMN_USERNAME + slot), row.id);
+        }
+        cursor->cell_num++;
+        cursor_settle(cursor);
+    }
+    cursor_close(cursor);
+}
+
+/*
+ * 压缩文件的写回：页换到新位置，旧位置在下一个检查点之后才重用
+ */
+
+static uint32_t extent_units(uint32_t length) {
+    return (length + PAGER_EXTENT_UNIT - 1) / PAGER_EXTENT_UNIT;
+}
+
+//放回一段空闲位置，和前后相邻的空闲段合并；合并后到了文件末尾就直接缩短末尾，文件在检查点时截短
+static void pager_release_run(Pager *pager, uint32_t offset, uint32_t units) {
+    if (units == 0) {
+        return;
+    }
+    //找第一个偏移大于 offset 的空闲段
+    uint32_t lo = 0;
+    uint32_t hi = pager->num_free_runs;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (pager->free_runs[mid].offset < offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    ExtentRun *runs = pager->free_runs;
+    bool merge_prev = lo > 0 && runs[lo - 1].offset + runs[lo - 1].units == offset;
+    bool merge_next = lo < pager->num_free_runs && offset + units == runs[lo].offset;
+    if (merge_prev && merge_next) {
+        runs[lo - 1].units += units + runs[lo].units;
+        memmove(runs + lo, runs + lo + 1, sizeof(ExtentRun) * (pager->num_free_runs - lo - 1));
+        pager->num_free_runs--;
+        lo--;
+    } else if (merge_prev) {
+        runs[lo - 1].units += units;
+        lo--;
+    } else if (merge_next) {
+        runs[lo].offset = offset;
+        runs[lo].units += units;
+    } else {
+        if (pager->num_free_runs == pager->free_runs_capacity) {
+            pager->free_runs_capacity = pager->free_runs_capacity == 0 ? 64 : pager->free_runs_capacity * 2;
+            pager->free_runs = realloc(pager->free_runs, sizeof(ExtentRun) * pager->free_runs_capacity);
+            runs = pager->free_runs;
+        }
+        memmove(runs + lo + 1, runs + lo, sizeof(ExtentRun) * (pager->num_free_runs - lo));
+        runs[lo] = (ExtentRun) {offset, units};
+        pager->num_free_runs++;
+    }
+    //最后一段空闲位置接着文件末尾：不再记录，末尾往前收
+    if (lo == pager->num_free_runs - 1 && runs[lo].offset + runs[lo].units == pager->end_units) {
+        pager->end_units = runs[lo].offset;
+        pager->num_free_runs--;
+    }
+}
+
+//分配 units 个单位：取偏移最小的够长的空闲段，从段头切出来，页往文件前部集中，末尾空出来好截掉；
+//都不够长就接在文件末尾
+static uint32_t pager_alloc_run(Pager *pager, uint32_t units) {
+    uint32_t first = 0;
+    while (first < pager->num_free_runs && pager->free_runs[first].units < units) {
+        first++;
+    }
+    if (first < pager->num_free_runs) {
+        ExtentRun *run = &pager->free_runs[first];
+        uint32_t offset = run->offset;
+        run->offset += units;
+        run->units -= units;
+        if (run->units == 0) {
+            memmove(run, run + 1, sizeof(ExtentRun) * (pager->num_free_runs - first - 1));
+            pager->num_free_runs--;
+        }
+        return offset;
+    }
+    uint32_t offset = pager->end_units;
+    pager->end_units += units;
+    off_t length = (off_t) pager->end_units * PAGER_EXTENT_UNIT;
+    if (length > pager->file_length) {
+        pager->file_length = length;
+    }
+    return offset;
+}
+
+//文件末尾之后已经没有被引用的位置，截掉；调用时持有 pager->lock，且没有在途的写
+//先让刚写的根指针落盘，否则崩溃后旧的根指针可能指向被截掉的页位置表
+static void pager_truncate_extents(Pager *pager) {
+    off_t length = (off_t) pager->end_units * PAGER_EXTENT_UNIT;
+    if (length >= pager->file_length) {
+        return;
+    }
+    if (fdatasync(pager->file_descriptor) == -1) {
+        printf("Error syncing db file: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    if (ftruncate(pager->file_descriptor, length) == 0) {
+        pager->file_length = length;
+    }
+}
+
+static void pager_defer_run(Pager *pager, uint32_t offset, uint32_t units) {
+    if (pager->num_pending_runs == pager->pending_capacity) {
+        pager->pending_capacity = pager->pending_capacity == 0 ? 64 : pager->pending_capacity * 2;
+        pager->pending_runs = realloc(pager->pending_runs, sizeof(ExtentRun) * pager->pending_capacity);
+    }
+    pager->pending_runs[pager->num_pending_runs++] = (ExtentRun) {offset, units};
+}
+
+static void pager_ensure_extents(Pager *pager, uint32_t count) {
+    if (count <= pager->extents_capacity) {
+        return;
+    }
+    uint32_t capacity = pager->extents_capacity < 64 ? 64 : pager->extents_capacity * 2;
+    while (capacity < count) {
+        capacity *= 2;
+    }
+    pager->extents = realloc(pager->extents, sizeof(PageExtent) * capacity);
+    memset(pager->extents + pager->extents_capacity, 0,
+           sizeof(PageExtent) * (capacity - pager->extents_capacity));
+    pager->extents_capacity = capacity;
+}
+
+//页里没用到的字节清零，压缩时就不占地方：叶子的空闲区，内部节点、桶页、空闲页最后一项之后
+static void node_clear_unused(void *node) {
+    uint32_t start;
+    uint32_t end = PAGE_SIZE;
+    switch (get_node_type(node)) {
+        case NODE_LEAF:
+            start = LEAF_NODE_HEADER_SIZE + *leaf_node_num_cells(node) * LEAF_NODE_SLOT_SIZE;
+            end = *leaf_node_content_start(node);
+            break;
+        case NODE_INTERNAL:
+            start = INTERNAL_NODE_HEADER_SIZE + *internal_node_num_keys(node) * INTERNAL_NODE_CELL_SIZE;
+            break;
+        case NODE_HASH_BUCKET:
+            start = HASH_BUCKET_HEADER_SIZE + *hash_bucket_num_entries(node) * sizeof(HashEntry);
+            break;
+        case NODE_FREE:
+            start = FREE_PAGE_NEXT_OFFSET + sizeof(uint32_t);
+            break;
+        default:
+            return;
+    }
+    if (start < end && end <= PAGE_SIZE) {
+        memset((char *) node + start, 0, end - start);
+    }
+}
+
+//压缩一页并决定写到哪里，返回要写的字节数，内容放在 packed 里；调用时持有 pager->lock
+//上次检查点之后分配的位置长度合适就原地覆盖，否则换新位置
+static uint32_t pager_place_page(Pager *pager, uint32_t page_num, const void *page, uint8_t *packed, off_t *offset) {
+    uint8_t copy[PAGE_SIZE];
+    memcpy(copy, page, PAGE_SIZE);
+    node_clear_unused(copy);
+    uint16_t flags = PAGE_EXTENT_FRESH;
+    uint32_t length = page_compress(copy, packed, PAGE_SIZE - PAGER_EXTENT_UNIT);
+    if (length == 0) {
+        memcpy(packed, copy, PAGE_SIZE);
+        length = PAGE_SIZE;
+        flags |= PAGE_EXTENT_RAW;
+    }
+
+    pager_ensure_extents(pager, page_num + 1);
+    PageExtent *extent = &pager->extents[page_num];
+    uint32_t units = extent_units(length);
+    uint32_t old_units = extent_units(extent->length);
+    if (!(extent->flags & PAGE_EXTENT_FRESH) || old_units != units) {
+        if (extent->length != 0) {
+            if (extent->flags & PAGE_EXTENT_FRESH) {
+                pager_release_run(pager, extent->offset, old_units);
+            } else {
+                pager_defer_run(pager, extent->offset, old_units);
+            }
+        }
+        extent->offset = pager_alloc_run(pager, units);
+        pager->extents_dirty = true;
+    }
+    extent->length = length;
+    extent->flags = flags;
+    *offset = (off_t) extent->offset * PAGER_EXTENT_UNIT;
+    return length;
+}
+
+static void pager_write_at(Pager *pager, const void *data, size_t length, off_t offset) {
+    size_t written = 0;
+    while (written < length) {
+        ssize_t n = pwrite(pager->file_descriptor, (const char *) data + written, length - written,
+                           offset + written);
+        if (n == -1) {
+            printf("Error writing: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+        written += n;
+    }
+}
+
+//压缩模式下写回一页，返回写出的字节数，调用时持有 pager->lock
+static uint32_t pager_write_compressed(Pager *pager, uint32_t page_num, const void *page) {
+    if (page_num == HEADER_PAGE_NUM) {
+        //页 0 末尾是根指针，文件头只写前面
+        pager_write_at(pager, page, PAGE_SIZE - sizeof(PageMapRoot), 0);
+        return PAGE_SIZE - sizeof(PageMapRoot);
+    }
+    uint8_t packed[PAGE_SIZE];
+    off_t offset;
+    uint32_t length = pager_place_page(pager, page_num, page, packed, &offset);
+    pager_write_at(pager, packed, length, offset);
+    return length;
+}
+
+//检查点：压缩写回脏页，有页换了位置就把页位置表写到新位置，落盘后再改根指针
+static uint32_t pager_flush_dirty_compressed(Pager *pager) {
+    pthread_mutex_lock(&pager->lock);
+    Frame **dirty = malloc(sizeof(Frame *) * pager->num_frames);
+    uint32_t num_dirty = 0;
+    for (uint32_t i = 0; i < pager->num_frames; i++) {
+        if (pager->frames[i].in_use && pager->frames[i].dirty) {
+            dirty[num_dirty++] = &pager->frames[i];
+            pager->frames[i].pin_count++;
+        }
+    }
+
+    //持有锁时压缩、分配位置，写盘时放开
+    uint8_t *packed = malloc((size_t) (num_dirty + 1) * PAGE_SIZE);
+    uint32_t *lengths = malloc(sizeof(uint32_t) * (num_dirty + 1));
+    off_t *offsets = malloc(sizeof(off_t) * (num_dirty + 1));
+    Frame *header = NULL;
+    for (uint32_t i = 0; i < num_dirty; i++) {
+        if (dirty[i]->page_num == HEADER_PAGE_NUM) {
+            header = dirty[i];
+            lengths[i] = 0;
+            continue;
+        }
+        lengths[i] = pager_place_page(pager, dirty[i]->page_num, dirty[i]->data,
+                                      packed + (size_t) i * PAGE_SIZE, &offsets[i]);
+    }
+
+    bool write_map = pager->extents_dirty || pager->num_pages != pager->map_num_pages;
+    PageExtent *map = NULL;
+    size_t map_bytes = 0;
+    uint32_t old_map_offset = pager->map_offset;
+    uint32_t old_map_units = pager->map_units;
+    if (write_map) {
+        pager_ensure_extents(pager, pager->num_pages);
+        map_bytes = sizeof(PageExtent) * pager->num_pages;
+        map = malloc(map_bytes);
+        for (uint32_t i = 0; i < pager->num_pages; i++) {
+            map[i] = pager->extents[i];
+            map[i].flags &= ~PAGE_EXTENT_FRESH;
+        }
+        pager->map_units = extent_units(map_bytes);
+        pager->map_offset = pager_alloc_run(pager, pager->map_units);
+        pager->map_num_pages = pager->num_pages;
+    }
+    uint8_t page_zero[PAGE_SIZE];
+    PageMapRoot root = {.map_offset = pager->map_offset, .num_pages = pager->map_num_pages};
+    memcpy(root.magic, PAGE_MAP_MAGIC, sizeof(root.magic));
+    if (header != NULL) {
+        memcpy(page_zero, header->data, PAGE_SIZE);
+        memcpy(page_zero + PAGE_SIZE - sizeof(root), &root, sizeof(root));
+    }
+    pthread_mutex_unlock(&pager->lock);
+
+    uint64_t bytes_written = 0;
+    for (uint32_t i = 0; i < num_dirty; i++) {
+        if (lengths[i] > 0) {
+            pager_write_at(pager, packed + (size_t) i * PAGE_SIZE, lengths[i], offsets[i]);
+            bytes_written += lengths[i];
+        }
+    }
+    if (write_map) {
+        pager_write_at(pager, map, map_bytes, (off_t) pager->map_offset * PAGER_EXTENT_UNIT);
+        if (fdatasync(pager->file_descriptor) == -1) {
+            printf("Error syncing db file: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (header != NULL) {
+        pager_write_at(pager, page_zero, PAGE_SIZE, 0);
+        bytes_written += PAGE_SIZE;
+    } else if (write_map) {
+        pager_write_at(pager, &root, sizeof(root), PAGE_SIZE - sizeof(root));
+        bytes_written += sizeof(root);
+    }
+    stat_add(&pager->flush_calls, 1);
+    stat_add(&pager->flush_pages, num_dirty);
+    stat_add(&pager->flush_bytes, bytes_written + map_bytes);
+
+    pthread_mutex_lock(&pager->lock);
+    if (write_map) {
+        //新的页位置表已经生效，旧表和它引用的旧位置可以重用了
+        for (uint32_t i = 0; i < pager->num_pending_runs; i++) {
+            pager_release_run(pager, pager->pending_runs[i].offset, pager->pending_runs[i].units);
+        }
+        pager->num_pending_runs = 0;
+        if (old_map_units > 0) {
+            pager_release_run(pager, old_map_offset, old_map_units);
+        }
+        for (uint32_t i = 0; i < pager->extents_capacity; i++) {
+            pager->extents[i].flags &= ~PAGE_EXTENT_FRESH;
+        }
+        pager->extents_dirty = false;
+        pager_truncate_extents(pager);
+    }
+    for (uint32_t i = 0; i < num_dirty; i++) {
+        dirty[i]->dirty = false;
+        dirty[i]->pin_count--;
+    }
+    pthread_mutex_unlock(&pager->lock);
+    free(map);
+    free(offsets);
+    free(lengths);
+    free(packed);
+    free(dirty);
+    return num_dirty;
+}
+
+static int compare_extent_run(const void *a, const void *b) {
+    uint32_t offset_a = ((const ExtentRun *) a)->offset;
+    uint32_t offset_b = ((const ExtentRun *) b)->offset;
+    return (offset_a > offset_b) - (offset_a < offset_b);
+}
+
+//新建压缩文件：页位置表为空，根指针马上落盘
+static void pager_init_compressed(Pager *pager) {
+    pager->compressed = true;
+    pager_ensure_extents(pager, 1);
+    pager->extents[HEADER_PAGE_NUM] = (PageExtent) {0, PAGE_SIZE, PAGE_EXTENT_RAW};
+    pager->end_units = PAGE_SIZE / PAGER_EXTENT_UNIT;
+    PageMapRoot root = {.map_offset = 0, .num_pages = 0};
+    memcpy(root.magic, PAGE_MAP_MAGIC, sizeof(root.magic));
+    pager_write_at(pager, &root, sizeof(root), PAGE_SIZE - sizeof(root));
+    pager->file_length = PAGE_SIZE;
+}
+
+//打开压缩文件：读入上个检查点的页位置表，没有被引用的位置都是空闲的，
+//包括崩溃前写出去、还没进页位置表的页
+static void pager_load_extents(Pager *pager, const PageMapRoot *root) {
+    pager->compressed = true;
+    pager->num_pages = root->num_pages;
+    pager->map_offset = root->map_offset;
+    pager->map_num_pages = root->num_pages;
+    size_t map_bytes = sizeof(PageExtent) * root->num_pages;
+    pager->map_units = extent_units(map_bytes);
+    pager_ensure_extents(pager, root->num_pages + 1);
+    if (map_bytes > 0) {
+        ssize_t bytes_read = pread(pager->file_descriptor, pager->extents, map_bytes,
+                                   (off_t) root->map_offset * PAGER_EXTENT_UNIT);
+        if (bytes_read != (ssize_t) map_bytes) {
+            printf("Error reading page map. Corrupt file.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    pager->extents[HEADER_PAGE_NUM] = (PageExtent) {0, PAGE_SIZE, PAGE_EXTENT_RAW};
+
+    ExtentRun *runs = malloc(sizeof(ExtentRun) * (root->num_pages + 1));
+    uint32_t num_runs = 0;
+    for (uint32_t i = HEADER_PAGE_NUM + 1; i < root->num_pages; i++) {
+        if (pager->extents[i].length > PAGE_SIZE) {
+            printf("Error reading page map. Corrupt file.\n");
+            exit(EXIT_FAILURE);
+        }
+        if (pager->extents[i].length != 0) {
+            runs[num_runs++] = (ExtentRun) {pager->extents[i].offset, extent_units(pager->extents[i].length)};
+        }
+    }
+    if (pager->map_units > 0) {
+        runs[num_runs++] = (ExtentRun) {pager->map_offset, pager->map_units};
+    }
+    qsort(runs, num_runs, sizeof(ExtentRun), compare_extent_run);
+
+    uint32_t file_units = (pager->file_length + PAGER_EXTENT_UNIT - 1) / PAGER_EXTENT_UNIT;
+    uint32_t end = PAGE_SIZE / PAGER_EXTENT_UNIT;
+    for (uint32_t i = 0; i < num_runs; i++) {
+        if (runs[i].offset < end || runs[i].offset + runs[i].units > file_units) {
+            printf("Page map has overlapping or missing pages. Corrupt file.\n");
+            exit(EXIT_FAILURE);
+        }
+        pager_release_run(pager, end, runs[i].offset - end);
+        end = runs[i].offset + runs[i].units;
+    }
+    pager->end_units = end;
+    free(runs);
+
+    //末尾没有被引用的部分截掉
+    pager_truncate_extents(pager);
+}
+
+/*
+ * 回滚日志 (<db>-journal)
+ * 淘汰脏页、检查点和批量导入都把页原地写回；检查点之间写回的页可能停在一次分裂的中间，
+ * 逻辑 redo 日志没法在这样的树上重放，检查点又已经清空了之前的日志。
+ * 所以检查点之后第一次原地覆盖一个检查点时就有的页之前，先把它在文件里的内容追加到回滚日志并 fdatasync。
+ * 打开时回滚日志不为空，把这些页写回去，文件回到上次检查点的样子，之后再截掉检查点之后分配的页、重放 WAL。
+ * 检查点在数据文件 fsync 之后、清空 WAL 之前清空回滚日志。压缩文件换位置写回，不需要回滚日志。
+ *
+ * 记录格式: page_num(4) | crc32(4) | page
+ */
+
+#define JOURNAL_RECORD_HEADER_SIZE 8
+
+//把回滚日志里的页写回数据文件，校验失败的记录（崩溃时没写完）之后的都不管：这些页还没被覆盖
+static void journal_recover(int file_descriptor, int journal_descriptor) {
+    off_t length = lseek(journal_descriptor, 0, SEEK_END);
+    size_t record_size = JOURNAL_RECORD_HEADER_SIZE + PAGE_SIZE;
+    uint8_t *record = malloc(record_size);
+    uint32_t num_restored = 0;
+    for (off_t offset = 0; offset + (off_t) record_size <= length; offset += record_size) {
+        if (pread(journal_descriptor, record, record_size, offset) != (ssize_t) record_size) {
+            printf("Error reading journal: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+        uint32_t page_num;
+        uint32_t checksum;
+        memcpy(&page_num, record, sizeof(page_num));
+        memcpy(&checksum, record + sizeof(page_num), sizeof(checksum));
+        //校验覆盖页号和页内容
+        uint32_t expected = crc32(record + JOURNAL_RECORD_HEADER_SIZE, PAGE_SIZE) ^ page_num;
+        if (checksum != expected) {
+            break;
+        }
+        if (pwrite(file_descriptor, record + JOURNAL_RECORD_HEADER_SIZE, PAGE_SIZE,
+                   (off_t) page_num * PAGE_SIZE) != (ssize_t) PAGE_SIZE) {
+            printf("Error restoring page %d from journal: %d\n", page_num, errno);
+            exit(EXIT_FAILURE);
+        }
+        num_restored++;
+    }
+    free(record);
+    if (num_restored > 0 && fsync(file_descriptor) == -1) {
+        printf("Error syncing db file: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+}
+
+//文件里的页都已落盘，作为新的检查点：清空回滚日志，之后每页第一次原地写回前重新存
+static void pager_reset_journal(Pager *pager) {
+    pthread_mutex_lock(&pager->lock);
+    if (pager->journal_length > 0) {
+        if (ftruncate(pager->journal_descriptor, 0) == -1 || fdatasync(pager->journal_descriptor) == -1) {
+            printf("Error truncating journal: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+        pager->journal_length = 0;
+    }
+    pager->checkpoint_pages = pager->num_pages;
+    free(pager->journaled);
+    pager->journaled = calloc(pager->checkpoint_pages / 8 + 1, 1);
+    pthread_mutex_unlock(&pager->lock);
+}
+
+static bool pager_needs_journal(Pager *pager, uint32_t page_num) {
+    return pager->journal_descriptor != -1 && page_num < pager->checkpoint_pages &&
+           !(pager->journaled[page_num / 8] & (1 << (page_num % 8)));
+}
+
+//要原地写回的页里还没存过的，从文件读出检查点时的内容一次追加到回滚日志并落盘；调用时持有 pager->lock
+static void pager_journal_pages(Pager *pager, const uint32_t *page_nums, uint32_t count) {
+    size_t record_size = JOURNAL_RECORD_HEADER_SIZE + PAGE_SIZE;
+    uint8_t *records = NULL;
+    uint32_t num_records = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t page_num = page_nums[i];
+        if (!pager_needs_journal(pager, page_num)) {
+            continue;
+        }
+        if (records == NULL) {
+            records = malloc(record_size * (count - i));
+        }
+        uint8_t *record = records + record_size * num_records++;
+        if (pread(pager->file_descriptor, record + JOURNAL_RECORD_HEADER_SIZE, PAGE_SIZE,
+                  (off_t) page_num * PAGE_SIZE) != (ssize_t) PAGE_SIZE) {
+            printf("Error reading page %d for journal: %d\n", page_num, errno);
+            exit(EXIT_FAILURE);
+        }
+        uint32_t checksum = crc32(record + JOURNAL_RECORD_HEADER_SIZE, PAGE_SIZE) ^ page_num;
+        memcpy(record, &page_num, sizeof(page_num));
+        memcpy(record + sizeof(page_num), &checksum, sizeof(checksum));
+        pager->journaled[page_num / 8] |= 1 << (page_num % 8);
+    }
+    if (num_records == 0) {
+        return;
+    }
+
+    size_t length = record_size * num_records;
+    size_t written = 0;
+    while (written < length) {
+        ssize_t n = pwrite(pager->journal_descriptor, records + written, length - written,
+                           pager->journal_length + written);
+        if (n == -1) {
+            printf("Error writing journal: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+        written += n;
+    }
+    if (fdatasync(pager->journal_descriptor) == -1) {
+        printf("Error syncing journal: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    pager->journal_length += length;
+    free(records);
+}
+
+static void pager_flush(Pager* pager, uint32_t page_num, uint32_t size){
+    int32_t i = pager_find_frame(pager, page_num);
+    if (i == -1) {
+        printf("Tried to flush null page\n");
+        exit(EXIT_FAILURE);
+    }
+    stat_add(&pager->flush_calls, 1);
+    stat_add(&pager->flush_pages, 1);
+    if (pager->compressed) {
+        stat_add(&pager->flush_bytes, pager_write_compressed(pager, page_num, pager->frames[i].data));
+        pager->frames[i].dirty = false;
+        return;
+    }
+
+    pager_journal_pages(pager, &page_num, 1);
+    off_t offset = (off_t) page_num * PAGE_SIZE;
+    ssize_t bytes_written = pwrite(pager->file_descriptor, pager->frames[i].data, size, offset);
+
+    if (bytes_written == -1) {
+        printf("Error writing: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+
+    if (offset + bytes_written > pager->file_length) {
+        pager->file_length = offset + bytes_written;
+    }
+    stat_add(&pager->flush_bytes, bytes_written);
+    pager->frames[i].dirty = false;
+}
+
+static int compare_frame_page_num(const void *a, const void *b) {
+    uint32_t page_a = (*(Frame **) a)->page_num;
+    uint32_t page_b = (*(Frame **) b)->page_num;
+    return (page_a > page_b) - (page_a < page_b);
+}
+
+//只写回脏页，页号连续的脏页合并成一个请求，返回写回的页数
+//io_uring 下所有段一次提交；写盘期间不持有 pager->lock，脏页钉住不会被淘汰，读者照常取页
+//调用者持有写者锁，写盘期间没有人改这些页
+static uint32_t pager_flush_dirty(Pager* pager) {
+    if (pager->compressed) {
+        return pager_flush_dirty_compressed(pager);
+    }
+    pthread_mutex_lock(&pager->lock);
+    Frame **dirty = malloc(sizeof(Frame *) * pager->num_frames);
+    uint32_t num_dirty = 0;
+    for (uint32_t i = 0; i < pager->num_frames; i++) {
+        if (pager->frames[i].in_use && pager->frames[i].dirty) {
+            dirty[num_dirty++] = &pager->frames[i];
+            pager->frames[i].pin_count++;
+        }
+    }
+    qsort(dirty, num_dirty, sizeof(Frame *), compare_frame_page_num);
+    uint32_t *dirty_pages = malloc(sizeof(uint32_t) * (num_dirty + 1));
+    for (uint32_t i = 0; i < num_dirty; i++) {
+        dirty_pages[i] = dirty[i]->page_num;
+    }
+    pager_journal_pages(pager, dirty_pages, num_dirty);
+    free(dirty_pages);
+
+    IoRequest **requests = malloc(sizeof(IoRequest *) * (num_dirty + 1));
+    uint32_t num_requests = 0;
+    uint32_t run_start = 0;
+    while (run_start < num_dirty) {
+        uint32_t run_length = 1;
+        while (run_start + run_length < num_dirty && run_length < IOV_MAX &&
+               dirty[run_start + run_length]->page_num ==
+               dirty[run_start]->page_num + run_length) {
+            run_length++;
+        }
+        requests[num_requests++] = io_request_new(true, &dirty[run_start], run_length);
+        run_start += run_length;
+    }
+
+    if (pager->ring != NULL) {
+        for (uint32_t next = 0; next < num_requests;) {
+            uint32_t batch = num_requests - next;
+            if (batch > pager->ring->sq_entries) {
+                batch = pager->ring->sq_entries;
+            }
+            pager_reserve_io(pager, batch);
+            for (uint32_t i = 0; i < batch; i++) {
+                IoRequest *request = requests[next + i];
+                io_ring_prepare(pager->ring, pager->file_descriptor, request,
+                                (off_t) request->frames[0]->page_num * PAGE_SIZE);
+            }
+            io_ring_submit(pager->ring, batch);
+            next += batch;
+        }
+        for (uint32_t i = 0; i < num_requests; i++) {
+            while (!requests[i]->done) {
+                pager_io_progress(pager);
+            }
+        }
+    } else {
+        pthread_mutex_unlock(&pager->lock);
+        for (uint32_t i = 0; i < num_requests; i++) {
+            IoRequest *request = requests[i];
+            off_t offset = (off_t) request->frames[0]->page_num * PAGE_SIZE;
+            ssize_t expected = (ssize_t) request->num_frames * PAGE_SIZE;
+            if (pwritev(pager->file_descriptor, request->iov, request->num_frames, offset) != expected) {
+                printf("Error writing: %d\n", errno);
+                exit(EXIT_FAILURE);
+            }
+        }
+        pthread_mutex_lock(&pager->lock);
+    }
+
+    for (uint32_t i = 0; i < num_requests; i++) {
+        IoRequest *request = requests[i];
+        off_t end = ((off_t) request->frames[0]->page_num + request->num_frames) * PAGE_SIZE;
+        if (end > pager->file_length) {
+            pager->file_length = end;
+        }
+        free(request);
+    }
+    for (uint32_t i = 0; i < num_dirty; i++) {
+        dirty[i]->dirty = false;
+        dirty[i]->pin_count--;
+    }
+    stat_add(&pager->flush_calls, 1);
+    stat_add(&pager->flush_pages, num_dirty);
+    stat_add(&pager->flush_bytes, (uint64_t) num_dirty * PAGE_SIZE);
+    free(requests);
+    free(dirty);
+    pthread_mutex_unlock(&pager->lock);
+    return num_dirty;
+}
+
+//批量导入：页号连续的新页直接写到文件里，不经过缓冲池
+static void pager_write_pages(Pager* pager, uint32_t first_page, const char* data, uint32_t num_pages) {
+    pthread_mutex_lock(&pager->lock);
+    stat_add(&pager->flush_calls, 1);
+    stat_add(&pager->flush_pages, num_pages);
+    if (pager->compressed) {
+        for (uint32_t i = 0; i < num_pages; i++) {
+            uint32_t length = pager_write_compressed(pager, first_page + i, data + (size_t) i * PAGE_SIZE);
+            stat_add(&pager->flush_bytes, length);
+        }
+        if (first_page + num_pages > pager->num_pages) {
+            pager->num_pages = first_page + num_pages;
+        }
+        pthread_mutex_unlock(&pager->lock);
+        return;
+    }
+    uint32_t *page_nums = malloc(sizeof(uint32_t) * num_pages);
+    for (uint32_t i = 0; i < num_pages; i++) {
+        page_nums[i] = first_page + i;
+    }
+    pager_journal_pages(pager, page_nums, num_pages);
+    free(page_nums);
+
+    off_t offset = (off_t) first_page * PAGE_SIZE;
+    size_t length = (size_t) num_pages * PAGE_SIZE;
+    size_t written = 0;
+    while (written < length) {
+        ssize_t n = pwrite(pager->file_descriptor, data + written, length - written, offset + written);
+        if (n == -1) {
+            printf("Error writing: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+        written += n;
+    }
+    if (offset + (off_t) length > pager->file_length) {
+        pager->file_length = offset + length;
+    }
+    stat_add(&pager->flush_bytes, length);
+    if (first_page + num_pages > pager->num_pages) {
+        pager->num_pages = first_page + num_pages;
+    }
+    pthread_mutex_unlock(&pager->lock);
+}
+
+/*
+ * 固定大小的线程池，一次执行一个任务，每个工作线程都调用一次任务函数
+ */
+
+typedef struct {
+    ThreadPool *pool;
+    uint32_t worker_id;
+} ThreadPoolWorker;
+
+static void *thread_pool_worker_main(void *arg) {
+    ThreadPoolWorker *worker = arg;
+    ThreadPool *pool = worker->pool;
+    uint64_t seen_generation = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    while (true) {
+        while (!pool->stop && pool->generation == seen_generation) {
+            pthread_cond_wait(&pool->work_cond, &pool->lock);
+        }
+        if (pool->stop) {
+            break;
+        }
+        seen_generation = pool->generation;
+        ThreadPoolJob job = pool->job;
+        void *job_arg = pool->job_arg;
+        pthread_mutex_unlock(&pool->lock);
+
+        job(job_arg, worker->worker_id);
+
+        pthread_mutex_lock(&pool->lock);
+        pool->num_running--;
+        if (pool->num_running == 0) {
+            pthread_cond_broadcast(&pool->done_cond);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+static ThreadPool *thread_pool_create(uint32_t num_threads) {
+    ThreadPool *pool = malloc(sizeof(ThreadPool));
+    pool->num_threads = num_threads;
+    pool->threads = malloc(sizeof(pthread_t) * num_threads);
+    pool->workers = malloc(sizeof(ThreadPoolWorker) * num_threads);
+    pool->job = NULL;
+    pool->job_arg = NULL;
+    pool->generation = 0;
+    pool->num_running = 0;
+    pool->stop = false;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_cond, NULL);
+    pthread_cond_init(&pool->done_cond, NULL);
+
+    ThreadPoolWorker *workers = pool->workers;
+    for (uint32_t i = 0; i < num_threads; i++) {
+        workers[i].pool = pool;
+        workers[i].worker_id = i;
+        pthread_create(&pool->threads[i], NULL, thread_pool_worker_main, &workers[i]);
+    }
+    return pool;
+}
+
+//所有工作线程开始执行 job(arg, worker_id)，不等待完成
+static void thread_pool_start(ThreadPool *pool, ThreadPoolJob job, void *arg) {
+    pthread_mutex_lock(&pool->lock);
+    pool->job = job;
+    pool->job_arg = arg;
+    pool->num_running = pool->num_threads;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->work_cond);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void thread_pool_wait(ThreadPool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->num_running > 0) {
+        pthread_cond_wait(&pool->done_cond, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void thread_pool_destroy(ThreadPool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->work_cond);
+    pthread_mutex_unlock(&pool->lock);
+    for (uint32_t i = 0; i < pool->num_threads; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work_cond);
+    pthread_cond_destroy(&pool->done_cond);
+    free(pool->workers);
+    free(pool->threads);
+    free(pool);
+}
+
+/*
+ * 预写日志 (WAL)
+ * 每次 insert 追加一条逻辑 redo 记录，攒成一组后一次 write + fdatasync，
+ * 由后台线程保证记录最多等待 group_window_us 微秒就落盘。写操作放开写者锁后等自己的记录落盘才返回。
+ * checkpoint 把脏页刷盘并 fsync 后清空日志，db_open 时重放日志中的记录。
+ *
+ * 记录格式: crc32(4) | length(2) | type(1) | payload
+ * insert/update payload: id(4) | username_len(1) | username | email_len(1) | email
+ * delete payload: id(4)
+ */
+
+static uint32_t crc32_table[256];
+//多个库实例可能在不同线程里同时打开，表只在 pager_open 里建一次
+static pthread_once_t crc32_once = PTHREAD_ONCE_INIT;
+
+static void crc32_init() {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) {
+            c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        }
+        crc32_table[i] = c;
+    }
+}
+
+static uint32_t crc32(const uint8_t *data, uint32_t length) {
+    uint32_t c = 0xFFFFFFFFu;
+    for (uint32_t i = 0; i < length; i++) {
+        c = crc32_table[(c ^ data[i]) & 0xFF] ^ (c >> 8);
+    }
+    return c ^ 0xFFFFFFFFu;
+}
+
+static uint64_t now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+//写出当前组并 fdatasync，调用时持有 wal->lock
+//写盘期间释放锁，新的记录可以继续追加到另一块缓冲
+static void wal_sync_locked(Wal *wal) {
+    while (wal->syncing) {
+        pthread_cond_wait(&wal->cond, &wal->lock);
+    }
+    if (wal->pending_records == 0) {
+        return;
+    }
+
+    char *buffer = wal->buffer;
+    uint32_t length = wal->buffer_length;
+    wal->buffer = wal->spare_buffer;
+    wal->spare_buffer = buffer;
+    uint32_t capacity = wal->buffer_capacity;
+    wal->buffer_capacity = wal->spare_capacity;
+    wal->spare_capacity = capacity;
+    wal->buffer_length = 0;
+    wal->pending_records = 0;
+    wal->syncing = true;
+    uint64_t lsn = wal->append_lsn;
+    pthread_mutex_unlock(&wal->lock);
+
+    uint32_t written = 0;
+    while (written < length) {
+        ssize_t n = write(wal->file_descriptor, buffer + written, length - written);
+        if (n == -1) {
+            printf("Error writing wal: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+        written += n;
+    }
+    if (fdatasync(wal->file_descriptor) == -1) {
+        printf("Error syncing wal: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+
+    pthread_mutex_lock(&wal->lock);
+    wal->file_length += length;
+    if (lsn > wal->durable_lsn) {
+        wal->durable_lsn = lsn;
+    }
+    wal->syncing = false;
+    pthread_cond_broadcast(&wal->cond);
+}
+
+//后台线程：组内第一条记录等满窗口后提交
+static void *wal_flusher_main(void *arg) {
+    Wal *wal = arg;
+    pthread_mutex_lock(&wal->lock);
+    while (!wal->stop) {
+        if (wal->pending_records == 0) {
+            pthread_cond_wait(&wal->cond, &wal->lock);
+            continue;
+        }
+        uint64_t deadline = wal->group_start_us + wal->group_window_us;
+        if (now_us() < deadline) {
+            struct timespec ts;
+            ts.tv_sec = deadline / 1000000;
+            ts.tv_nsec = (deadline % 1000000) * 1000;
+            pthread_cond_timedwait(&wal->cond, &wal->lock, &ts);
+            continue;
+        }
+        wal_sync_locked(wal);
+    }
+    pthread_mutex_unlock(&wal->lock);
+    return NULL;
+}
+
+static Wal *wal_open(const char *db_filename, const DbOptions *options) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s-wal", db_filename);
+    int fd = open(path, O_RDWR | O_CREAT | O_APPEND, S_IWUSR | S_IRUSR);
+    if (fd == -1) {
+        printf("Unable to open wal file\n");
+        exit(EXIT_FAILURE);
+    }
+
+    Wal *wal = malloc(sizeof(Wal));
+    wal->file_descriptor = fd;
+    wal->file_length = lseek(fd, 0, SEEK_END);
+    wal->buffer_capacity = WAL_BUFFER_INITIAL_SIZE;
+    wal->buffer = malloc(wal->buffer_capacity);
+    wal->spare_capacity = WAL_BUFFER_INITIAL_SIZE;
+    wal->spare_buffer = malloc(wal->spare_capacity);
+    wal->buffer_length = 0;
+    wal->pending_records = 0;
+    wal->group_start_us = 0;
+    wal->group_window_us = options->wal_group_window_us;
+    wal->group_max_records = options->wal_group_max_records;
+    wal->append_lsn = 0;
+    wal->durable_lsn = 0;
+    wal->syncing = false;
+    wal->stop = false;
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&wal->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&wal->lock, NULL);
+    pthread_create(&wal->flusher, NULL, wal_flusher_main, wal);
+    return wal;
+}
+
+static void wal_close(Wal *wal) {
+    pthread_mutex_lock(&wal->lock);
+    wal_sync_locked(wal);
+    wal->stop = true;
+    pthread_cond_broadcast(&wal->cond);
+    pthread_mutex_unlock(&wal->lock);
+    pthread_join(wal->flusher, NULL);
+
+    close(wal->file_descriptor);
+    pthread_mutex_destroy(&wal->lock);
+    pthread_cond_destroy(&wal->cond);
+    free(wal->buffer);
+    free(wal->spare_buffer);
+    free(wal);
+}
+
+//把一条 insert/update/delete 编码成日志记录，返回记录长度；delete 只用 row 的 id
+static uint32_t wal_encode_row(uint8_t type, const Row *row, uint8_t *record) {
+    uint8_t *p = record + WAL_RECORD_HEADER_SIZE;
+    *p++ = type;
+    memcpy(p, &row->id, sizeof(row->id));
+    p += sizeof(row->id);
+    if (type != WAL_RECORD_DELETE) {
+        uint8_t username_length = strlen(row->username);
+        uint8_t email_length = strlen(row->email);
+        *p++ = username_length;
+        memcpy(p, row->username, username_length);
+        p += username_length;
+        *p++ = email_length;
+        memcpy(p, row->email, email_length);
+        p += email_length;
+    }
+
+    uint16_t length = p - (record + WAL_RECORD_HEADER_SIZE);
+    memcpy(record + sizeof(uint32_t), &length, sizeof(length));
+    uint32_t checksum = crc32(record + sizeof(uint32_t), sizeof(length) + length);
+    memcpy(record, &checksum, sizeof(checksum));
+    return WAL_RECORD_HEADER_SIZE + length;
+}
+
+//把连续的 count 条同类记录追加到当前组，只加一次锁；返回这些记录的结束位置，交给 wal_wait_durable
+static uint64_t wal_append_rows(Wal *wal, uint8_t type, const Row *rows, uint32_t count) {
+    pthread_mutex_lock(&wal->lock);
+    if (count == 0) {
+        //之前追加的记录还没落盘时同样要等
+        uint64_t lsn = wal->append_lsn;
+        pthread_mutex_unlock(&wal->lock);
+        return lsn;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        if (wal->buffer_length + WAL_RECORD_MAX_SIZE > wal->buffer_capacity) {
+            wal->buffer_capacity *= 2;
+            wal->buffer = realloc(wal->buffer, wal->buffer_capacity);
+        }
+        uint32_t length = wal_encode_row(type, &rows[i], (uint8_t *) wal->buffer + wal->buffer_length);
+        wal->buffer_length += length;
+        wal->append_lsn += length;
+    }
+    uint64_t lsn = wal->append_lsn;
+    bool group_started = wal->pending_records == 0;
+    wal->pending_records += count;
+
+    if (wal->group_window_us == 0 || wal->pending_records >= wal->group_max_records) {
+        //组已满，在调用者线程直接提交
+        wal_sync_locked(wal);
+    } else if (group_started) {
+        //新的一组开始，唤醒后台线程计时
+        wal->group_start_us = now_us();
+        pthread_cond_broadcast(&wal->cond);
+    }
+    pthread_mutex_unlock(&wal->lock);
+    return lsn;
+}
+
+static uint64_t wal_append_inserts(Wal *wal, const Row *rows, uint32_t count) {
+    return wal_append_rows(wal, WAL_RECORD_INSERT, rows, count);
+}
+
+//把一条 insert 记录追加到当前组
+static uint64_t wal_append_insert(Wal *wal, Row *row) {
+    return wal_append_inserts(wal, row, 1);
+}
+
+//等到 lsn 之前的记录都已落盘，组提交由后台线程或攒满的那个调用者完成
+//调用时不持有写者锁，等待期间其他写者还能把记录加进同一组
+static void wal_wait_durable(Wal *wal, uint64_t lsn) {
+    pthread_mutex_lock(&wal->lock);
+    while (wal->durable_lsn < lsn) {
+        pthread_cond_wait(&wal->cond, &wal->lock);
+    }
+    pthread_mutex_unlock(&wal->lock);
+}
+
+//重放日志，返回重放的记录数。重放是幂等的：已在表中的 id 会被跳过，已经删掉的 id 不再删
+//日志尾部不完整或校验失败的记录被截掉
+static uint32_t wal_replay(Wal *wal, Table *table) {
+    if (wal->file_length == 0) {
+        return 0;
+    }
+
+    uint8_t *data = malloc(wal->file_length);
+    ssize_t bytes_read = pread(wal->file_descriptor, data, wal->file_length, 0);
+    if (bytes_read != wal->file_length) {
+        printf("Error reading wal: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+
+    uint32_t num_replayed = 0;
+    off_t offset = 0;
+    while (offset + WAL_RECORD_HEADER_SIZE <= wal->file_length) {
+        uint8_t *record = data + offset;
+        uint32_t checksum;
+        uint16_t length;
+        memcpy(&checksum, record, sizeof(checksum));
+        memcpy(&length, record + sizeof(checksum), sizeof(length));
+        if (offset + WAL_RECORD_HEADER_SIZE + length > wal->file_length ||
+            crc32(record + sizeof(checksum), sizeof(length) + length) != checksum) {
+            break;
+        }
+
+        uint8_t *p = record + WAL_RECORD_HEADER_SIZE;
+        uint8_t type = *p++;
+        Row row;
+        memset(&row, 0, sizeof(row));
+        memcpy(&row.id, p, sizeof(row.id));
+        p += sizeof(row.id);
+        if (type == WAL_RECORD_INSERT || type == WAL_RECORD_UPDATE) {
+            uint8_t username_length = *p++;
+            memcpy(row.username, p, username_length);
+            p += username_length;
+            uint8_t email_length = *p++;
+            memcpy(row.email, p, email_length);
+        }
+        //update 重放成覆盖，删掉的行已经不在表里时跳过
+        if ((type == WAL_RECORD_INSERT && table_insert(table, &row) == EXECUTE_SUCCESS) ||
+            (type == WAL_RECORD_UPDATE && table_update(table, &row)) ||
+            (type == WAL_RECORD_DELETE && table_delete(table, row.id))) {
+            num_replayed++;
+        }
+        offset += WAL_RECORD_HEADER_SIZE + length;
+    }
+    free(data);
+
+    if (offset < wal->file_length) {
+        if (ftruncate(wal->file_descriptor, offset) == -1) {
+            printf("Error truncating wal: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+        wal->file_length = offset;
+    }
+    return num_replayed;
+}
+
+/*
+ * 文件头
+ * 检查点把行数、空闲页链表等写进页0，和其他脏页一起落盘；正常关闭时所有页落盘之后再单独写一次，标上 clean。
+ * 打开时 clean 为 0 说明上次没有正常关闭，文件里的页可能比文件头新（淘汰时写回的脏页、vacuum 改过的页），
+ * 这时沿叶子链表重新统计行数、扫描重建空闲页链表，再重放日志
+ */
+
+//按内存里的状态填写文件头，内容变了返回 true
+static bool header_fill(Table *table, void *page, bool clean) {
+    FileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, DB_FILE_MAGIC, sizeof(header.magic));
+    header.format_version = DB_FORMAT_VERSION;
+    header.page_size = PAGE_SIZE;
+    header.num_pages = table->pager->num_pages;
+    header.root_page_num = table->root_page_num;
+    header.num_rows = atomic_load(&table->num_rows);
+    header.num_tombstones = atomic_load(&table->num_tombstones);
+    header.free_head = table->pager->free_head;
+    header.num_free_pages = table->pager->num_free_pages;
+    header.clean = clean;
+    for (uint32_t i = 0; i < NUM_INDEX_COLUMNS; i++) {
+        header.index_pages[i] = atomic_load(&table->index_pages[i]);
+    }
+    if (memcmp(page, &header, sizeof(header)) == 0) {
+        return false;
+    }
+    memcpy(page, &header, sizeof(header));
+    return true;
+}
+
+//文件头跟着检查点一起写回，调用时持有写者锁
+static void table_store_header(Table *table) {
+    Pager *pager = table->pager;
+    void *page = get_page(pager, HEADER_PAGE_NUM);
+    if (header_fill(table, page, false)) {
+        pager_mark_dirty(pager, HEADER_PAGE_NUM);
+    }
+    pager_unpin(pager, HEADER_PAGE_NUM);
+}
+
+//立即写回文件头并 fdatasync：clean 标记要在之后的写之前落盘
+static void table_write_header(Table *table, bool clean) {
+    Pager *pager = table->pager;
+    void *page = get_page(pager, HEADER_PAGE_NUM);
+    header_fill(table, page, clean);
+    pthread_mutex_lock(&pager->lock);
+    pager_flush(pager, HEADER_PAGE_NUM, PAGE_SIZE);
+    pthread_mutex_unlock(&pager->lock);
+    pager_unpin(pager, HEADER_PAGE_NUM);
+    if (fdatasync(pager->file_descriptor) == -1) {
+        printf("Error syncing db file: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+}
+
+//读文件头并检查格式，返回上次是否正常关闭；正常关闭时统计信息和空闲页链表直接用文件头里的
+//索引目录总是可信：建索引时马上做检查点
+static bool table_load_header(Table *table) {
+    Pager *pager = table->pager;
+    FileHeader header;
+    void *page = get_page_ro(pager, HEADER_PAGE_NUM);
+    memcpy(&header, page, sizeof(header));
+    pager_unpin_ro(pager, HEADER_PAGE_NUM, page);
+
+    if (memcmp(header.magic, DB_FILE_MAGIC, sizeof(header.magic)) != 0) {
+        printf("Not a db file, or written by an older version.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (header.format_version != DB_FORMAT_VERSION) {
+        printf("Unsupported db file format version %d.\n", header.format_version);
+        exit(EXIT_FAILURE);
+    }
+    if (header.page_size != PAGE_SIZE || header.num_pages > pager->num_pages) {
+        printf("Db file does not match its header. Corrupt file.\n");
+        exit(EXIT_FAILURE);
+    }
+    //文件头和回滚日志恢复出来的页是同一个检查点的；之后分配、淘汰时写进文件的页没有页引用，截掉
+    if (!pager->compressed && header.num_pages < pager->num_pages) {
+        if (ftruncate(pager->file_descriptor, (off_t) header.num_pages * PAGE_SIZE) == -1 ||
+            fsync(pager->file_descriptor) == -1) {
+            printf("Error truncating db file: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+        pager->num_pages = header.num_pages;
+        pager->file_length = (off_t) header.num_pages * PAGE_SIZE;
+        pager_reset_journal(pager);
+    }
+
+    table->root_page_num = header.root_page_num;
+    for (uint32_t i = 0; i < NUM_INDEX_COLUMNS; i++) {
+        atomic_store(&table->index_pages[i], header.index_pages[i]);
+    }
+    if (!header.clean) {
+        return false;
+    }
+    atomic_store(&table->num_rows, header.num_rows);
+    atomic_store(&table->num_tombstones, header.num_tombstones);
+    pager->free_head = header.free_head;
+    pager->num_free_pages = header.num_free_pages;
+    return true;
+}
+
+//拿到写者锁，分配提交时间戳，mmap 模式下等读者离开映射
+static void table_lock_writer(Table *table) {
+    pthread_mutex_lock(&table->write_lock);
+    table->write_ts = atomic_load(&table->versions.commit_clock) + 1;
+    pager_begin_write(table->pager);
+}
+
+//写操作的入口；打开后第一次写之前先在文件头上记下没有正常关闭
+static void table_begin_write(Table *table) {
+    table_lock_writer(table);
+    if (table->header_clean) {
+        table_write_header(table, false);
+        table->header_clean = false;
+    }
+}
+
+//提交：这次写入的行对之后的快照可见
+static void table_end_write(Table *table) {
+    version_commit(&table->versions, table->write_ts);
+    table->write_ts = 0;
+    pthread_mutex_unlock(&table->write_lock);
+}
+
+//检查点：脏页刷盘并 fsync 后清空日志，调用时持有写者锁
+static void table_checkpoint(Table *table) {
+    Wal *wal = table->wal;
+    pthread_mutex_lock(&wal->lock);
+    while (wal->syncing) {
+        pthread_cond_wait(&wal->cond, &wal->lock);
+    }
+
+    if (!table->header_clean) {
+        table_store_header(table);
+    }
+    uint32_t pages_written = pager_flush_dirty(table->pager);
+    pager_end_write(table->pager);
+    if (pages_written == 0 && wal->file_length == 0 && wal->pending_records == 0 &&
+        table->pager->journal_length == 0) {
+        //没有任何修改，不产生 I/O
+        pthread_mutex_unlock(&wal->lock);
+        return;
+    }
+
+    if (fsync(table->pager->file_descriptor) == -1) {
+        printf("Error syncing db file: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    //先清空回滚日志：反过来的话，崩溃后页会退回上一个检查点，而 WAL 已经空了
+    pager_reset_journal(table->pager);
+    //日志中的记录都已经在数据文件里了
+    wal->buffer_length = 0;
+    wal->pending_records = 0;
+    wal->durable_lsn = wal->append_lsn;
+    pthread_cond_broadcast(&wal->cond);
+    if (wal->file_length > 0) {
+        if (ftruncate(wal->file_descriptor, 0) == -1) {
+            printf("Error truncating wal: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+        wal->file_length = 0;
+    }
+    pthread_mutex_unlock(&wal->lock);
+}
+
+void db_checkpoint(Table *table) {
+    table_lock_writer(table);
+    table_checkpoint(table);
+    table_end_write(table);
+}
+
+void db_close(Table* table){
+    Pager* pager = table->pager;
+
+    //只读会话没有脏页，文件头也不用改，不产生任何写 I/O
+    table_lock_writer(table);
+    table_checkpoint(table);
+    if (!table->header_clean) {
+        //所有页都落盘之后才把文件头标成正常关闭，写文件头时存进回滚日志的页 0 不再需要
+        table_write_header(table, true);
+        pager_reset_journal(pager);
+    }
+    table_end_write(table);
+    wal_close(table->wal);
+    if (table->scan_pool != NULL) {
+        thread_pool_destroy(table->scan_pool);
+    }
+    for (uint32_t i = 0; i < STATEMENT_CACHE_SIZE; i++) {
+        free(table->statement_cache[i].text);
+    }
+    free(table->statement_cache);
+    pthread_mutex_destroy(&table->statement_cache_lock);
+    pthread_mutex_destroy(&table->scan_pool_lock);
+    pthread_mutex_destroy(&table->write_lock);
+    version_store_destroy(&table->versions);
+    //预读可能还在途，读完之前帧不能释放
+    pager_drain_io(pager);
+    if (pager->ring != NULL) {
+        io_ring_close(pager->ring);
+    }
+
+    int result = close(pager->file_descriptor);
+    if (result == -1) {
+        printf("Error closing db file.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (pager->journal_descriptor != -1) {
+        close(pager->journal_descriptor);
+    }
+
+    if (pager->map != NULL) {
+        munmap(pager->map, pager->map_length);
+    }
+    for (uint32_t i = 0; i < pager->num_retired_maps; i++) {
+        munmap(pager->retired_maps[i], pager->retired_map_lengths[i]);
+    }
+    for (uint32_t i = 0; i < pager->num_frames; i++) {
+        pthread_rwlock_destroy(&pager->frames[i].latch);
+    }
+    pthread_cond_destroy(&pager->map_cond);
+    pthread_cond_destroy(&pager->io_cond);
+    pthread_mutex_destroy(&pager->lock);
+    free(pager->frames[0].data);
+    free(pager->frames);
+    free(pager->buckets);
+    free(pager->extents);
+    free(pager->free_runs);
+    free(pager->pending_runs);
+    free(pager->journaled);
+    free(pager);
+    free(table);
+}
+
+static Pager* pager_open(const char * filename, const DbOptions *options){
+    int fd = open(filename,
+                  O_RDWR |     // R W
+                  O_CREAT, // create file if it does not exist
+                  S_IWUSR |    // user W permission
+                  S_IRUSR  // user R permission
+    );
+    if (fd == -1){
+        printf("Unable to open file\n");
+        exit(EXIT_FAILURE);
+    }
+    pthread_once(&crc32_once, crc32_init);
+
+    //上次检查点之后原地写回过页又没有正常关闭：先把这些页恢复成检查点时的内容
+    char journal_path[PATH_MAX];
+    snprintf(journal_path, sizeof(journal_path), "%s-journal", filename);
+    int journal_fd = open(journal_path, O_RDWR);
+    if (journal_fd != -1) {
+        journal_recover(fd, journal_fd);
+    }
+
+    off_t file_length = lseek(fd, 0, SEEK_END);
+
+    uint32_t num_frames = options->num_frames;
+    bool use_mmap = options->use_mmap;
+    if (num_frames < PAGER_MIN_FRAMES) {
+        num_frames = PAGER_MIN_FRAMES;
+    }
+
+    Pager *pager = malloc(sizeof(Pager));
+    pager->file_descriptor = fd;
+    pager->file_length = file_length;
+    pager->num_pages = file_length / PAGE_SIZE;
+    if (file_length % PAGE_SIZE) {
+        pager->num_pages += 1;
+    }
+    pager->free_head = 0;
+    pager->num_free_pages = 0;
+
+    //页 0 末尾有根指针的是压缩文件，按文件里的页位置表打开；新文件按选项决定
+    pager->compressed = false;
+    pager->extents = NULL;
+    pager->extents_capacity = 0;
+    pager->extents_dirty = false;
+    pager->end_units = 0;
+    pager->map_offset = 0;
+    pager->map_units = 0;
+    pager->map_num_pages = 0;
+    pager->free_runs = NULL;
+    pager->num_free_runs = 0;
+    pager->free_runs_capacity = 0;
+    pager->pending_runs = NULL;
+    pager->num_pending_runs = 0;
+    pager->pending_capacity = 0;
+    PageMapRoot root;
+    if (file_length == 0) {
+        if (options->compress_pages) {
+            pager_init_compressed(pager);
+        }
+    } else if (file_length >= PAGE_SIZE &&
+               pread(fd, &root, sizeof(root), PAGE_SIZE - sizeof(root)) == sizeof(root) &&
+               memcmp(root.magic, PAGE_MAP_MAGIC, sizeof(root.magic)) == 0) {
+        pager_load_extents(pager, &root);
+    }
+    //压缩的页要先解压，不能直接映射或按页号读
+    if (pager->compressed) {
+        use_mmap = false;
+    }
+    if (pager->compressed && journal_fd != -1) {
+        close(journal_fd);
+        journal_fd = -1;
+    } else if (!pager->compressed && journal_fd == -1) {
+        journal_fd = open(journal_path, O_RDWR | O_CREAT, S_IWUSR | S_IRUSR);
+        if (journal_fd == -1) {
+            printf("Unable to open journal file\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    pager->journal_descriptor = journal_fd;
+    pager->journal_length = journal_fd == -1 ? 0 : lseek(journal_fd, 0, SEEK_END);
+    pager->journaled = NULL;
+
+    //所有帧的页缓冲一次性分配，常驻内存固定为 num_frames * PAGE_SIZE
+    char *data = malloc((size_t) num_frames * PAGE_SIZE);
+    pager->num_frames = num_frames;
+    pager->frames = malloc(sizeof(Frame) * num_frames);
+    pager->clock_hand = 0;
+    for (uint32_t i = 0; i < num_frames; i++) {
+        Frame *frame = &pager->frames[i];
+        frame->page_num = 0;
+        frame->pin_count = 0;
+        frame->in_use = false;
+        frame->dirty = false;
+        frame->referenced = false;
+        frame->io_pending = false;
+        frame->hash_next = -1;
+        pthread_rwlock_init(&frame->latch, NULL);
+        frame->data = data + (size_t) i * PAGE_SIZE;
+    }
+
+    pager->use_mmap = use_mmap;
+    pager->map = NULL;
+    pager->map_length = 0;
+    pager->map_advice = MADV_NORMAL;
+    pager->num_retired_maps = 0;
+    pager->map_reads_enabled = use_mmap;
+    pager->mapped_readers = 0;
+    pthread_cond_init(&pager->map_cond, NULL);
+    pthread_mutex_init(&pager->lock, NULL);
+
+    //内核不支持或被禁用时退回同步读写
+    pager->ring = options->use_io_uring && !pager->compressed ? io_ring_open(PAGER_IO_RING_ENTRIES) : NULL;
+    pager->io_waiting = false;
+    pthread_cond_init(&pager->io_cond, NULL);
+    pager->read_ahead_pages = options->read_ahead_pages;
+    if (pager->read_ahead_pages > PAGER_MAX_READ_AHEAD) {
+        pager->read_ahead_pages = PAGER_MAX_READ_AHEAD;
+    }
+    pager->last_miss_page = 0;
+    pager->last_miss_valid = false;
+    pager->read_ahead_end = 0;
+
+    atomic_init(&pager->page_hits, 0);
+    atomic_init(&pager->page_misses, 0);
+    atomic_init(&pager->page_evictions, 0);
+    atomic_init(&pager->page_map_reads, 0);
+    atomic_init(&pager->flush_calls, 0);
+    atomic_init(&pager->flush_pages, 0);
+    atomic_init(&pager->flush_bytes, 0);
+
+    pager->num_buckets = num_frames * 2;
+    pager->buckets = malloc(sizeof(int32_t) * pager->num_buckets);
+    for (uint32_t i = 0; i < pager->num_buckets; i++) {
+        pager->buckets[i] = -1;
+    }
+
+    //恢复出来的页已经落盘
+    pager_reset_journal(pager);
+    return pager;
+}
+
+//上次没有正常关闭：沿叶子链表重新统计行数，已删除的行单独计数
+static void table_recount(Table *table) {
+    Cursor* cursor = table_start(table);
+    while (!cursor->end_of_table) {
+        uint32_t num_cells = *leaf_node_num_cells(cursor->node);
+        uint32_t num_deleted = 0;
+        for (uint32_t i = 0; i < num_cells; i++) {
+            num_deleted += leaf_node_is_deleted(cursor->node, i);
+        }
+        atomic_fetch_add(&table->num_rows, num_cells - num_deleted);
+        atomic_fetch_add(&table->num_tombstones, num_deleted);
+        cursor->cell_num = num_cells;
+        cursor_settle(cursor);
+    }
+    cursor_close(cursor);
+}
+
+//initialize the table
+Table *db_open(const char * filename, const DbOptions *options) {
+    Pager* pager = pager_open(filename, options);
+
+    if (!pager->compressed && pager->file_length % PAGE_SIZE) {
+        printf("Db file is not a whole number of pages. Corrupt file.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    Table *table = (Table *) malloc(sizeof(Table));
+    table->pager = pager;
+    table->wal = wal_open(filename, options);
+    table->scan_pool = NULL;
+    table->output_mode = OUTPUT_TEXT;
+    table->statement_cache = calloc(STATEMENT_CACHE_SIZE, sizeof(StatementCacheEntry));
+    table->statement_cache_clock = 0;
+    pthread_mutex_init(&table->statement_cache_lock, NULL);
+    pthread_mutex_init(&table->scan_pool_lock, NULL);
+    pthread_mutex_init(&table->write_lock, NULL);
+    table->write_ts = 0;
+    version_store_init(&table->versions);
+    if (options->scan_threads > 1) {
+        table->scan_pool = thread_pool_create(options->scan_threads);
+    }
+    table->root_page_num = ROOT_PAGE_NUM;
+    atomic_init(&table->num_rows, 0);
+    atomic_init(&table->num_tombstones, 0);
+    table->header_clean = false;
+    for (uint32_t i = 0; i < NUM_INDEX_COLUMNS; i++) {
+        atomic_init(&table->index_pages[i], 0);
+        atomic_init(&table->index_ts[i], 0);
+    }
+    atomic_init(&table->statement_cache_hits, 0);
+    latency_reset(&table->prepare_latency);
+    for (uint32_t i = 0; i <= STATEMENT_CREATE_INDEX; i++) {
+        latency_reset(&table->statement_latency[i]);
+    }
+
+    if (pager->num_pages == 0) {
+        //新文件，页1 初始化为叶子节点作为根，先写回根页再让文件头落盘：
+        //文件头说有 2 页时文件里必须真的有这 2 页，否则检查点之前崩溃的文件再也打不开
+        void* root_node = get_page(pager, ROOT_PAGE_NUM);
+        initialize_leaf_node(root_node);
+        set_node_root(root_node, true);
+        pager_mark_dirty(pager, ROOT_PAGE_NUM);
+        pthread_mutex_lock(&pager->lock);
+        pager_flush(pager, ROOT_PAGE_NUM, PAGE_SIZE);
+        pthread_mutex_unlock(&pager->lock);
+        pager_unpin(pager, ROOT_PAGE_NUM);
+        table_write_header(table, false);
+        pager_reset_journal(pager);
+    } else if (table_load_header(table)) {
+        table->header_clean = true;
+    } else {
+        table_recount(table);
+        pager_rebuild_free_list(pager);
+    }
+
+    //上次没有 checkpoint 就退出了，重放日志
+    wal_replay(table->wal, table);
+    return table;
+}
+
+void db_set_output_mode(Table *table, OutputMode mode) {
+    table->output_mode = mode;
+}
+
+//写游标停在 key 的槽上时返回 true，deleted 表示这一行已经删除
+static bool cursor_at_key(Cursor *cursor, uint32_t key, bool *deleted) {
+    if (cursor->cell_num >= *leaf_node_num_cells(cursor->node) || cursor_key(cursor) != key) {
+        return false;
+    }
+    *deleted = leaf_node_is_deleted(cursor->node, cursor->cell_num);
+    return true;
+}
+
+//把写游标处的槽换成 row：旧内容先登记进版本表，再删槽重新插入，新记录长度不同时可能分裂，新内容登记进索引
+//日志重放时还没有读者，不用登记
+static void cursor_replace_row(Cursor *cursor, Row *row) {
+    Table *table = cursor->table;
+    if (table->write_ts != 0) {
+        Row old_row;
+        leaf_node_read_row(cursor->node, cursor->cell_num, &old_row);
+        version_replace(&table->versions, row->id, &old_row,
+                        leaf_node_is_deleted(cursor->node, cursor->cell_num), table->write_ts);
+    }
+    leaf_node_remove(cursor->node, cursor->cell_num);
+    leaf_node_insert(cursor, row->id, row);
+    table_index_row(table, row);
+}
+
+//在写游标处插入一行，写游标已经定位到 row->id；同一个 id 已经删除时覆盖那个槽
+static ExecuteResult cursor_insert_row(Cursor *cursor, Row *row) {
+    Table *table = cursor->table;
+    bool deleted;
+    if (cursor_at_key(cursor, row->id, &deleted)) {
+        //主键不允许重复
+        if (!deleted) {
+            return EXECUTE_DUPLICATE_KEY;
+        }
+        cursor_replace_row(cursor, row);
+        atomic_fetch_sub(&table->num_tombstones, 1);
+    } else {
+        if (table->write_ts != 0) {
+            version_add(&table->versions, row->id, table->write_ts);
+        }
+        leaf_node_insert(cursor, row->id, row);
+        table_index_row(table, row);
+    }
+    atomic_fetch_add(&table->num_rows, 1);
+    return EXECUTE_SUCCESS;
+}
+
+//按主键插入 B+树，不写日志
+static ExecuteResult table_insert(Table *table, Row *row) {
+    if (atomic_load(&table->num_rows) == UINT32_MAX) {
+        return EXECUTE_TABLE_FULL;
+    }
+
+    Cursor* cursor = table_find(table, row->id);
+    ExecuteResult result = cursor_insert_row(cursor, row);
+    cursor_close(cursor);
+    return result;
+}
+
+//按主键删除一行，不写日志，返回这一行是否存在
+//有写操作时删除的行只打标记，之前开始的快照还能读到；日志重放时直接删掉
+static bool table_delete(Table *table, uint32_t id) {
+    Cursor *cursor = table_find(table, id);
+    bool deleted;
+    bool found = cursor_at_key(cursor, id, &deleted) && !deleted;
+    if (found) {
+        if (table->write_ts != 0) {
+            version_delete(&table->versions, id, table->write_ts);
+            *leaf_node_record_length(cursor->node, cursor->cell_num) |= LEAF_NODE_TOMBSTONE;
+            atomic_fetch_add(&table->num_tombstones, 1);
+        } else {
+            leaf_node_remove(cursor->node, cursor->cell_num);
+        }
+        pager_mark_dirty(table->pager, cursor->page_num);
+        atomic_fetch_sub(&table->num_rows, 1);
+    }
+    cursor_close(cursor);
+    return found;
+}
+
+//按主键把一行整个换成 row，不写日志，返回这一行是否存在
+static bool table_update(Table *table, Row *row) {
+    Cursor *cursor = table_find(table, row->id);
+    bool deleted;
+    bool found = cursor_at_key(cursor, row->id, &deleted) && !deleted;
+    if (found) {
+        cursor_replace_row(cursor, row);
+    }
+    cursor_close(cursor);
+    return found;
+}
+
+//执行insert
+ExecuteResult execute_insert(Statement *statement, Table *table) {
+    //得到row
+    Row *row_to_insert = &(statement->row_to_insert);
+
+    table_begin_write(table);
+    ExecuteResult result = table_insert(table, row_to_insert);
+    uint64_t lsn = 0;
+    if (result == EXECUTE_SUCCESS) {
+        //redo 记录进入当前提交组
+        lsn = wal_append_insert(table->wal, row_to_insert);
+    }
+    table_end_write(table);
+    //放开写者锁之后再等这一组落盘
+    wal_wait_durable(table->wal, lsn);
+    return result;
+}
+
+//游标停着的叶子是否就是 key 该插入的叶子：落在已有 key 之间，或者是最右边的叶子
+static bool cursor_leaf_covers(Cursor *cursor, uint32_t key) {
+    void *node = cursor->node;
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    if (num_cells == 0) {
+        return cursor->depth == 0;
+    }
+    if (key < *leaf_node_key(node, 0)) {
+        return false;
+    }
+    return key <= *leaf_node_key(node, num_cells - 1) || *leaf_node_next_leaf(node) == 0;
+}
+
+//批量插入：写游标留在上一行的叶子上，下一行还落在这个叶子里就直接定位插入，不再从根下降；
+//叶子分裂后游标失效，下一行重新查找。日志最后一次追加，整批进同一个提交组
+ExecuteResult db_insert_batch(Table *table, const Row *rows, uint32_t count, uint32_t *inserted) {
+    ExecuteResult result = EXECUTE_SUCCESS;
+    Cursor *cursor = NULL;
+    uint32_t num_inserted = 0;
+    table_begin_write(table);
+    for (; num_inserted < count; num_inserted++) {
+        const Row *row = &rows[num_inserted];
+        if (atomic_load(&table->num_rows) == UINT32_MAX) {
+            result = EXECUTE_TABLE_FULL;
+            break;
+        }
+
+        if (cursor != NULL && !cursor_leaf_covers(cursor, row->id)) {
+            cursor_close(cursor);
+            cursor = NULL;
+        }
+        if (cursor == NULL) {
+            cursor = table_find(table, row->id);
+        } else {
+            cursor->cell_num = leaf_node_find_cell(cursor->node, row->id);
+        }
+
+        result = cursor_insert_row(cursor, (Row *) row);
+        if (result != EXECUTE_SUCCESS) {
+            break;
+        }
+        if (cursor->node == NULL) {
+            //叶子分裂了
+            cursor_close(cursor);
+            cursor = NULL;
+        }
+    }
+    if (cursor != NULL) {
+        cursor_close(cursor);
+    }
+
+    uint64_t lsn = wal_append_inserts(table->wal, rows, num_inserted);
+    table_end_write(table);
+    wal_wait_durable(table->wal, lsn);
+    if (inserted != NULL) {
+        *inserted = num_inserted;
+    }
+    return result;
+}
+
+/*
+ * 批量导入 .import <file>
+ * 文件按大块读入，逐行解析成 Row。第一行有制表符按 TSV 解析，否则按 CSV（支持引号），
+ * 第一行的第一个字段（去掉引号）不以数字开头视为表头跳过。
+ * 表为空且 id 严格递增时自底向上构造 B+树：叶子填满后按页号顺序追加写入文件，
+ * 每层内部节点满了也追加写出，最上层的节点最后写进根页。这部分不写日志，
+ * 换根之前先 fdatasync，崩溃时根页仍是空表。
+ * 遇到乱序的行，已经构造的部分先收尾成完整的树，剩下的行逐行 table_insert 并写日志。
+ */
+
+typedef struct {
+    int file_descriptor;
+    char *buffer;
+    size_t capacity;
+    size_t start;       //下一行的起点
+    size_t scan;        //已经找过换行符的位置
+    size_t end;
+    bool in_quotes;     //scan 处是否在引号里
+    bool eof;
+    char separator;
+} ImportReader;
+
+static void import_reader_fill(ImportReader *reader) {
+    if (reader->start > 0) {
+        memmove(reader->buffer, reader->buffer + reader->start, reader->end - reader->start);
+        reader->end -= reader->start;
+        reader->scan -= reader->start;
+        reader->start = 0;
+    }
+    if (reader->end == reader->capacity) {
+        //一行比缓冲还长
+        reader->capacity *= 2;
+        reader->buffer = realloc(reader->buffer, reader->capacity);
+    }
+    ssize_t bytes_read = read(reader->file_descriptor, reader->buffer + reader->end,
+                              reader->capacity - reader->end);
+    if (bytes_read == -1) {
+        printf("Error reading import file: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    if (bytes_read == 0) {
+        reader->eof = true;
+    }
+    reader->end += bytes_read;
+}
+
+static void import_reader_open(ImportReader *reader, int file_descriptor) {
+    reader->file_descriptor = file_descriptor;
+    reader->capacity = IMPORT_READ_SIZE;
+    reader->buffer = malloc(reader->capacity);
+    reader->start = 0;
+    reader->scan = 0;
+    reader->end = 0;
+    reader->in_quotes = false;
+    reader->eof = false;
+    import_reader_fill(reader);
+
+    //看第一行决定分隔符
+    char *newline = memchr(reader->buffer, '\n', reader->end);
+    size_t first_line = newline != NULL ? (size_t) (newline - reader->buffer) : reader->end;
+    reader->separator = memchr(reader->buffer, '\t', first_line) != NULL ? '\t' : ',';
+}
+
+//返回下一行，不含换行符，文件结束返回 NULL。CSV 引号里的换行不算行尾
+static char *import_next_line(ImportReader *reader, size_t *length) {
+    while (true) {
+        char *buffer = reader->buffer;
+        while (reader->scan < reader->end) {
+            char *p = buffer + reader->scan;
+            size_t remaining = reader->end - reader->scan;
+            if (reader->in_quotes) {
+                char *quote = memchr(p, '"', remaining);
+                reader->scan = quote != NULL ? (size_t) (quote - buffer) + 1 : reader->end;
+                reader->in_quotes = quote == NULL;
+                continue;
+            }
+            char *newline = memchr(p, '\n', remaining);
+            size_t span = newline != NULL ? (size_t) (newline - p) : remaining;
+            char *quote = reader->separator == ',' ? memchr(p, '"', span) : NULL;
+            if (quote != NULL) {
+                reader->scan = (quote - buffer) + 1;
+                reader->in_quotes = true;
+                continue;
+            }
+            if (newline == NULL) {
+                reader->scan = reader->end;
+                break;
+            }
+            char *line = buffer + reader->start;
+            *length = newline - line;
+            reader->start = (newline - buffer) + 1;
+            reader->scan = reader->start;
+            if (*length > 0 && line[*length - 1] == '\r') {
+                (*length)--;
+            }
+            return line;
+        }
+
+        if (reader->eof) {
+            if (reader->start == reader->end) {
+                return NULL;
+            }
+            //最后一行没有换行符
+            char *line = buffer + reader->start;
+            *length = reader->end - reader->start;
+            reader->start = reader->end;
+            reader->scan = reader->end;
+            if (*length > 0 && line[*length - 1] == '\r') {
+                (*length)--;
+            }
+            return line;
+        }
+        import_reader_fill(reader);
+    }
+}
+
+static void import_reader_close(ImportReader *reader) {
+    free(reader->buffer);
+}
+
+//取出一个字段写到 out 并补 '\0'，more 表示后面还有字段；超过 max_length 返回 false
+static bool import_parse_field(const char **cursor, const char *end, char separator,
+                               char *out, uint32_t max_length, bool *more) {
+    const char *p = *cursor;
+    uint32_t length = 0;
+    if (separator == ',' && p < end && *p == '"') {
+        //引号里的 "" 表示一个引号
+        p++;
+        while (p < end) {
+            char c = *p++;
+            if (c == '"') {
+                if (p < end && *p == '"') {
+                    p++;
+                } else {
+                    break;
+                }
+            }
+            if (length == max_length) {
+                return false;
+            }
+            out[length++] = c;
+        }
+    }
+    while (p < end && *p != separator) {
+        if (length == max_length) {
+            return false;
+        }
+        out[length++] = *p++;
+    }
+    out[length] = '\0';
+    *more = p < end;
+    *cursor = *more ? p + 1 : p;
+    return true;
+}
+
+//第一行的第一个字段去掉引号后不是数字就当作表头；全部加了引号的 CSV 第一行也可能是数据
+static bool import_is_header(const char *line, size_t length, char separator) {
+    const char *p = line;
+    char field[16];
+    bool more;
+    field[0] = '\0';
+    //太长时返回 false，但开头的字符已经写进 field
+    import_parse_field(&p, line + length, separator, field, sizeof(field) - 1, &more);
+    return !isdigit((unsigned char) field[0]);
+}
+
+static PrepareResult import_parse_row(const char *line, size_t length, char separator, Row *row) {
+    const char *p = line;
+    const char *end = line + length;
+    char id_text[16];
+    bool more;
+
+    if (!import_parse_field(&p, end, separator, id_text, sizeof(id_text) - 1, &more) || !more) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    if (id_text[0] == '-') {
+        return PREPARE_NEGATIVE_ID;
+    }
+    uint64_t id = 0;
+    for (char *c = id_text; *c != '\0'; c++) {
+        if (!isdigit((unsigned char) *c)) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        id = id * 10 + (*c - '0');
+    }
+    if (id_text[0] == '\0' || id > UINT32_MAX) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    row->id = id;
+
+    if (!import_parse_field(&p, end, separator, row->username, COLUMN_USERNAME_SIZE, &more)) {
+        return PREPARE_STRING_TOO_LONG;
+    }
+    if (!more || row->username[0] == '\0') {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    if (!import_parse_field(&p, end, separator, row->email, COLUMN_EMAIL_SIZE, &more)) {
+        return PREPARE_STRING_TOO_LONG;
+    }
+    if (more || row->email[0] == '\0') {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    return PREPARE_SUCCESS;
+}
+
+//自底向上构造中的一层内部节点，最后一个孩子先不写进 cell，收尾时作为 right_child
+typedef struct {
+    void *node;
+    uint32_t num_children;
+    uint32_t last_child;
+    uint32_t last_key;      //最后一个孩子子树的最大 key
+} BulkLevel;
+
+typedef struct {
+    Table *table;
+    void *leaf;                         //正在填的叶子
+    uint32_t num_leaves_written;
+    uint32_t num_rows;
+    uint32_t last_key;
+    BulkLevel levels[BTREE_MAX_DEPTH];  //levels[0] 是叶子的父节点那一层
+    uint32_t num_levels;
+    uint32_t next_page;                 //下一个分配的页号，页号只增不减
+    char *stage;                        //写好还没落盘的页，页号从 stage_first_page 开始连续
+    uint32_t stage_first_page;
+} BulkLoader;
+
+static bool table_is_empty(Table *table) {
+    if (atomic_load(&table->num_rows) > 0) {
+        return false;
+    }
+    void *root = get_page_ro(table->pager, table->root_page_num);
+    bool empty = get_node_type(root) == NODE_LEAF && *leaf_node_num_cells(root) == 0;
+    pager_unpin_ro(table->pager, table->root_page_num, root);
+    return empty;
+}
+
+static void bulk_loader_init(BulkLoader *loader, Table *table) {
+    loader->table = table;
+    loader->leaf = malloc(PAGE_SIZE);
+    memset(loader->leaf, 0, PAGE_SIZE);
+    initialize_leaf_node(loader->leaf);
+    loader->num_leaves_written = 0;
+    loader->num_rows = 0;
+    loader->last_key = 0;
+    loader->num_levels = 0;
+    //新页连续追加在文件末尾，才能按段写出，空闲页留给普通插入
+    loader->next_page = table->pager->num_pages;
+    loader->stage = malloc((size_t) IMPORT_STAGE_PAGES * PAGE_SIZE);
+    loader->stage_first_page = loader->next_page;
+}
+
+static void bulk_flush_stage(BulkLoader *loader) {
+    uint32_t num_pages = loader->next_page - loader->stage_first_page;
+    if (num_pages > 0) {
+        pager_write_pages(loader->table->pager, loader->stage_first_page, loader->stage, num_pages);
+    }
+    loader->stage_first_page = loader->next_page;
+}
+
+//保证接下来分配的 count 个页都能放进暂存区
+static void bulk_reserve_stage(BulkLoader *loader, uint32_t count) {
+    if (loader->next_page + count > loader->stage_first_page + IMPORT_STAGE_PAGES) {
+        bulk_flush_stage(loader);
+    }
+}
+
+static void bulk_stage_page(BulkLoader *loader, uint32_t page_num, void *node) {
+    memcpy(loader->stage + (size_t) (page_num - loader->stage_first_page) * PAGE_SIZE, node, PAGE_SIZE);
+}
+
+static void bulk_push_child(BulkLoader *loader, uint32_t level, uint32_t child, uint32_t key);
+
+//把一层的节点收尾：最后一个孩子作为 right_child
+static void bulk_close_level(BulkLevel *level) {
+    *internal_node_right_child(level->node) = level->last_child;
+}
+
+//写出一层的节点，并作为孩子加到上一层
+static void bulk_flush_level(BulkLoader *loader, uint32_t level) {
+    BulkLevel *current = &loader->levels[level];
+    bulk_close_level(current);
+    uint32_t page_num = loader->next_page++;
+    bulk_stage_page(loader, page_num, current->node);
+    uint32_t max_key = current->last_key;
+    initialize_internal_node(current->node);
+    current->num_children = 0;
+    bulk_push_child(loader, level + 1, page_num, max_key);
+}
+
+static void bulk_push_child(BulkLoader *loader, uint32_t level, uint32_t child, uint32_t key) {
+    if (level == loader->num_levels) {
+        if (level == BTREE_MAX_DEPTH) {
+            printf("Error: B+tree deeper than %d levels.\n", BTREE_MAX_DEPTH);
+            exit(EXIT_FAILURE);
+        }
+        loader->levels[level].node = malloc(PAGE_SIZE);
+        memset(loader->levels[level].node, 0, PAGE_SIZE);
+        initialize_internal_node(loader->levels[level].node);
+        loader->levels[level].num_children = 0;
+        loader->num_levels++;
+    }
+
+    BulkLevel *current = &loader->levels[level];
+    if (current->num_children == INTERNAL_NODE_MAX_KEYS + 1) {
+        bulk_flush_level(loader, level);
+    }
+    if (current->num_children > 0) {
+        //先加 num_keys，避免 internal_node_child 返回 right_child
+        uint32_t index = (*internal_node_num_keys(current->node))++;
+        *internal_node_child(current->node, index) = current->last_child;
+        *internal_node_key(current->node, index) = current->last_key;
+    }
+    current->last_child = child;
+    current->last_key = key;
+    current->num_children++;
+}
+
+//写出放满的叶子。下一个分配的页一定是下一片叶子，因为中间的内部节点都在这之前写出
+static void bulk_flush_leaf(BulkLoader *loader, bool last) {
+    bulk_reserve_stage(loader, loader->num_levels + 2);
+    uint32_t page_num = loader->next_page++;
+    void *leaf = loader->leaf;
+    bulk_push_child(loader, 0, page_num, *leaf_node_key(leaf, *leaf_node_num_cells(leaf) - 1));
+    *leaf_node_next_leaf(leaf) = last ? 0 : loader->next_page;
+    bulk_stage_page(loader, page_num, leaf);
+    loader->num_leaves_written++;
+}
+
+static void bulk_loader_add(BulkLoader *loader, Row *row) {
+    void *leaf = loader->leaf;
+    uint8_t record[2 + COLUMN_USERNAME_SIZE + COLUMN_EMAIL_SIZE];
+    uint32_t length = serialize_row(row, record);
+    if (leaf_node_free_space(leaf) < LEAF_NODE_SLOT_SIZE + length) {
+        bulk_flush_leaf(loader, false);
+        initialize_leaf_node(leaf);
+    }
+    leaf_node_append(leaf, row->id, record, length);
+    loader->last_key = row->id;
+    loader->num_rows++;
+}
+
+//收尾：写出剩下的叶子和各层节点，最上层的节点放进根页
+static void bulk_loader_finish(BulkLoader *loader) {
+    Table *table = loader->table;
+    void *root = loader->leaf;
+    if (loader->num_rows > 0 && loader->num_leaves_written > 0) {
+        bulk_flush_leaf(loader, true);
+        for (uint32_t level = 0; level + 1 < loader->num_levels; level++) {
+            bulk_reserve_stage(loader, loader->num_levels + 1);
+            bulk_flush_level(loader, level);
+        }
+        root = loader->levels[loader->num_levels - 1].node;
+        bulk_close_level(&loader->levels[loader->num_levels - 1]);
+    }
+
+    if (loader->num_rows > 0) {
+        //新页先落盘，再换根
+        bulk_flush_stage(loader);
+        if (loader->num_leaves_written > 0 && fdatasync(table->pager->file_descriptor) == -1) {
+            printf("Error syncing db file: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+        version_add_bulk(&table->versions, table->write_ts);
+        void *node = get_page(table->pager, table->root_page_num);
+        memcpy(node, root, PAGE_SIZE);
+        set_node_root(node, true);
+        pager_mark_dirty(table->pager, table->root_page_num);
+        pager_unpin(table->pager, table->root_page_num);
+        atomic_fetch_add(&table->num_rows, loader->num_rows);
+        //构造期间页号归 loader 连续分配，索引不能跟着分配页，换根后一次登记
+        for (uint32_t i = 0; i < NUM_INDEX_COLUMNS; i++) {
+            table_index_existing(table, i);
+        }
+    }
+
+    for (uint32_t level = 0; level < loader->num_levels; level++) {
+        free(loader->levels[level].node);
+    }
+    free(loader->leaf);
+    free(loader->stage);
+}
+
+static const char *import_error_message(PrepareResult result) {
+    switch (result) {
+        case (PREPARE_NEGATIVE_ID):
+            return "ID must be positive.";
+        case (PREPARE_STRING_TOO_LONG):
+            return "String is too long.";
+        default:
+            return "Syntax error.";
+    }
+}
+
+//导入出错时停在出错的行，之前的行保留
+void db_import(Table *table, const char *filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        printf("Unable to open import file '%s'\n", filename);
+        return;
+    }
+
+    table_begin_write(table);
+    ImportReader reader;
+    import_reader_open(&reader, fd);
+    BulkLoader loader;
+    bool bulk = table_is_empty(table);
+    if (bulk) {
+        bulk_loader_init(&loader, table);
+    }
+
+    uint32_t line_num = 0;
+    uint32_t num_imported = 0;
+    char *line;
+    size_t length;
+    while ((line = import_next_line(&reader, &length)) != NULL) {
+        line_num++;
+        if (length == 0 || (line_num == 1 && import_is_header(line, length, reader.separator))) {
+            //空行和表头
+            continue;
+        }
+
+        Row row;
+        PrepareResult parsed = import_parse_row(line, length, reader.separator, &row);
+        if (parsed != PREPARE_SUCCESS) {
+            printf("Error on line %d: %s\n", line_num, import_error_message(parsed));
+            break;
+        }
+
+        if (bulk && (loader.num_rows == 0 || row.id > loader.last_key)) {
+            bulk_loader_add(&loader, &row);
+            num_imported++;
+            continue;
+        }
+        if (bulk) {
+            //不再有序，已经构造的部分收尾，后面逐行插入
+            bulk_loader_finish(&loader);
+            bulk = false;
+        }
+
+        ExecuteResult result = table_insert(table, &row);
+        if (result == EXECUTE_DUPLICATE_KEY) {
+            printf("Error on line %d: Duplicate key.\n", line_num);
+            break;
+        } else if (result == EXECUTE_TABLE_FULL) {
+            printf("Error on line %d: Table full.\n", line_num);
+            break;
+        }
+        wal_append_insert(table->wal, &row);
+        num_imported++;
+    }
+
+    if (bulk) {
+        bulk_loader_finish(&loader);
+    }
+    import_reader_close(&reader);
+    close(fd);
+
+    //导入的页和日志一次刷盘
+    table_checkpoint(table);
+    table_end_write(table);
+    printf("Imported %d rows.\n", num_imported);
+}
+
+/*
+ * where 条件求值，直接在叶子页的紧凑字节上做，不匹配的行不会被反序列化
+ * id 区间和 != 用 SIMD 一次比较多行：叶子里的 id 连续存放，AVX2 一次读 8 个，SSE2 一次读 4 个；
+ * 字符串条件只对 id 已经匹配的行做
+ */
+
+//逐个比较，没有 SIMD 的平台和 SIMD 版本的尾部用
+static uint32_t filter_ids_scalar(const uint32_t *ids, uint32_t count,
+                                  uint32_t lo, uint32_t hi,
+                                  const uint32_t *excluded, uint32_t num_excluded,
+                                  uint8_t *match) {
+    uint32_t num_matched = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t id = ids[i];
+        bool ok = id - lo <= hi - lo;
+        for (uint32_t e = 0; ok && e < num_excluded; e++) {
+            ok = id != excluded[e];
+        }
+        match[i] = ok;
+        num_matched += ok;
+    }
+    return num_matched;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+//lo <= id <= hi 等价于 (id - lo) <= (hi - lo)，无符号比较借助符号位翻转变成有符号比较
+__attribute__((target("avx2")))
+static uint32_t filter_ids_avx2(const uint32_t *ids, uint32_t count,
+                                uint32_t lo, uint32_t hi,
+                                const uint32_t *excluded, uint32_t num_excluded,
+                                uint8_t *match) {
+    const __m256i bias = _mm256_set1_epi32((int) 0x80000000u);
+    const __m256i lo_vec = _mm256_set1_epi32((int) lo);
+    const __m256i span = _mm256_xor_si256(_mm256_set1_epi32((int) (hi - lo)), bias);
+    uint32_t i = 0;
+    uint32_t num_matched = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i id = _mm256_loadu_si256((const __m256i *) (ids + i));
+        __m256i delta = _mm256_xor_si256(_mm256_sub_epi32(id, lo_vec), bias);
+        __m256i out = _mm256_cmpgt_epi32(delta, span);
+        for (uint32_t e = 0; e < num_excluded; e++) {
+            out = _mm256_or_si256(out, _mm256_cmpeq_epi32(id, _mm256_set1_epi32((int) excluded[e])));
+        }
+        uint32_t bits = ~_mm256_movemask_ps(_mm256_castsi256_ps(out)) & 0xFF;
+        for (uint32_t k = 0; k < 8; k++) {
+            match[i + k] = (bits >> k) & 1;
+        }
+        num_matched += __builtin_popcount(bits);
+    }
+    //不足一组的尾部逐个比较
+    return num_matched + filter_ids_scalar(ids + i, count - i, lo, hi, excluded, num_excluded, match + i);
+}
+
+static uint32_t filter_ids_sse2(const uint32_t *ids, uint32_t count,
+                                uint32_t lo, uint32_t hi,
+                                const uint32_t *excluded, uint32_t num_excluded,
+                                uint8_t *match) {
+    const __m128i bias = _mm_set1_epi32((int) 0x80000000u);
+    const __m128i lo_vec = _mm_set1_epi32((int) lo);
+    const __m128i span = _mm_xor_si128(_mm_set1_epi32((int) (hi - lo)), bias);
+    uint32_t i = 0;
+    uint32_t num_matched = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i id = _mm_loadu_si128((const __m128i *) (ids + i));
+        __m128i delta = _mm_xor_si128(_mm_sub_epi32(id, lo_vec), bias);
+        __m128i out = _mm_cmpgt_epi32(delta, span);
+        for (uint32_t e = 0; e < num_excluded; e++) {
+            out = _mm_or_si128(out, _mm_cmpeq_epi32(id, _mm_set1_epi32((int) excluded[e])));
+        }
+        uint32_t bits = ~_mm_movemask_ps(_mm_castsi128_ps(out)) & 0xF;
+        for (uint32_t k = 0; k < 4; k++) {
+            match[i + k] = (bits >> k) & 1;
+        }
+        num_matched += __builtin_popcount(bits);
+    }
+    //不足一组的尾部逐个比较
+    return num_matched + filter_ids_scalar(ids + i, count - i, lo, hi, excluded, num_excluded, match + i);
+}
+#endif
+
+//对 count 个连续的 id 求 lo <= id <= hi 且不在 excluded 中，结果写入 match
+static uint32_t filter_ids(const uint32_t *ids, uint32_t count,
+                    uint32_t lo, uint32_t hi,
+                    const uint32_t *excluded, uint32_t num_excluded,
+                    uint8_t *match) {
+#if defined(__x86_64__) || defined(__i386__)
+    static int has_avx2 = -1;
+    if (has_avx2 == -1) {
+        has_avx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+    }
+    if (has_avx2) {
+        return filter_ids_avx2(ids, count, lo, hi, excluded, num_excluded, match);
+    }
+    return filter_ids_sse2(ids, count, lo, hi, excluded, num_excluded, match);
+#else
+    return filter_ids_scalar(ids, count, lo, hi, excluded, num_excluded, match);
+#endif
+}
+
+//field 是变长记录里的字符串内容，field_length 是它的长度前缀，不以 0 结尾
+static bool text_field_matches(const char *field, uint32_t field_length, Predicate *predicate) {
+    if (field_length < predicate->length ||
+        (predicate->op == PREDICATE_EQUALS && field_length != predicate->length)) {
+        return false;
+    }
+    return memcmp(field, predicate->text, predicate->length) == 0;
+}
+
+//在叶子的 [first_cell, num_cells) 上求值，id 限定在 [id_lo, id_hi]
+//match[i] 对应第 first_cell + i 个 cell，返回匹配的行数
+static uint32_t leaf_node_filter(void *node, uint32_t first_cell, uint32_t id_lo, uint32_t id_hi,
+                          Statement *statement, uint8_t *match) {
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    if (first_cell >= num_cells) {
+        return 0;
+    }
+    uint32_t count = num_cells - first_cell;
+    uint32_t num_matched = filter_ids(leaf_node_key(node, first_cell), count, id_lo, id_hi,
+                                      statement->id_excluded, statement->num_id_excluded,
+                                      match);
+    if (num_matched == 0 || statement->num_predicates == 0) {
+        return num_matched;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (!match[i]) {
+            continue;
+        }
+        const void *record = leaf_node_value(node, first_cell + i);
+        for (uint32_t p = 0; p < statement->num_predicates; p++) {
+            Predicate *predicate = &statement->predicates[p];
+            uint32_t length;
+            const char *field = predicate->column == COLUMN_USERNAME
+                                ? record_username(record, &length)
+                                : record_email(record, &length);
+            bool ok = text_field_matches(field, length, predicate);
+            if (!ok) {
+                match[i] = 0;
+                num_matched--;
+                break;
+            }
+        }
+    }
+    return num_matched;
+}
+
+typedef void (*RowCallback)(Row *row, void *context);
+//match[i] 对应叶子里第 first_cell + i 个 cell
+typedef void (*LeafCallback)(void *node, uint32_t first_cell, uint8_t *match,
+                             uint32_t num_matched, void *context);
+
+//扫描中途让出：每个叶子处理完后问 ready，为 true 时先放掉叶子再调用 run，之后从下一个 id 重新定位
+typedef struct {
+    bool (*ready)(void *context);
+    void (*run)(void *context);
+    void *context;
+} ScanYield;
+
+//where 里有建了索引的列上的等值条件、快照晚于建索引时，返回索引的元数据页号和要找的哈希值，否则返回 0
+//建索引时先写 index_ts 再写 index_pages，读到页号时时间戳已经是新的
+static uint32_t table_index_for(Table *table, const Statement *statement, const Snapshot *snapshot,
+                                uint32_t *hash) {
+    for (uint32_t i = 0; i < statement->num_predicates; i++) {
+        const Predicate *predicate = &statement->predicates[i];
+        if (predicate->op != PREDICATE_EQUALS || predicate->column == COLUMN_ID) {
+            continue;
+        }
+        uint32_t slot = predicate->column - COLUMN_USERNAME;
+        uint32_t meta_page_num = atomic_load(&table->index_pages[slot]);
+        if (meta_page_num != 0 && snapshot->ts >= atomic_load(&table->index_ts[slot])) {
+            *hash = text_hash(predicate->text, predicate->length);
+            return meta_page_num;
+        }
+    }
+    return 0;
+}
+
+static int compare_ids(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *) a;
+    uint32_t y = *(const uint32_t *) b;
+    return (x > y) - (x < y);
+}
+
+//拼好的行在 view 上求值 where 条件（顺带去掉哈希冲突的行），交给 callback 后清空 view
+static void index_view_flush(void *view, Statement *statement, uint32_t id_lo, uint32_t id_hi,
+                             LeafCallback callback, void *context) {
+    uint8_t match[LEAF_NODE_MAX_CELLS];
+    uint32_t num_matched = leaf_node_filter(view, 0, id_lo, id_hi, statement, match);
+    if (num_matched > 0) {
+        callback(view, 0, match, num_matched, context);
+    }
+    initialize_leaf_node(view);
+}
+
+//按索引扫描：候选 id 排序去重后逐个回表，快照看到的内容拷进 view，按 id 顺序交给 callback
+//回表时不持有索引页，每次只钉一个叶子
+static void table_index_scan(Table *table, Statement *statement, const Snapshot *snapshot,
+                             uint32_t meta_page_num, uint32_t hash, uint32_t id_lo, uint32_t id_hi,
+                             LeafCallback callback, void *context, const ScanYield *yield) {
+    uint8_t record[2 + COLUMN_USERNAME_SIZE + COLUMN_EMAIL_SIZE];
+    uint32_t *ids;
+    uint32_t count = hash_index_lookup(table->pager, meta_page_num, hash, &ids);
+    qsort(ids, count, sizeof(uint32_t), compare_ids);
+    void *view = malloc(PAGE_SIZE);
+    initialize_leaf_node(view);
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t id = ids[i];
+        if ((i > 0 && id == ids[i - 1]) || id < id_lo || id > id_hi) {
+            continue;
+        }
+        Cursor *cursor = table_seek(table, id);
+        if (cursor->end_of_table || cursor_key(cursor) != id) {
+            cursor_close(cursor);
+            continue;
+        }
+        void *node = cursor->node;
+        uint32_t cell = cursor->cell_num;
+        bool deleted = leaf_node_is_deleted(node, cell);
+        VersionVisibility visibility = deleted ? VERSION_HIDDEN : VERSION_CURRENT;
+        uint32_t length = leaf_node_record_size(node, cell);
+        memcpy(record, leaf_node_value(node, cell), length);
+        if (!snapshot_sees_all(snapshot)) {
+            const Row *older;
+            pthread_rwlock_rdlock(&snapshot->store->lock);
+            visibility = snapshot_sees_locked(snapshot, id, deleted, &older);
+            if (visibility == VERSION_OLDER) {
+                length = serialize_row((Row *) older, record);
+            }
+            pthread_rwlock_unlock(&snapshot->store->lock);
+        }
+        cursor_close(cursor);
+        if (visibility == VERSION_HIDDEN) {
+            continue;
+        }
+
+        if (leaf_node_free_space(view) < LEAF_NODE_SLOT_SIZE + length) {
+            index_view_flush(view, statement, id_lo, id_hi, callback, context);
+            if (yield != NULL && yield->ready(yield->context)) {
+                yield->run(yield->context);
+            }
+        }
+        leaf_node_append(view, id, record, length);
+    }
+    index_view_flush(view, statement, id_lo, id_hi, callback, context);
+    free(view);
+    free(ids);
+}
+
+//按 id 顺序逐个叶子扫描 [id_lo, id_hi]，每个叶子先求值 where 条件、去掉快照看不到的行，
+//再把匹配结果交给 callback；有行要看旧内容时 callback 拿到的是按快照拼出的拷贝。yield 可以为 NULL
+//where 里有能用索引的等值条件时改走 table_index_scan
+static void table_scan_leaves(Table *table, Statement *statement, const Snapshot *snapshot,
+                       uint32_t id_lo, uint32_t id_hi, LeafCallback callback, void *context,
+                       const ScanYield *yield) {
+    uint32_t hash;
+    uint32_t meta_page_num = table_index_for(table, statement, snapshot, &hash);
+    if (meta_page_num != 0) {
+        table_index_scan(table, statement, snapshot, meta_page_num, hash, id_lo, id_hi,
+                         callback, context, yield);
+        return;
+    }
+
+    uint8_t match[LEAF_NODE_MAX_CELLS];
+    void *view = NULL;
+    Cursor *cursor = table_seek(table, id_lo);
+    while (!cursor->end_of_table) {
+        void *node = cursor->node;
+        uint32_t num_cells = *leaf_node_num_cells(node);
+        uint32_t first_cell = cursor->cell_num;
+        uint32_t num_matched = leaf_node_filter(node, first_cell, id_lo, id_hi, statement, match);
+        bool needs_view = false;
+        num_matched = snapshot_filter_leaf(snapshot, node, first_cell, match, num_matched, &needs_view);
+        if (needs_view) {
+            //在拷贝上重新求值，拷贝放不下整个叶子时分几次
+            if (view == NULL) {
+                view = malloc(PAGE_SIZE);
+            }
+            for (uint32_t cell = first_cell; cell < num_cells;) {
+                cell = snapshot_leaf_view(snapshot, node, cell, view);
+                num_matched = leaf_node_filter(view, 0, id_lo, id_hi, statement, match);
+                if (num_matched > 0) {
+                    callback(view, 0, match, num_matched, context);
+                }
+            }
+        } else if (num_matched > 0) {
+            callback(node, first_cell, match, num_matched, context);
+        }
+        //叶子里最大的 id 已经到上界，后面的叶子不用再读
+        uint32_t last_key = *leaf_node_key(node, num_cells - 1);
+        if (last_key >= id_hi) {
+            break;
+        }
+        if (yield != NULL && yield->ready(yield->context)) {
+            //快照不变，放掉叶子期间提交的行重新定位后也看不到
+            cursor_close(cursor);
+            yield->run(yield->context);
+            cursor = table_seek(table, last_key + 1);
+            continue;
+        }
+        cursor->cell_num = num_cells;
+        cursor_settle(cursor);
+    }
+    cursor_close(cursor);
+    free(view);
+}
+
+typedef struct {
+    RowCallback callback;
+    void *context;
+} RowScan;
+
+static void deserialize_matched_rows(void *node, uint32_t first_cell, uint8_t *match,
+                                     uint32_t num_matched, void *context) {
+    RowScan *scan = context;
+    Row row;
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    for (uint32_t i = first_cell; i < num_cells; i++) {
+        if (match[i - first_cell]) {
+            leaf_node_read_row(node, i, &row);
+            scan->callback(&row, scan->context);
+        }
+    }
+}
+
+//只反序列化满足 where 条件的行
+static void table_scan(Table *table, Statement *statement, const Snapshot *snapshot,
+                uint32_t id_lo, uint32_t id_hi, RowCallback callback, void *context,
+                const ScanYield *yield) {
+    RowScan scan = {callback, context};
+    table_scan_leaves(table, statement, snapshot, id_lo, id_hi,
+                      deserialize_matched_rows, &scan, yield);
+}
+
+/*
+ * select 结果输出
+ * 行按当前格式直接格式化进大块缓冲，不经过 printf。
+ * 所有块写满或语句结束时用一次 writev 写出，写之前先 fflush(stdout)，保证和提示信息的顺序。
+ */
+
+typedef struct ResultSink ResultSink;
+
+struct ResultSink {
+    int file_descriptor;
+    //把一行写到 out，返回字节数，不超过 OUTPUT_ROW_MAX_SIZE
+    uint32_t (*format_row)(char *out, Row *row);
+    char *buffer;
+    struct iovec blocks[OUTPUT_MAX_BLOCKS];
+    uint32_t num_blocks;    //已使用的块数，最后一块可能没写满
+};
+
+static uint32_t format_uint32(char *out, uint32_t value) {
+    char digits[10];
+    uint32_t n = 0;
+    do {
+        digits[n++] = (char) ('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+    for (uint32_t i = 0; i < n; i++) {
+        out[i] = digits[n - 1 - i];
+    }
+    return n;
+}
+
+static uint32_t format_text_row(char *out, Row *row) {
+    char *p = out;
+    *p++ = '(';
+    p += format_uint32(p, row->id);
+    *p++ = ',';
+    *p++ = ' ';
+    size_t username_length = strlen(row->username);
+    memcpy(p, row->username, username_length);
+    p += username_length;
+    *p++ = ',';
+    *p++ = ' ';
+    size_t email_length = strlen(row->email);
+    memcpy(p, row->email, email_length);
+    p += email_length;
+    *p++ = ')';
+    *p++ = '\n';
+    return p - out;
+}
+
+//含逗号、引号、换行的字段用引号括起来，内部的引号写两遍
+static uint32_t format_csv_field(char *out, const char *field) {
+    if (strpbrk(field, ",\"\r\n") == NULL) {
+        size_t length = strlen(field);
+        memcpy(out, field, length);
+        return length;
+    }
+    char *p = out;
+    *p++ = '"';
+    for (const char *c = field; *c != '\0'; c++) {
+        if (*c == '"') {
+            *p++ = '"';
+        }
+        *p++ = *c;
+    }
+    *p++ = '"';
+    return p - out;
+}
+
+static uint32_t format_csv_row(char *out, Row *row) {
+    char *p = out;
+    p += format_uint32(p, row->id);
+    *p++ = ',';
+    p += format_csv_field(p, row->username);
+    *p++ = ',';
+    p += format_csv_field(p, row->email);
+    *p++ = '\n';
+    return p - out;
+}
+
+static uint32_t format_binary_row(char *out, Row *row) {
+    uint8_t username_length = strlen(row->username);
+    uint8_t email_length = strlen(row->email);
+    uint32_t length = 4 + 1 + username_length + 1 + email_length;
+    char *p = out;
+    memcpy(p, &length, 4);
+    memcpy(p + 4, &row->id, 4);
+    p += 8;
+    *p++ = (char) username_length;
+    memcpy(p, row->username, username_length);
+    p += username_length;
+    *p++ = (char) email_length;
+    memcpy(p, row->email, email_length);
+    p += email_length;
+    return p - out;
+}
+
+//写出所有块，处理部分写
+static void sink_flush(ResultSink *sink) {
+    if (sink->num_blocks == 0) {
+        return;
+    }
+    fflush(stdout);
+    struct iovec *iov = sink->blocks;
+    int iovcnt = sink->num_blocks;
+    while (iovcnt > 0) {
+        ssize_t written = writev(sink->file_descriptor, iov, iovcnt);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            printf("Error writing output: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+        while (iovcnt > 0 && (size_t) written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *) iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    sink->num_blocks = 0;
+}
+
+//返回剩余空间至少 length 字节的当前块，必要时换下一块或先写出
+static struct iovec *sink_reserve(ResultSink *sink, uint32_t length) {
+    if (sink->num_blocks > 0 &&
+        sink->blocks[sink->num_blocks - 1].iov_len + length <= OUTPUT_BLOCK_SIZE) {
+        return &sink->blocks[sink->num_blocks - 1];
+    }
+    if (sink->num_blocks == OUTPUT_MAX_BLOCKS) {
+        sink_flush(sink);
+    }
+    struct iovec *block = &sink->blocks[sink->num_blocks];
+    block->iov_base = sink->buffer + (size_t) sink->num_blocks * OUTPUT_BLOCK_SIZE;
+    block->iov_len = 0;
+    sink->num_blocks++;
+    return block;
+}
+
+static void sink_write(ResultSink *sink, const char *data, uint32_t length) {
+    struct iovec *block = sink_reserve(sink, length);
+    memcpy((char *) block->iov_base + block->iov_len, data, length);
+    block->iov_len += length;
+}
+
+//直接格式化进块里，不经过中间缓冲
+static void sink_write_row(ResultSink *sink, Row *row) {
+    struct iovec *block = sink_reserve(sink, OUTPUT_ROW_MAX_SIZE);
+    block->iov_len += sink->format_row((char *) block->iov_base + block->iov_len, row);
+}
+
+static void sink_open(ResultSink *sink, OutputMode mode, int file_descriptor) {
+    sink->file_descriptor = file_descriptor;
+    sink->buffer = malloc((size_t) OUTPUT_BLOCK_SIZE * OUTPUT_MAX_BLOCKS);
+    sink->num_blocks = 0;
+    switch (mode) {
+        case (OUTPUT_TEXT):
+            sink->format_row = format_text_row;
+            break;
+        case (OUTPUT_CSV):
+            sink->format_row = format_csv_row;
+            sink_write(sink, "id,username,email\n", strlen("id,username,email\n"));
+            break;
+        case (OUTPUT_BINARY):
+            sink->format_row = format_binary_row;
+            break;
+    }
+}
+
+static void sink_close(ResultSink *sink) {
+    sink_flush(sink);
+    free(sink->buffer);
+}
+
+static void sink_row_callback(Row *row, void *context) {
+    sink_write_row((ResultSink *) context, row);
+}
+
+//写出可能阻塞在慢的输出上，扫描在叶子之间、不钉页的时候做
+static bool sink_flush_due(void *context) {
+    ResultSink *sink = context;
+    return sink->num_blocks + OUTPUT_YIELD_BLOCKS > OUTPUT_MAX_BLOCKS;
+}
+
+static void sink_flush_yield(void *context) {
+    sink_flush((ResultSink *) context);
+}
+
+/*
+ * 并行全表扫描
+ * 用内部节点的分隔 key 把 id 区间切成若干块，每块约 PARALLEL_SCAN_CHUNK_LEAVES 个叶子。
+ * 块按 id 顺序发给空闲的工作线程，工作线程把块内的行按输出格式写进块自己的字节缓冲，调用者按块的顺序输出，结果仍按 id 有序。
+ * 同时在途的块不超过线程数的两倍：输出慢（比如 stdout 阻塞）时工作线程停下来等，内存不随表的大小增长。
+ */
+
+typedef struct {
+    uint32_t first_id;      //块覆盖的 id 区间，闭区间
+    uint32_t last_id;
+    char *output;           //格式化好的行
+    uint32_t length;
+    uint32_t capacity;
+    bool done;
+} ScanChunk;
+
+typedef struct {
+    Table *table;
+    Statement *statement;
+    const Snapshot *snapshot;   //所有块用同一个快照
+    uint32_t (*format_row)(char *out, Row *row);
+    ScanChunk *chunks;
+    uint32_t num_chunks;
+    uint32_t next_chunk;        //下一个发出去的块
+    uint32_t next_output;       //调用者下一个要输出的块，之前的块已经释放
+    uint32_t max_in_flight;
+    pthread_mutex_t lock;
+    pthread_cond_t chunk_done;
+    pthread_cond_t chunk_freed;
+} ParallelScan;
+
+//内部节点以上有几层
+static uint32_t btree_height(Table *table) {
+    Pager *pager = table->pager;
+    uint32_t height = 0;
+    uint32_t page_num = table->root_page_num;
+    void *node = get_page_ro(pager, page_num);
+    while (get_node_type(node) == NODE_INTERNAL) {
+        uint32_t child_page_num = *internal_node_child(node, 0);
+        void *child = get_page_ro(pager, child_page_num);
+        pager_unpin_ro(pager, page_num, node);
+        page_num = child_page_num;
+        node = child;
+        height++;
+    }
+    pager_unpin_ro(pager, page_num, node);
+    return height;
+}
+
+//中序收集所有内部节点的 key，只读内部节点，不碰叶子
+static void btree_collect_separators(Table *table, uint32_t page_num, uint32_t height,
+                                     uint32_t **keys, uint32_t *num_keys, uint32_t *capacity) {
+    Pager *pager = table->pager;
+    void *node = get_page_ro(pager, page_num);
+    uint32_t node_num_keys = *internal_node_num_keys(node);
+    for (uint32_t i = 0; i <= node_num_keys; i++) {
+        if (height > 1) {
+            btree_collect_separators(table, *internal_node_child(node, i), height - 1,
+                                     keys, num_keys, capacity);
+        }
+        if (i < node_num_keys) {
+            if (*num_keys == *capacity) {
+                *capacity *= 2;
+                *keys = realloc(*keys, sizeof(uint32_t) * *capacity);
+            }
+            (*keys)[(*num_keys)++] = *internal_node_key(node, i);
+        }
+    }
+    pager_unpin_ro(pager, page_num, node);
+}
+
+//按顺序取下一个要处理的块，离调用者已经输出到的块太远时等它输出；块都发完了返回 false
+static bool parallel_scan_next_chunk(ParallelScan *scan, uint32_t *chunk_num) {
+    pthread_mutex_lock(&scan->lock);
+    while (scan->next_chunk < scan->num_chunks &&
+           scan->next_chunk >= scan->next_output + scan->max_in_flight) {
+        pthread_cond_wait(&scan->chunk_freed, &scan->lock);
+    }
+    bool found = scan->next_chunk < scan->num_chunks;
+    if (found) {
+        *chunk_num = scan->next_chunk++;
+    }
+    pthread_mutex_unlock(&scan->lock);
+    return found;
+}
+
+typedef struct {
+    ParallelScan *scan;
+    ScanChunk *chunk;
+} ScanChunkWriter;
+
+//匹配的行直接格式化进块自己的缓冲
+static void scan_chunk_append(Row *row, void *context) {
+    ScanChunkWriter *writer = context;
+    ScanChunk *chunk = writer->chunk;
+    if (chunk->length + OUTPUT_ROW_MAX_SIZE > chunk->capacity) {
+        chunk->capacity = chunk->capacity ? chunk->capacity * 2 : OUTPUT_BLOCK_SIZE;
+        chunk->output = realloc(chunk->output, chunk->capacity);
+    }
+    chunk->length += writer->scan->format_row(chunk->output + chunk->length, row);
+}
+
+static void parallel_scan_worker(void *arg, uint32_t worker_id) {
+    ParallelScan *scan = arg;
+    uint32_t chunk_num;
+    (void) worker_id;
+    while (parallel_scan_next_chunk(scan, &chunk_num)) {
+        ScanChunk *chunk = &scan->chunks[chunk_num];
+        ScanChunkWriter writer = {scan, chunk};
+        table_scan(scan->table, scan->statement, scan->snapshot, chunk->first_id, chunk->last_id,
+                   scan_chunk_append, &writer, NULL);
+
+        pthread_mutex_lock(&scan->lock);
+        chunk->done = true;
+        pthread_cond_broadcast(&scan->chunk_done);
+        pthread_mutex_unlock(&scan->lock);
+    }
+}
+
+//并行输出满足条件的行，区间太小不值得并行或者能走索引时返回 false
+static bool parallel_select(Table *table, Statement *statement, const Snapshot *snapshot,
+                     ResultSink *sink) {
+    uint32_t id_min = statement->id_min;
+    uint32_t id_max = statement->id_max;
+    ThreadPool *pool = table->scan_pool;
+    uint32_t hash;
+    //能走索引时只回表几行，不值得切块
+    if (pool == NULL || table_index_for(table, statement, snapshot, &hash) != 0 ||
+        pthread_mutex_trylock(&table->scan_pool_lock) != 0) {
+        return false;
+    }
+    uint32_t height = btree_height(table);
+    if (height == 0) {
+        pthread_mutex_unlock(&table->scan_pool_lock);
+        return false;
+    }
+
+    uint32_t capacity = 64;
+    uint32_t num_separators = 0;
+    uint32_t *separators = malloc(sizeof(uint32_t) * capacity);
+    btree_collect_separators(table, table->root_page_num, height,
+                             &separators, &num_separators, &capacity);
+
+    //每 PARALLEL_SCAN_CHUNK_LEAVES 个叶子切一刀
+    ScanChunk *chunks = malloc(sizeof(ScanChunk) * (num_separators / PARALLEL_SCAN_CHUNK_LEAVES + 1));
+    uint32_t num_chunks = 0;
+    uint64_t first_id = id_min;
+    for (uint32_t i = PARALLEL_SCAN_CHUNK_LEAVES - 1; i < num_separators; i += PARALLEL_SCAN_CHUNK_LEAVES) {
+        if (separators[i] < first_id) {
+            continue;
+        }
+        if (separators[i] >= id_max) {
+            break;
+        }
+        chunks[num_chunks].first_id = first_id;
+        chunks[num_chunks].last_id = separators[i];
+        num_chunks++;
+        first_id = (uint64_t) separators[i] + 1;
+    }
+    chunks[num_chunks].first_id = first_id;
+    chunks[num_chunks].last_id = id_max;
+    num_chunks++;
+    free(separators);
+
+    if (num_chunks < 2) {
+        free(chunks);
+        pthread_mutex_unlock(&table->scan_pool_lock);
+        return false;
+    }
+
+    ParallelScan scan;
+    scan.table = table;
+    scan.statement = statement;
+    scan.snapshot = snapshot;
+    scan.format_row = sink->format_row;
+    scan.chunks = chunks;
+    scan.num_chunks = num_chunks;
+    scan.next_chunk = 0;
+    scan.next_output = 0;
+    scan.max_in_flight = pool->num_threads * 2;
+    pthread_mutex_init(&scan.lock, NULL);
+    pthread_cond_init(&scan.chunk_done, NULL);
+    pthread_cond_init(&scan.chunk_freed, NULL);
+    for (uint32_t i = 0; i < num_chunks; i++) {
+        chunks[i].output = NULL;
+        chunks[i].length = 0;
+        chunks[i].capacity = 0;
+        chunks[i].done = false;
+    }
+
+    thread_pool_start(pool, parallel_scan_worker, &scan);
+
+    //按块顺序归并输出，先完成的块在缓冲里等着；输出完一块就放行下一个块
+    for (uint32_t i = 0; i < num_chunks; i++) {
+        pthread_mutex_lock(&scan.lock);
+        while (!chunks[i].done) {
+            pthread_cond_wait(&scan.chunk_done, &scan.lock);
+        }
+        pthread_mutex_unlock(&scan.lock);
+
+        //一次最多写一整块
+        for (uint32_t offset = 0; offset < chunks[i].length; offset += OUTPUT_BLOCK_SIZE) {
+            uint32_t length = chunks[i].length - offset;
+            sink_write(sink, chunks[i].output + offset, length < OUTPUT_BLOCK_SIZE ? length : OUTPUT_BLOCK_SIZE);
+        }
+        free(chunks[i].output);
+
+        pthread_mutex_lock(&scan.lock);
+        scan.next_output = i + 1;
+        pthread_cond_broadcast(&scan.chunk_freed);
+        pthread_mutex_unlock(&scan.lock);
+    }
+
+    thread_pool_wait(pool);
+    pthread_mutex_unlock(&table->scan_pool_lock);
+    pthread_mutex_destroy(&scan.lock);
+    pthread_cond_destroy(&scan.chunk_done);
+    pthread_cond_destroy(&scan.chunk_freed);
+    free(chunks);
+    return true;
+}
+
+/*
+ * 聚合查询：count(*)、min/max/sum(id)、按 username 分组计数
+ * 流式扫描叶子，只读需要的列字节，不反序列化整行；
+ * 没有 where 条件时 count 直接用行数，min/max 只读最左/最右的叶子；
+ * 快照之后有新的提交时元数据里混着快照看不到的行，照常扫描
+ */
+
+typedef struct {
+    char username[COLUMN_USERNAME_SIZE + 1];
+    uint64_t count;
+    bool in_use;
+} UsernameGroup;
+
+typedef struct {
+    uint64_t count;
+    uint64_t sum;
+    uint32_t min;
+    uint32_t max;
+    UsernameGroup *groups;      //开放寻址哈希表
+    uint32_t num_groups;
+    uint32_t groups_capacity;
+} AggregateState;
+
+static void username_group_add(AggregateState *state, const char *field, uint32_t length) {
+    if ((state->num_groups + 1) * 2 > state->groups_capacity) {
+        //负载超过一半就扩容重建
+        UsernameGroup *old_groups = state->groups;
+        uint32_t old_capacity = state->groups_capacity;
+        state->groups_capacity = old_capacity ? old_capacity * 2 : 64;
+        state->groups = calloc(state->groups_capacity, sizeof(UsernameGroup));
+        for (uint32_t i = 0; i < old_capacity; i++) {
+            if (!old_groups[i].in_use) {
+                continue;
+            }
+            uint32_t slot = text_hash(old_groups[i].username, strlen(old_groups[i].username))
+                            & (state->groups_capacity - 1);
+            while (state->groups[slot].in_use) {
+                slot = (slot + 1) & (state->groups_capacity - 1);
+            }
+            state->groups[slot] = old_groups[i];
+        }
+        free(old_groups);
+    }
+
+    uint32_t slot = text_hash(field, length) & (state->groups_capacity - 1);
+    while (state->groups[slot].in_use) {
+        UsernameGroup *group = &state->groups[slot];
+        if (strncmp(group->username, field, length) == 0 && group->username[length] == 0) {
+            group->count++;
+            return;
+        }
+        slot = (slot + 1) & (state->groups_capacity - 1);
+    }
+    memcpy(state->groups[slot].username, field, length);
+    state->groups[slot].username[length] = 0;
+    state->groups[slot].count = 1;
+    state->groups[slot].in_use = true;
+    state->num_groups++;
+}
+
+static void aggregate_leaf(void *node, uint32_t first_cell, uint8_t *match,
+                           uint32_t num_matched, void *context) {
+    AggregateState *state = context;
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    const uint32_t *keys = leaf_node_key(node, 0);
+    state->count += num_matched;
+    for (uint32_t i = first_cell; i < num_cells; i++) {
+        if (!match[i - first_cell]) {
+            continue;
+        }
+        if (state->groups_capacity > 0) {
+            uint32_t length;
+            const char *username = record_username(leaf_node_value(node, i), &length);
+            username_group_add(state, username, length);
+            continue;
+        }
+        uint32_t id = keys[i];
+        state->sum += id;
+        state->min = id < state->min ? id : state->min;
+        state->max = id > state->max ? id : state->max;
+    }
+}
+
+//最右叶子的最后一个 key
+static bool btree_max_key(Table *table, uint32_t *key) {
+    Pager *pager = table->pager;
+    uint32_t page_num = table->root_page_num;
+    void *node = get_page_ro(pager, page_num);
+    while (get_node_type(node) == NODE_INTERNAL) {
+        uint32_t child_page_num = *internal_node_right_child(node);
+        void *child = get_page_ro(pager, child_page_num);
+        pager_unpin_ro(pager, page_num, node);
+        page_num = child_page_num;
+        node = child;
+    }
+    //最右的叶子刚分裂、根还没更新时，右边还有叶子
+    while (*leaf_node_next_leaf(node) != 0) {
+        uint32_t next_page_num = *leaf_node_next_leaf(node);
+        void *next = get_page_ro(pager, next_page_num);
+        pager_unpin_ro(pager, page_num, node);
+        page_num = next_page_num;
+        node = next;
+    }
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    if (num_cells > 0) {
+        *key = *leaf_node_key(node, num_cells - 1);
+    }
+    pager_unpin_ro(pager, page_num, node);
+    return num_cells > 0;
+}
+
+static int compare_username_groups(const void *a, const void *b) {
+    return strcmp(((UsernameGroup *) a)->username, ((UsernameGroup *) b)->username);
+}
+
+static void print_aggregate_value(AggregateState *state, Aggregate aggregate) {
+    switch (aggregate) {
+        case (AGGREGATE_COUNT):
+            printf("%llu", (unsigned long long) state->count);
+            break;
+        case (AGGREGATE_SUM):
+            printf("%llu", (unsigned long long) state->sum);
+            break;
+        case (AGGREGATE_MIN):
+        case (AGGREGATE_MAX):
+            if (state->count == 0) {
+                printf("NULL");
+            } else {
+                printf("%u", aggregate == AGGREGATE_MIN ? state->min : state->max);
+            }
+            break;
+        case (AGGREGATE_USERNAME):
+            break;
+    }
+}
+
+static ExecuteResult execute_aggregate(Statement *statement, Table *table) {
+    AggregateState state;
+    memset(&state, 0, sizeof(state));
+    state.min = UINT32_MAX;
+
+    bool unfiltered = statement->id_min == 0 && statement->id_max == UINT32_MAX &&
+                      statement->num_id_excluded == 0 && statement->num_predicates == 0;
+    bool needs_scan = statement->group_by_username;
+    for (uint32_t i = 0; i < statement->num_aggregates; i++) {
+        if (statement->aggregates[i] == AGGREGATE_SUM) {
+            needs_scan = true;
+        }
+    }
+
+    if (statement->group_by_username) {
+        state.groups_capacity = 64;
+        state.groups = calloc(state.groups_capacity, sizeof(UsernameGroup));
+    }
+
+    Snapshot snapshot;
+    snapshot_begin(&table->versions, &snapshot);
+    bool answered = statement->empty_range;
+    //最左/最右的行可能是已删除的行，这时也要扫描
+    if (!answered && unfiltered && !needs_scan && snapshot_sees_all(&snapshot) &&
+        atomic_load(&table->num_tombstones) == 0) {
+        //从元数据直接回答，不扫描
+        state.count = atomic_load(&table->num_rows);
+        bool metadata_ok = true;
+        if (state.count > 0) {
+            Cursor *cursor = table_start(table);
+            state.min = cursor_key(cursor);
+            cursor_close(cursor);
+            //删空的叶子等 .vacuum 回收，最右的叶子可能是空的
+            metadata_ok = btree_max_key(table, &state.max);
+        }
+        //读元数据期间有写者登记了新版本，读到的可能包含快照之后的修改，改为扫描
+        answered = metadata_ok && snapshot_sees_all(&snapshot);
+        if (!answered) {
+            state.count = 0;
+            state.min = UINT32_MAX;
+            state.max = 0;
+        }
+    }
+    if (!answered) {
+        table_scan_leaves(table, statement, &snapshot, statement->id_min, statement->id_max,
+                          aggregate_leaf, &state, NULL);
+    }
+    snapshot_end(&snapshot);
+
+    if (!statement->group_by_username) {
+        printf("(");
+        for (uint32_t i = 0; i < statement->num_aggregates; i++) {
+            if (i > 0) {
+                printf(", ");
+            }
+            print_aggregate_value(&state, statement->aggregates[i]);
+        }
+        printf(")\n");
+        return EXECUTE_SUCCESS;
+    }
+
+    //分组按 username 排序输出
+    uint32_t num_groups = 0;
+    for (uint32_t i = 0; i < state.groups_capacity; i++) {
+        if (state.groups[i].in_use) {
+            state.groups[num_groups++] = state.groups[i];
+        }
+    }
+    qsort(state.groups, num_groups, sizeof(UsernameGroup), compare_username_groups);
+    for (uint32_t g = 0; g < num_groups; g++) {
+        printf("(");
+        for (uint32_t i = 0; i < statement->num_aggregates; i++) {
+            if (i > 0) {
+                printf(", ");
+            }
+            if (statement->aggregates[i] == AGGREGATE_USERNAME) {
+                printf("%s", state.groups[g].username);
+            } else {
+                printf("%llu", (unsigned long long) state.groups[g].count);
+            }
+        }
+        printf(")\n");
+    }
+    free(state.groups);
+    return EXECUTE_SUCCESS;
+}
+
+//执行select，按 id 有序输出满足 where 条件的行
+ExecuteResult execute_select(Statement *statement, Table *table) {
+    if (statement->empty_range) {
+        return EXECUTE_SUCCESS;
+    }
+
+    bool full_scan = statement->id_min == 0 && statement->id_max == UINT32_MAX;
+    if (full_scan) {
+        pager_advise_sequential(table->pager, true);
+    }
+
+    Snapshot snapshot;
+    snapshot_begin(&table->versions, &snapshot);
+    ResultSink sink;
+    sink_open(&sink, table->output_mode, STDOUT_FILENO);
+    if (!parallel_select(table, statement, &snapshot, &sink)) {
+        ScanYield yield = {sink_flush_due, sink_flush_yield, &sink};
+        table_scan(table, statement, &snapshot, statement->id_min, statement->id_max,
+                   sink_row_callback, &sink, &yield);
+    }
+    snapshot_end(&snapshot);
+    sink_close(&sink);
+
+    if (full_scan) {
+        pager_advise_sequential(table->pager, false);
+    }
+    return EXECUTE_SUCCESS;
+}
+
+/*
+ * delete / update
+ * 持有写者锁先按 where 条件扫出要改的 id，再逐个从根定位修改，扫描的叶子和要改的叶子不会同时钉住；
+ * 收集期间没有别的写者，扫到的就是当前的表，update 改到的列也不会影响还没改的行是否匹配。
+ * 日志每 MODIFY_LOG_BATCH 行追加一次，和这次写操作在同一个提交组里。
+ */
+
+typedef struct {
+    uint32_t *ids;
+    uint32_t count;
+    uint32_t capacity;
+} IdList;
+
+static void collect_matched_ids(void *node, uint32_t first_cell, uint8_t *match,
+                                uint32_t num_matched, void *context) {
+    IdList *list = context;
+    if (list->count + num_matched > list->capacity) {
+        while (list->count + num_matched > list->capacity) {
+            list->capacity = list->capacity ? list->capacity * 2 : LEAF_NODE_MAX_CELLS;
+        }
+        list->ids = realloc(list->ids, sizeof(uint32_t) * list->capacity);
+    }
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    for (uint32_t i = first_cell; i < num_cells; i++) {
+        if (match[i - first_cell]) {
+            list->ids[list->count++] = *leaf_node_key(node, i);
+        }
+    }
+}
+
+//满足 where 条件的 id，按 id 有序，调用时持有写者锁
+static void table_collect_ids(Table *table, Statement *statement, IdList *list) {
+    list->ids = NULL;
+    list->count = 0;
+    list->capacity = 0;
+    if (statement->empty_range) {
+        return;
+    }
+    Snapshot snapshot;
+    snapshot_begin(&table->versions, &snapshot);
+    table_scan_leaves(table, statement, &snapshot, statement->id_min, statement->id_max,
+                      collect_matched_ids, list, NULL);
+    snapshot_end(&snapshot);
+}
+
+//执行delete，删除满足 where 条件的行
+ExecuteResult execute_delete(Statement *statement, Table *table) {
+    table_begin_write(table);
+    IdList list;
+    table_collect_ids(table, statement, &list);
+
+    Row *batch = malloc(sizeof(Row) * MODIFY_LOG_BATCH);
+    uint32_t num_batched = 0;
+    for (uint32_t i = 0; i < list.count; i++) {
+        if (!table_delete(table, list.ids[i])) {
+            continue;
+        }
+        batch[num_batched++].id = list.ids[i];
+        if (num_batched == MODIFY_LOG_BATCH) {
+            wal_append_rows(table->wal, WAL_RECORD_DELETE, batch, num_batched);
+            num_batched = 0;
+        }
+    }
+    uint64_t lsn = wal_append_rows(table->wal, WAL_RECORD_DELETE, batch, num_batched);
+    table_end_write(table);
+    wal_wait_durable(table->wal, lsn);
+    free(batch);
+    free(list.ids);
+    return EXECUTE_SUCCESS;
+}
+
+//执行update，把满足 where 条件的行的 set 列改成新值，日志里记整行
+ExecuteResult execute_update(Statement *statement, Table *table) {
+    table_begin_write(table);
+    IdList list;
+    table_collect_ids(table, statement, &list);
+
+    Row *batch = malloc(sizeof(Row) * MODIFY_LOG_BATCH);
+    uint32_t num_batched = 0;
+    for (uint32_t i = 0; i < list.count; i++) {
+        Row *row = &batch[num_batched];
+        Cursor *cursor = table_find(table, list.ids[i]);
+        bool deleted;
+        bool found = cursor_at_key(cursor, list.ids[i], &deleted) && !deleted;
+        if (found) {
+            leaf_node_read_row(cursor->node, cursor->cell_num, row);
+            if (statement->set_username) {
+                strcpy(row->username, statement->row_to_insert.username);
+            }
+            if (statement->set_email) {
+                strcpy(row->email, statement->row_to_insert.email);
+            }
+            cursor_replace_row(cursor, row);
+        }
+        cursor_close(cursor);
+        if (found && ++num_batched == MODIFY_LOG_BATCH) {
+            wal_append_rows(table->wal, WAL_RECORD_UPDATE, batch, num_batched);
+            num_batched = 0;
+        }
+    }
+    uint64_t lsn = wal_append_rows(table->wal, WAL_RECORD_UPDATE, batch, num_batched);
+    table_end_write(table);
+    wal_wait_durable(table->wal, lsn);
+    free(batch);
+    free(list.ids);
+    return EXECUTE_SUCCESS;
+}
+
+/*
+ * vacuum
+ * 按 key 顺序逐个处理最底层的父节点，每个父节点一次写操作：
+ * 先清掉叶子里所有快照都看不到的已删除行，再把能放进一页的相邻叶子合并，空出来的叶子放进空闲页链表。
+ * 页闩按父节点、左叶子、右叶子的顺序独占，和读者从根向下、沿叶子链表向右的顺序一致；
+ * 合并时父节点和两个叶子都被独占，读者要么还没到，要么已经离开，不会走到释放掉的页
+ */
+
+//把 right 的 cell 全部搬进 left，父节点里删掉两者之间的分隔 key，right 由调用者释放
+static void vacuum_merge_leaves(void *parent, uint32_t index, uint32_t left_page_num,
+                                void *left, void *right) {
+    uint32_t num_cells = *leaf_node_num_cells(right);
+    for (uint32_t i = 0; i < num_cells; i++) {
+        leaf_node_append_cell(left, right, i);
+    }
+    *leaf_node_next_leaf(left) = *leaf_node_next_leaf(right);
+
+    //右叶子的位置改指左叶子，它的 key 就是合并后的上界；再删掉左叶子原来的 cell
+    uint32_t num_keys = *internal_node_num_keys(parent);
+    *internal_node_child(parent, index + 1) = left_page_num;
+    memmove(internal_node_cell(parent, index), internal_node_cell(parent, index + 1),
+            (num_keys - index - 1) * INTERNAL_NODE_CELL_SIZE);
+    *internal_node_num_keys(parent) = num_keys - 1;
+}
+
+//整理 key 所在的最底层父节点，返回释放的页数；upper 返回这个父节点负责的 key 上界，
+//has_upper 为 false 表示它是最右边的父节点。调用时持有写者锁
+static uint32_t vacuum_step(Table *table, uint32_t key, uint32_t *upper, bool *has_upper) {
+    Pager *pager = table->pager;
+    uint32_t page_num = table->root_page_num;
+    void *node = get_page(pager, page_num);
+    *has_upper = false;
+    if (get_node_type(node) == NODE_LEAF) {
+        leaf_node_purge(table, node);
+        pager_mark_dirty(pager, page_num);
+        pager_unpin(pager, page_num);
+        return 0;
+    }
+    while (true) {
+        uint32_t child_index = internal_node_find_child(node, key);
+        uint32_t child_page_num = *internal_node_child(node, child_index);
+        void *child = get_page(pager, child_page_num);
+        if (get_node_type(child) == NODE_LEAF) {
+            pager_unpin(pager, child_page_num);
+            break;
+        }
+        if (child_index < *internal_node_num_keys(node)) {
+            *upper = *internal_node_key(node, child_index);
+            *has_upper = true;
+        }
+        pager_unpin(pager, page_num);
+        page_num = child_page_num;
+        node = child;
+    }
+
+    uint32_t limit = LEAF_NODE_SPACE_FOR_CELLS * VACUUM_FILL_PERCENT / 100;
+    uint32_t num_freed = 0;
+    uint32_t index = 0;
+    uint32_t left_page_num = *internal_node_child(node, 0);
+    void *left = get_page(pager, left_page_num);
+    leaf_node_purge(table, left);
+    pager_mark_dirty(pager, left_page_num);
+    while (index < *internal_node_num_keys(node)) {
+        uint32_t right_page_num = *internal_node_child(node, index + 1);
+        void *right = get_page(pager, right_page_num);
+        leaf_node_purge(table, right);
+        pager_mark_dirty(pager, right_page_num);
+        //非根的父节点至少留一个 key
+        bool can_merge = *internal_node_num_keys(node) > 1 || is_node_root(node);
+        if (can_merge && leaf_node_used_space(left) + leaf_node_used_space(right) <= limit) {
+            vacuum_merge_leaves(node, index, left_page_num, left, right);
+            pager_unpin(pager, right_page_num);
+            pager_free_page(pager, right_page_num);
+            num_freed++;
+            continue;
+        }
+        pager_unpin(pager, left_page_num);
+        left_page_num = right_page_num;
+        left = right;
+        index++;
+    }
+
+    if (*internal_node_num_keys(node) == 0) {
+        //根下面只剩一个叶子，叶子搬回根页，树降一层
+        memcpy(node, left, PAGE_SIZE);
+        set_node_root(node, true);
+        pager_unpin(pager, left_page_num);
+        pager_free_page(pager, left_page_num);
+        num_freed++;
+    } else {
+        pager_unpin(pager, left_page_num);
+    }
+    pager_mark_dirty(pager, page_num);
+    pager_unpin(pager, page_num);
+    return num_freed;
+}
+
+//索引项还可能有快照要用：版本表里有这一行，或者叶子里这一行还在、没删、这一列的哈希没变
+static bool hash_entry_live(Table *table, Column column, const HashEntry *entry) {
+    pthread_rwlock_rdlock(&table->versions.lock);
+    bool versioned = version_find(&table->versions, entry->id) != NULL;
+    pthread_rwlock_unlock(&table->versions.lock);
+    if (versioned) {
+        return true;
+    }
+    bool live = false;
+    Cursor *cursor = table_seek(table, entry->id);
+    if (!cursor->end_of_table && cursor_key(cursor) == entry->id &&
+        !leaf_node_is_deleted(cursor->node, cursor->cell_num)) {
+        Row row;
+        leaf_node_read_row(cursor->node, cursor->cell_num, &row);
+        live = row_column_hash(&row, column) == entry->hash;
+    }
+    cursor_close(cursor);
+    return live;
+}
+
+//清理一个桶：先读出所有项，放掉索引页逐个回表核对，再把留下的项写回，返回释放的溢出页数
+//调用时持有写者锁，核对期间桶不会变；桶号超出桶数时 *done 置 true
+static uint32_t vacuum_index_bucket(Table *table, uint32_t meta_page_num, uint32_t bucket, bool *done) {
+    Pager *pager = table->pager;
+    void *meta = get_page(pager, meta_page_num);
+    if (bucket >= hash_meta_num_buckets(meta)) {
+        pager_unpin(pager, meta_page_num);
+        *done = true;
+        return 0;
+    }
+    Column column = *hash_meta_column(meta);
+    uint32_t page_num = hash_bucket_page(meta, bucket);
+    HashEntry *entries;
+    uint32_t count = hash_bucket_collect(pager, page_num, &entries);
+    pager_unpin(pager, meta_page_num);
+
+    uint32_t num_kept = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (hash_entry_live(table, column, &entries[i])) {
+            entries[num_kept++] = entries[i];
+        }
+    }
+    uint32_t num_freed = 0;
+    if (num_kept < count) {
+        meta = get_page(pager, meta_page_num);
+        num_freed = hash_bucket_rewrite(pager, page_num, entries, num_kept);
+        *hash_meta_num_entries(meta) -= count - num_kept;
+        pager_mark_dirty(pager, meta_page_num);
+        pager_unpin(pager, meta_page_num);
+    }
+    free(entries);
+    return num_freed;
+}
+
+uint32_t db_vacuum(Table *table) {
+    uint32_t num_freed = 0;
+    uint32_t key = 0;
+    while (true) {
+        uint32_t upper = 0;
+        bool has_upper;
+        table_begin_write(table);
+        num_freed += vacuum_step(table, key, &upper, &has_upper);
+        table_end_write(table);
+        if (!has_upper || upper == UINT32_MAX) {
+            break;
+        }
+        key = upper + 1;
+    }
+
+    for (uint32_t i = 0; i < NUM_INDEX_COLUMNS; i++) {
+        uint32_t meta_page_num = atomic_load(&table->index_pages[i]);
+        bool done = meta_page_num == 0;
+        for (uint32_t bucket = 0; !done; bucket++) {
+            table_begin_write(table);
+            num_freed += vacuum_index_bucket(table, meta_page_num, bucket, &done);
+            table_end_write(table);
+        }
+    }
+    return num_freed;
+}
+
+//执行 create index：建空索引并登记现有的行，索引目录在文件头里，随这次检查点落盘
+//提交之前开始的快照都早于 index_ts，不会用到还没建完的索引
+ExecuteResult execute_create_index(Statement *statement, Table *table) {
+    uint32_t slot = statement->index_column - COLUMN_USERNAME;
+    table_begin_write(table);
+    if (atomic_load(&table->index_pages[slot]) != 0) {
+        table_end_write(table);
+        return EXECUTE_INDEX_EXISTS;
+    }
+    uint32_t meta_page_num = hash_index_create(table->pager, statement->index_column);
+    atomic_store(&table->index_ts[slot], table->write_ts);
+    atomic_store(&table->index_pages[slot], meta_page_num);
+    table_index_existing(table, slot);
+    table_checkpoint(table);
+    table_end_write(table);
+    return EXECUTE_SUCCESS;
+}
+
+static ExecuteResult execute_statement_type(Statement *statement, Table *table) {
+    switch (statement->type) {
+        case (STATEMENT_INSERT):
+            return execute_insert(statement, table);
+        case (STATEMENT_SELECT):
+            if (statement->num_aggregates > 0) {
+                return execute_aggregate(statement, table);
+            }
+            return execute_select(statement, table);
+        case (STATEMENT_DELETE):
+            return execute_delete(statement, table);
+        case (STATEMENT_UPDATE):
+            return execute_update(statement, table);
+        case (STATEMENT_CREATE_INDEX):
+            return execute_create_index(statement, table);
+    }
+    printf("Unknown statement type %d.\n", statement->type);
+    exit(EXIT_FAILURE);
+}
+
+//按语句类型记下执行耗时，select 包括输出结果
+static ExecuteResult execute_statement(Statement *statement, Table *table) {
+    uint64_t start = now_ns();
+    ExecuteResult result = execute_statement_type(statement, table);
+    latency_record(&table->statement_latency[statement->type], now_ns() - start);
+    return result;
+}
+
+
+/*
+ * 语句解析
+ * 词法分析一遍扫过语句文本，递归下降直接生成 PreparedStatement，不修改输入、不用 strtok。
+ * 值可以是空白分隔的裸词、'单引号串'（'' 表示一个引号）或 ? 参数；关键字不区分大小写。
+ * id 比较先记成 IdCondition，执行前再合并成区间，这样参数可以每次绑定不同的值。
+ */
+
+typedef enum {
+    TOKEN_END,
+    TOKEN_WORD,
+    TOKEN_STRING,
+    TOKEN_PARAM,
+    TOKEN_COMMA,
+    TOKEN_LEFT_PAREN,
+    TOKEN_RIGHT_PAREN,
+    TOKEN_STAR,
+    TOKEN_OPERATOR,
+    TOKEN_INVALID
+} TokenType;
+
+typedef struct {
+    TokenType type;
+    const char *start;
+    uint32_t length;
+} Token;
+
+typedef struct {
+    const char *next;
+    Token token;        //当前词
+} Tokenizer;
+
+static bool is_word_char(char c) {
+    return c != 0 && !isspace((unsigned char) c) && strchr(",()*?='<>!", c) == NULL;
+}
+
+static void tokenizer_advance(Tokenizer *tokenizer) {
+    const char *p = tokenizer->next;
+    while (isspace((unsigned char) *p)) {
+        p++;
+    }
+    Token *token = &tokenizer->token;
+    token->start = p;
+    token->length = 1;
+    switch (*p) {
+        case 0:
+            token->type = TOKEN_END;
+            token->length = 0;
+            break;
+        case ',':
+            token->type = TOKEN_COMMA;
+            break;
+        case '(':
+            token->type = TOKEN_LEFT_PAREN;
+            break;
+        case ')':
+            token->type = TOKEN_RIGHT_PAREN;
+            break;
+        case '*':
+            token->type = TOKEN_STAR;
+            break;
+        case '?':
+            token->type = TOKEN_PARAM;
+            break;
+        case '=':
+            token->type = TOKEN_OPERATOR;
+            break;
+        case '<':
+        case '>':
+            token->type = TOKEN_OPERATOR;
+            token->length = p[1] == '=' ? 2 : 1;
+            break;
+        case '!':
+            token->type = p[1] == '=' ? TOKEN_OPERATOR : TOKEN_INVALID;
+            token->length = p[1] == '=' ? 2 : 1;
+            break;
+        case '\'': {
+            const char *q = p + 1;
+            while (*q != 0 && !(*q == '\'' && q[1] != '\'')) {
+                q += *q == '\'' ? 2 : 1;
+            }
+            token->type = *q == '\'' ? TOKEN_STRING : TOKEN_INVALID;
+            token->length = (*q == '\'' ? q + 1 : q) - p;
+            break;
+        }
+        default: {
+            const char *q = p;
+            while (is_word_char(*q)) {
+                q++;
+            }
+            token->type = TOKEN_WORD;
+            token->length = q - p;
+            break;
+        }
+    }
+    tokenizer->next = p + token->length;
+}
+
+//值的位置按空白切分，和原来的语法一致，bob,jr 这样的值不用加引号；单独的 ? 是参数
+static void tokenizer_rescan_value(Tokenizer *tokenizer) {
+    Token *token = &tokenizer->token;
+    if (token->type == TOKEN_END || token->type == TOKEN_STRING) {
+        return;
+    }
+    const char *q = token->start;
+    while (*q != 0 && !isspace((unsigned char) *q)) {
+        q++;
+    }
+    token->length = q - token->start;
+    token->type = token->length == 1 && token->start[0] == '?' ? TOKEN_PARAM : TOKEN_WORD;
+    tokenizer->next = q;
+}
+
+static bool token_is(Token *token, const char *keyword) {
+    return token->type == TOKEN_WORD && strlen(keyword) == token->length &&
+           strncasecmp(token->start, keyword, token->length) == 0;
+}
+
+static bool token_is_operator(Token *token, const char *op) {
+    return token->type == TOKEN_OPERATOR && strlen(op) == token->length &&
+           strncmp(token->start, op, token->length) == 0;
+}
+
+static bool tokenizer_accept(Tokenizer *tokenizer, const char *keyword) {
+    if (!token_is(&tokenizer->token, keyword)) {
+        return false;
+    }
+    tokenizer_advance(tokenizer);
+    return true;
+}
+
+static bool tokenizer_accept_type(Tokenizer *tokenizer, TokenType type) {
+    if (tokenizer->token.type != type) {
+        return false;
+    }
+    tokenizer_advance(tokenizer);
+    return true;
+}
+
+//非负 id，负数单独报错
+static PrepareResult parse_id_text(const char *text, uint32_t length, uint32_t *id) {
+    if (length > 0 && text[0] == '-') {
+        return PREPARE_NEGATIVE_ID;
+    }
+    if (length == 0 || length > 10) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    uint64_t value = 0;
+    for (uint32_t i = 0; i < length; i++) {
+        if (!isdigit((unsigned char) text[i])) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        value = value * 10 + (text[i] - '0');
+    }
+    if (value > UINT32_MAX) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    *id = value;
+    return PREPARE_SUCCESS;
+}
+
+static PrepareResult check_id_value(int64_t value, uint32_t *id) {
+    if (value < 0) {
+        return PREPARE_NEGATIVE_ID;
+    }
+    if (value > UINT32_MAX) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    *id = value;
+    return PREPARE_SUCCESS;
+}
+
+//把值词拷到 out 并补 '\0'，引号串去掉引号和转义；超过 max_length 返回 false
+static bool token_copy_value(Token *token, char *out, uint32_t max_length, uint32_t *length) {
+    if (token->type == TOKEN_WORD) {
+        if (token->length > max_length) {
+            return false;
+        }
+        memcpy(out, token->start, token->length);
+        out[token->length] = 0;
+        *length = token->length;
+        return true;
+    }
+    uint32_t n = 0;
+    for (const char *p = token->start + 1; p < token->start + token->length - 1; p++) {
+        if (n == max_length) {
+            return false;
+        }
+        out[n++] = *p;
+        if (*p == '\'') {
+            p++;
+        }
+    }
+    out[n] = 0;
+    *length = n;
+    return true;
+}
+
+static bool token_is_value(Token *token) {
+    return token->type == TOKEN_WORD || token->type == TOKEN_STRING || token->type == TOKEN_PARAM;
+}
+
+static PrepareResult add_param(PreparedStatement *prepared, ParamTarget target, uint32_t index) {
+    if (prepared->num_params == MAX_PARAMS) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    Param *param = &prepared->params[prepared->num_params++];
+    param->target = target;
+    param->index = index;
+    param->bound = false;
+    return PREPARE_SUCCESS;
+}
+
+//insert 和 update set 的 username/email，长度按各自的列宽检查
+static PrepareResult set_insert_text(Row *row, ParamTarget target, const char *value, uint32_t length) {
+    char *field = target == PARAM_INSERT_USERNAME ? row->username : row->email;
+    uint32_t max_length = target == PARAM_INSERT_USERNAME ? COLUMN_USERNAME_SIZE : COLUMN_EMAIL_SIZE;
+    if (length > max_length) {
+        return PREPARE_STRING_TOO_LONG;
+    }
+    memcpy(field, value, length);
+    field[length] = 0;
+    return PREPARE_SUCCESS;
+}
+
+//username/email 条件的值，like 的值必须以 % 结尾
+static PrepareResult set_predicate_text(Predicate *predicate, const char *value, uint32_t length) {
+    if (predicate->op == PREDICATE_PREFIX) {
+        if (length == 0 || value[length - 1] != '%') {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        length -= 1;
+    }
+    uint32_t max_length = predicate->column == COLUMN_USERNAME ? COLUMN_USERNAME_SIZE : COLUMN_EMAIL_SIZE;
+    if (length > max_length) {
+        return PREPARE_STRING_TOO_LONG;
+    }
+    memcpy(predicate->text, value, length);
+    predicate->text[length] = 0;
+    predicate->length = length;
+    return PREPARE_SUCCESS;
+}
+
+//insert <id> <username> <email>
+static PrepareResult parse_insert(Tokenizer *tokenizer, PreparedStatement *prepared) {
+    Statement *statement = &prepared->statement;
+    Row *row = &statement->row_to_insert;
+    statement->type = STATEMENT_INSERT;
+    memset(row, 0, sizeof(Row));
+
+    const ParamTarget targets[] = {PARAM_INSERT_ID, PARAM_INSERT_USERNAME, PARAM_INSERT_EMAIL};
+    for (uint32_t i = 0; i < 3; i++) {
+        tokenizer_rescan_value(tokenizer);
+        Token *token = &tokenizer->token;
+        if (!token_is_value(token)) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        PrepareResult result = PREPARE_SUCCESS;
+        if (token->type == TOKEN_PARAM) {
+            result = add_param(prepared, targets[i], 0);
+        } else if (targets[i] == PARAM_INSERT_ID) {
+            result = token->type == TOKEN_WORD
+                     ? parse_id_text(token->start, token->length, &row->id)
+                     : PREPARE_SYNTAX_ERROR;
+        } else {
+            char value[COLUMN_EMAIL_SIZE + 1];
+            uint32_t length;
+            if (!token_copy_value(token, value, COLUMN_EMAIL_SIZE, &length)) {
+                return PREPARE_STRING_TOO_LONG;
+            }
+            result = set_insert_text(row, targets[i], value, length);
+        }
+        if (result != PREPARE_SUCCESS) {
+            return result;
+        }
+        tokenizer_advance(tokenizer);
+    }
+    return tokenizer->token.type == TOKEN_END ? PREPARE_SUCCESS : PREPARE_SYNTAX_ERROR;
+}
+
+//投影项：count(*)、min/max/sum(id)、username
+static PrepareResult parse_projection(Tokenizer *tokenizer, Statement *statement) {
+    if (statement->num_aggregates == MAX_AGGREGATES) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    Aggregate aggregate;
+    if (tokenizer_accept(tokenizer, "username")) {
+        statement->aggregates[statement->num_aggregates++] = AGGREGATE_USERNAME;
+        return PREPARE_SUCCESS;
+    } else if (tokenizer_accept(tokenizer, "count")) {
+        aggregate = AGGREGATE_COUNT;
+    } else if (tokenizer_accept(tokenizer, "min")) {
+        aggregate = AGGREGATE_MIN;
+    } else if (tokenizer_accept(tokenizer, "max")) {
+        aggregate = AGGREGATE_MAX;
+    } else if (tokenizer_accept(tokenizer, "sum")) {
+        aggregate = AGGREGATE_SUM;
+    } else {
+        return PREPARE_SYNTAX_ERROR;
+    }
+
+    if (!tokenizer_accept_type(tokenizer, TOKEN_LEFT_PAREN)) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    bool argument_ok = aggregate == AGGREGATE_COUNT
+                       ? tokenizer_accept_type(tokenizer, TOKEN_STAR)
+                       : tokenizer_accept(tokenizer, "id");
+    if (!argument_ok || !tokenizer_accept_type(tokenizer, TOKEN_RIGHT_PAREN)) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    statement->aggregates[statement->num_aggregates++] = aggregate;
+    return PREPARE_SUCCESS;
+}
+
+static PrepareResult add_id_condition(Tokenizer *tokenizer, PreparedStatement *prepared, IdOp op) {
+    tokenizer_rescan_value(tokenizer);
+    Token *token = &tokenizer->token;
+    if (prepared->num_id_conditions == MAX_ID_CONDITIONS || !token_is_value(token)) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    IdCondition *condition = &prepared->id_conditions[prepared->num_id_conditions];
+    condition->op = op;
+    condition->value = 0;
+    PrepareResult result;
+    if (token->type == TOKEN_PARAM) {
+        result = add_param(prepared, PARAM_ID_CONDITION, prepared->num_id_conditions);
+    } else if (token->type == TOKEN_WORD) {
+        result = parse_id_text(token->start, token->length, &condition->value);
+    } else {
+        result = PREPARE_SYNTAX_ERROR;
+    }
+    if (result == PREPARE_SUCCESS) {
+        prepared->num_id_conditions++;
+        tokenizer_advance(tokenizer);
+    }
+    return result;
+}
+
+//id =|!=|<|<=|>|>= N, id between A and B
+static PrepareResult parse_id_condition(Tokenizer *tokenizer, PreparedStatement *prepared) {
+    static const struct {
+        const char *text;
+        IdOp op;
+    } operators[] = {
+            {"=",  ID_EQUALS},
+            {"!=", ID_NOT_EQUALS},
+            {"<",  ID_LESS},
+            {"<=", ID_LESS_EQUAL},
+            {">",  ID_GREATER},
+            {">=", ID_GREATER_EQUAL}
+    };
+
+    if (tokenizer_accept(tokenizer, "between")) {
+        PrepareResult result = add_id_condition(tokenizer, prepared, ID_GREATER_EQUAL);
+        if (result != PREPARE_SUCCESS) {
+            return result;
+        }
+        if (!tokenizer_accept(tokenizer, "and")) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        return add_id_condition(tokenizer, prepared, ID_LESS_EQUAL);
+    }
+    for (uint32_t i = 0; i < sizeof(operators) / sizeof(operators[0]); i++) {
+        if (token_is_operator(&tokenizer->token, operators[i].text)) {
+            tokenizer_advance(tokenizer);
+            return add_id_condition(tokenizer, prepared, operators[i].op);
+        }
+    }
+    return PREPARE_SYNTAX_ERROR;
+}
+
+//username|email = value, username|email like prefix%
+static PrepareResult parse_text_condition(Tokenizer *tokenizer, PreparedStatement *prepared, Column column) {
+    Statement *statement = &prepared->statement;
+    if (statement->num_predicates == MAX_PREDICATES) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    Predicate *predicate = &statement->predicates[statement->num_predicates];
+    predicate->column = column;
+    if (token_is_operator(&tokenizer->token, "=")) {
+        predicate->op = PREDICATE_EQUALS;
+    } else if (token_is(&tokenizer->token, "like")) {
+        predicate->op = PREDICATE_PREFIX;
+    } else {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    tokenizer_advance(tokenizer);
+
+    tokenizer_rescan_value(tokenizer);
+    Token *token = &tokenizer->token;
+    PrepareResult result;
+    predicate->length = 0;
+    predicate->text[0] = 0;
+    if (token->type == TOKEN_PARAM) {
+        result = add_param(prepared, PARAM_PREDICATE, statement->num_predicates);
+    } else if (token->type == TOKEN_WORD || token->type == TOKEN_STRING) {
+        //like 的值多一个 %
+        char value[COLUMN_EMAIL_SIZE + 2];
+        uint32_t length;
+        result = token_copy_value(token, value, COLUMN_EMAIL_SIZE + 1, &length)
+                 ? set_predicate_text(predicate, value, length)
+                 : PREPARE_STRING_TOO_LONG;
+    } else {
+        result = PREPARE_SYNTAX_ERROR;
+    }
+    if (result == PREPARE_SUCCESS) {
+        statement->num_predicates++;
+        tokenizer_advance(tokenizer);
+    }
+    return result;
+}
+
+//[where <条件> [and <条件>]...]
+//条件: id =|!=|<|<=|>|>= N, id between A and B,
+//      username|email = value, username|email like prefix%
+static PrepareResult parse_where(Tokenizer *tokenizer, PreparedStatement *prepared) {
+    prepared->statement.num_predicates = 0;
+    if (tokenizer_accept(tokenizer, "where")) {
+        do {
+            PrepareResult result;
+            if (tokenizer_accept(tokenizer, "id")) {
+                result = parse_id_condition(tokenizer, prepared);
+            } else if (tokenizer_accept(tokenizer, "username")) {
+                result = parse_text_condition(tokenizer, prepared, COLUMN_USERNAME);
+            } else if (tokenizer_accept(tokenizer, "email")) {
+                result = parse_text_condition(tokenizer, prepared, COLUMN_EMAIL);
+            } else {
+                result = PREPARE_SYNTAX_ERROR;
+            }
+            if (result != PREPARE_SUCCESS) {
+                return result;
+            }
+        } while (tokenizer_accept(tokenizer, "and"));
+    }
+
+    uint32_t num_excluded = 0;
+    for (uint32_t i = 0; i < prepared->num_id_conditions; i++) {
+        num_excluded += prepared->id_conditions[i].op == ID_NOT_EQUALS;
+    }
+    return num_excluded > MAX_ID_EXCLUDED ? PREPARE_SYNTAX_ERROR : PREPARE_SUCCESS;
+}
+
+//select [投影] [where ...] [group by username]
+//投影: count(*), min(id), max(id), sum(id)，分组时还可以有 username，逗号可省略
+static PrepareResult parse_select(Tokenizer *tokenizer, PreparedStatement *prepared) {
+    Statement *statement = &prepared->statement;
+    statement->type = STATEMENT_SELECT;
+    statement->num_aggregates = 0;
+    statement->group_by_username = false;
+
+    while (tokenizer->token.type != TOKEN_END &&
+           !token_is(&tokenizer->token, "where") && !token_is(&tokenizer->token, "group")) {
+        PrepareResult result = parse_projection(tokenizer, statement);
+        if (result != PREPARE_SUCCESS) {
+            return result;
+        }
+        tokenizer_accept_type(tokenizer, TOKEN_COMMA);
+    }
+
+    PrepareResult result = parse_where(tokenizer, prepared);
+    if (result != PREPARE_SUCCESS) {
+        return result;
+    }
+
+    if (tokenizer_accept(tokenizer, "group")) {
+        if (!tokenizer_accept(tokenizer, "by") || !tokenizer_accept(tokenizer, "username")) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        statement->group_by_username = true;
+    }
+
+    if (tokenizer->token.type != TOKEN_END) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+
+    //username 只能和 group by username 一起出现，分组时只支持 count(*)
+    for (uint32_t i = 0; i < statement->num_aggregates; i++) {
+        Aggregate aggregate = statement->aggregates[i];
+        if (aggregate == AGGREGATE_USERNAME && !statement->group_by_username) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        if (statement->group_by_username &&
+            aggregate != AGGREGATE_USERNAME && aggregate != AGGREGATE_COUNT) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+    }
+    if (statement->group_by_username && statement->num_aggregates == 0) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    return PREPARE_SUCCESS;
+}
+
+//delete [where ...]
+static PrepareResult parse_delete(Tokenizer *tokenizer, PreparedStatement *prepared) {
+    prepared->statement.type = STATEMENT_DELETE;
+    PrepareResult result = parse_where(tokenizer, prepared);
+    if (result != PREPARE_SUCCESS) {
+        return result;
+    }
+    return tokenizer->token.type == TOKEN_END ? PREPARE_SUCCESS : PREPARE_SYNTAX_ERROR;
+}
+
+//set 的一项：username|email = value
+static PrepareResult parse_assignment(Tokenizer *tokenizer, PreparedStatement *prepared) {
+    Statement *statement = &prepared->statement;
+    ParamTarget target;
+    if (tokenizer_accept(tokenizer, "username")) {
+        target = PARAM_INSERT_USERNAME;
+        statement->set_username = true;
+    } else if (tokenizer_accept(tokenizer, "email")) {
+        target = PARAM_INSERT_EMAIL;
+        statement->set_email = true;
+    } else {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    if (!token_is_operator(&tokenizer->token, "=")) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    tokenizer_advance(tokenizer);
+
+    tokenizer_rescan_value(tokenizer);
+    Token *token = &tokenizer->token;
+    PrepareResult result;
+    if (token->type == TOKEN_PARAM) {
+        result = add_param(prepared, target, 0);
+    } else if (token->type == TOKEN_WORD || token->type == TOKEN_STRING) {
+        char value[COLUMN_EMAIL_SIZE + 1];
+        uint32_t length;
+        result = token_copy_value(token, value, COLUMN_EMAIL_SIZE, &length)
+                 ? set_insert_text(&statement->row_to_insert, target, value, length)
+                 : PREPARE_STRING_TOO_LONG;
+    } else {
+        result = PREPARE_SYNTAX_ERROR;
+    }
+    if (result == PREPARE_SUCCESS) {
+        tokenizer_advance(tokenizer);
+    }
+    return result;
+}
+
+//update set username = value [email = value] [where ...]，逗号可省略；id 是主键，不能改
+static PrepareResult parse_update(Tokenizer *tokenizer, PreparedStatement *prepared) {
+    Statement *statement = &prepared->statement;
+    statement->type = STATEMENT_UPDATE;
+    statement->set_username = false;
+    statement->set_email = false;
+    memset(&statement->row_to_insert, 0, sizeof(Row));
+    if (!tokenizer_accept(tokenizer, "set")) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    do {
+        PrepareResult result = parse_assignment(tokenizer, prepared);
+        if (result != PREPARE_SUCCESS) {
+            return result;
+        }
+        tokenizer_accept_type(tokenizer, TOKEN_COMMA);
+    } while (tokenizer->token.type != TOKEN_END && !token_is(&tokenizer->token, "where"));
+
+    PrepareResult result = parse_where(tokenizer, prepared);
+    if (result != PREPARE_SUCCESS) {
+        return result;
+    }
+    return tokenizer->token.type == TOKEN_END ? PREPARE_SUCCESS : PREPARE_SYNTAX_ERROR;
+}
+
+//create index on username|email
+static PrepareResult parse_create_index(Tokenizer *tokenizer, PreparedStatement *prepared) {
+    Statement *statement = &prepared->statement;
+    statement->type = STATEMENT_CREATE_INDEX;
+    if (!tokenizer_accept(tokenizer, "index") || !tokenizer_accept(tokenizer, "on")) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    if (tokenizer_accept(tokenizer, "username")) {
+        statement->index_column = COLUMN_USERNAME;
+    } else if (tokenizer_accept(tokenizer, "email")) {
+        statement->index_column = COLUMN_EMAIL;
+    } else {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    return tokenizer->token.type == TOKEN_END ? PREPARE_SUCCESS : PREPARE_SYNTAX_ERROR;
+}
+
+static PrepareResult parse_statement(const char *text, PreparedStatement *prepared) {
+    prepared->num_id_conditions = 0;
+    prepared->num_params = 0;
+    Tokenizer tokenizer = {text};
+    tokenizer_advance(&tokenizer);
+    if (tokenizer_accept(&tokenizer, "insert")) {
+        return parse_insert(&tokenizer, prepared);
+    }
+    if (tokenizer_accept(&tokenizer, "select")) {
+        return parse_select(&tokenizer, prepared);
+    }
+    if (tokenizer_accept(&tokenizer, "delete")) {
+        return parse_delete(&tokenizer, prepared);
+    }
+    if (tokenizer_accept(&tokenizer, "update")) {
+        return parse_update(&tokenizer, prepared);
+    }
+    if (tokenizer_accept(&tokenizer, "create")) {
+        return parse_create_index(&tokenizer, prepared);
+    }
+    return PREPARE_UNRECOGNIZED_STATEMENT;
+}
+
+//把 id 条件合并成 [id_min, id_max]，!= 留作逐行过滤的条件
+static void fold_id_conditions(PreparedStatement *prepared) {
+    Statement *statement = &prepared->statement;
+    //区间用 int64 算，id < 0 或 id > UINT32_MAX 这类空区间不会溢出
+    int64_t id_min = 0;
+    int64_t id_max = UINT32_MAX;
+    statement->num_id_excluded = 0;
+    for (uint32_t i = 0; i < prepared->num_id_conditions; i++) {
+        int64_t value = prepared->id_conditions[i].value;
+        switch (prepared->id_conditions[i].op) {
+            case (ID_EQUALS):
+                id_min = id_min > value ? id_min : value;
+                id_max = id_max < value ? id_max : value;
+                break;
+            case (ID_NOT_EQUALS):
+                statement->id_excluded[statement->num_id_excluded++] = value;
+                break;
+            case (ID_LESS):
+                id_max = id_max < value - 1 ? id_max : value - 1;
+                break;
+            case (ID_LESS_EQUAL):
+                id_max = id_max < value ? id_max : value;
+                break;
+            case (ID_GREATER):
+                id_min = id_min > value + 1 ? id_min : value + 1;
+                break;
+            case (ID_GREATER_EQUAL):
+                id_min = id_min > value ? id_min : value;
+                break;
+        }
+    }
+    statement->empty_range = id_min > id_max || id_min > UINT32_MAX || id_max < 0;
+    statement->id_min = statement->empty_range ? 0 : id_min;
+    statement->id_max = statement->empty_range ? 0 : id_max;
+}
+
+//预编译语句，先查最近用过的语句文本，命中时不再解析
+static PrepareResult prepare_cached(Table *table, const char *text, PreparedStatement *prepared) {
+    StatementCacheEntry *cache = table->statement_cache;
+    pthread_mutex_lock(&table->statement_cache_lock);
+    for (uint32_t i = 0; i < STATEMENT_CACHE_SIZE; i++) {
+        if (cache[i].text != NULL && strcmp(cache[i].text, text) == 0) {
+            cache[i].last_used = ++table->statement_cache_clock;
+            *prepared = cache[i].prepared;
+            pthread_mutex_unlock(&table->statement_cache_lock);
+            stat_add(&table->statement_cache_hits, 1);
+            return PREPARE_SUCCESS;
+        }
+    }
+    pthread_mutex_unlock(&table->statement_cache_lock);
+
+    //解析时不持锁，放进缓存时再挑最久未用的位置
+    PrepareResult result = parse_statement(text, prepared);
+    if (result != PREPARE_SUCCESS) {
+        return result;
+    }
+    pthread_mutex_lock(&table->statement_cache_lock);
+    StatementCacheEntry *victim = &cache[0];
+    for (uint32_t i = 0; i < STATEMENT_CACHE_SIZE; i++) {
+        if (cache[i].text == NULL || (victim->text != NULL && cache[i].last_used < victim->last_used)) {
+            victim = &cache[i];
+        }
+    }
+    free(victim->text);
+    victim->text = strdup(text);
+    victim->prepared = *prepared;
+    victim->last_used = ++table->statement_cache_clock;
+    pthread_mutex_unlock(&table->statement_cache_lock);
+    return PREPARE_SUCCESS;
+}
+
+PrepareResult db_prepare(Table *table, const char *text, PreparedStatement *prepared) {
+    uint64_t start = now_ns();
+    PrepareResult result = prepare_cached(table, text, prepared);
+    latency_record(&table->prepare_latency, now_ns() - start);
+    return result;
+}
+
+void db_get_stats(Table *table, DbStats *stats) {
+    Pager *pager = table->pager;
+    stats->page_hits = stat_load(&pager->page_hits);
+    stats->page_misses = stat_load(&pager->page_misses);
+    stats->page_evictions = stat_load(&pager->page_evictions);
+    stats->page_map_reads = stat_load(&pager->page_map_reads);
+    stats->flush_calls = stat_load(&pager->flush_calls);
+    stats->flush_pages = stat_load(&pager->flush_pages);
+    stats->flush_bytes = stat_load(&pager->flush_bytes);
+    stats->statement_cache_hits = stat_load(&table->statement_cache_hits);
+    latency_read(&table->prepare_latency, &stats->prepare);
+    for (uint32_t i = 0; i <= STATEMENT_CREATE_INDEX; i++) {
+        latency_read(&table->statement_latency[i], &stats->statements[i]);
+    }
+}
+
+void db_reset_stats(Table *table) {
+    Pager *pager = table->pager;
+    atomic_uint_fast64_t *counters[] = {
+            &pager->page_hits, &pager->page_misses, &pager->page_evictions, &pager->page_map_reads,
+            &pager->flush_calls, &pager->flush_pages, &pager->flush_bytes, &table->statement_cache_hits
+    };
+    for (uint32_t i = 0; i < sizeof(counters) / sizeof(counters[0]); i++) {
+        atomic_store_explicit(counters[i], 0, memory_order_relaxed);
+    }
+    latency_reset(&table->prepare_latency);
+    for (uint32_t i = 0; i <= STATEMENT_CREATE_INDEX; i++) {
+        latency_reset(&table->statement_latency[i]);
+    }
+}
+
+//参数从 1 开始编号
+static Param *prepared_param(PreparedStatement *prepared, uint32_t index) {
+    if (index == 0 || index > prepared->num_params) {
+        return NULL;
+    }
+    return &prepared->params[index - 1];
+}
+
+PrepareResult db_bind_int(PreparedStatement *prepared, uint32_t index, int64_t value) {
+    Param *param = prepared_param(prepared, index);
+    if (param == NULL) {
+        return PREPARE_INVALID_PARAMETER;
+    }
+    uint32_t *target;
+    if (param->target == PARAM_INSERT_ID) {
+        target = &prepared->statement.row_to_insert.id;
+    } else if (param->target == PARAM_ID_CONDITION) {
+        target = &prepared->id_conditions[param->index].value;
+    } else {
+        return PREPARE_INVALID_PARAMETER;
+    }
+    PrepareResult result = check_id_value(value, target);
+    param->bound = result == PREPARE_SUCCESS;
+    return result;
+}
+
+PrepareResult db_bind_text(PreparedStatement *prepared, uint32_t index, const char *value) {
+    Param *param = prepared_param(prepared, index);
+    if (param == NULL || value == NULL) {
+        return PREPARE_INVALID_PARAMETER;
+    }
+    size_t length = strlen(value);
+    if (length > COLUMN_EMAIL_SIZE + 1) {
+        param->bound = false;
+        return PREPARE_STRING_TOO_LONG;
+    }
+    PrepareResult result;
+    if (param->target == PARAM_INSERT_USERNAME || param->target == PARAM_INSERT_EMAIL) {
+        result = set_insert_text(&prepared->statement.row_to_insert, param->target, value, length);
+    } else if (param->target == PARAM_PREDICATE) {
+        result = set_predicate_text(&prepared->statement.predicates[param->index], value, length);
+    } else {
+        return PREPARE_INVALID_PARAMETER;
+    }
+    param->bound = result == PREPARE_SUCCESS;
+    return result;
+}
+
+//执行预编译语句，参数必须都已绑定；绑定的值保留，可以只改部分参数再执行
+ExecuteResult db_execute(Table *table, PreparedStatement *prepared) {
+    for (uint32_t i = 0; i < prepared->num_params; i++) {
+        if (!prepared->params[i].bound) {
+            return EXECUTE_UNBOUND_PARAMETER;
+        }
+    }
+    if (prepared->statement.type != STATEMENT_INSERT) {
+        fold_id_conditions(prepared);
+    }
+    return execute_statement(&prepared->statement, table);
+}
@@ -0,0 +1,300 @@
+//
+// 存储引擎的公开接口，REPL 和嵌入的程序都只通过这里访问表
+// 同一个 Table 可以被多个线程同时使用：写操作（insert、delete、update、批量插入、导入、checkpoint）互相串行，
+// 读操作（select、游标）可以同时进行，也可以和写者同时进行；
+// 每个读操作看到开始时刻已提交的行，一次批量插入或导入要么全部可见，要么都不可见
+//
+
+#ifndef _DB_H_
+#define _DB_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// part 3 硬编码表的 字段长度
+#define COLUMN_USERNAME_SIZE 32
+#define COLUMN_EMAIL_SIZE 255
+//where 里最多几个 id != 和字符串条件
+#define MAX_ID_EXCLUDED 8
+#define MAX_PREDICATES 8
+//select 投影里最多几项
+#define MAX_AGGREGATES 8
+//预编译语句里最多几个 id 条件、几个 ? 参数
+#define MAX_ID_CONDITIONS 16
+#define MAX_PARAMS 16
+//缓冲池默认帧数 256 * 4k = 1M 常驻内存
+#define PAGER_DEFAULT_FRAMES 256
+//顺序读时默认预读 32 页
+#define PAGER_DEFAULT_READ_AHEAD 32
+//WAL 组提交默认参数：等待 2ms 或攒够 128 条记录
+#define WAL_DEFAULT_GROUP_WINDOW_US 2000
+#define WAL_DEFAULT_GROUP_MAX_RECORDS 128
+//延迟直方图的桶数：第 i 个桶统计 [2^(i-1), 2^i) 纳秒，最后一个桶也收更慢的
+#define STATS_LATENCY_BUCKETS 40
+
+typedef enum {
+    PREPARE_SUCCESS,
+    PREPARE_UNRECOGNIZED_STATEMENT,
+    PREPARE_NEGATIVE_ID,
+    PREPARE_STRING_TOO_LONG,
+    PREPARE_SYNTAX_ERROR,
+    PREPARE_INVALID_PARAMETER   //参数编号不存在或类型不对
+} PrepareResult;
+
+typedef enum {
+    EXECUTE_SUCCESS,
+    EXECUTE_TABLE_FULL,
+    EXECUTE_DUPLICATE_KEY,
+    EXECUTE_UNBOUND_PARAMETER,
+    EXECUTE_INDEX_EXISTS
+} ExecuteResult;
+
+typedef enum {
+    STATEMENT_INSERT,
+    STATEMENT_SELECT,
+    STATEMENT_DELETE,
+    STATEMENT_UPDATE,
+    STATEMENT_CREATE_INDEX
+} StatementType;
+
+//select 的输出格式，.mode 切换
+typedef enum {
+    OUTPUT_TEXT,        // (id, username, email)
+    OUTPUT_CSV,         // id,username,email，带表头
+    OUTPUT_BINARY       // 每行：u32 长度 | u32 id | u8 ulen | username | u8 elen | email
+} OutputMode;
+
+typedef struct {
+    uint32_t id;
+    char username[COLUMN_USERNAME_SIZE + 1];
+    char email[COLUMN_EMAIL_SIZE + 1];
+} Row;
+
+typedef enum {
+    COLUMN_ID,
+    COLUMN_USERNAME,
+    COLUMN_EMAIL
+} Column;
+
+typedef enum {
+    PREDICATE_EQUALS,
+    PREDICATE_PREFIX
+} PredicateOp;
+
+//username/email 上的条件
+typedef struct {
+    Column column;
+    PredicateOp op;
+    uint32_t length;
+    char text[COLUMN_EMAIL_SIZE + 1];
+} Predicate;
+
+//select 的投影：聚合函数，或者分组时的 username 列
+typedef enum {
+    AGGREGATE_COUNT,
+    AGGREGATE_MIN,
+    AGGREGATE_MAX,
+    AGGREGATE_SUM,
+    AGGREGATE_USERNAME
+} Aggregate;
+
+typedef struct {
+    StatementType type;
+    Row row_to_insert;  // insert 的整行；update 时是 set 的新值
+    bool set_username;  // update 改哪些列
+    bool set_email;
+    Column index_column;    // create index 建在哪一列
+    Aggregate aggregates[MAX_AGGREGATES];
+    uint32_t num_aggregates;    // 0 表示输出整行
+    bool group_by_username;
+    //select/delete/update 的 where 条件：id 的比较合并成闭区间，!= 单独记录
+    uint32_t id_min;
+    uint32_t id_max;
+    bool empty_range;   // id 条件互相矛盾，结果为空
+    uint32_t id_excluded[MAX_ID_EXCLUDED];
+    uint32_t num_id_excluded;
+    Predicate predicates[MAX_PREDICATES];
+    uint32_t num_predicates;
+} Statement;
+
+typedef enum {
+    ID_EQUALS,
+    ID_NOT_EQUALS,
+    ID_LESS,
+    ID_LESS_EQUAL,
+    ID_GREATER,
+    ID_GREATER_EQUAL
+} IdOp;
+
+//where 里的一个 id 比较，执行前才合并进 id_min/id_max，值可以是参数
+typedef struct {
+    IdOp op;
+    uint32_t value;
+} IdCondition;
+
+//? 参数绑定到哪里
+typedef enum {
+    PARAM_INSERT_ID,
+    PARAM_INSERT_USERNAME,      //insert 的值，或 update 的 set 值
+    PARAM_INSERT_EMAIL,
+    PARAM_ID_CONDITION,     //index 是 id_conditions 的下标
+    PARAM_PREDICATE         //index 是 predicates 的下标
+} ParamTarget;
+
+typedef struct {
+    ParamTarget target;
+    uint32_t index;
+    bool bound;
+} Param;
+
+//预编译好的语句：解析一次，之后只绑定参数、执行
+typedef struct {
+    Statement statement;
+    IdCondition id_conditions[MAX_ID_CONDITIONS];
+    uint32_t num_id_conditions;
+    Param params[MAX_PARAMS];
+    uint32_t num_params;
+} PreparedStatement;
+
+//db_open 的可调参数
+typedef struct {
+    uint32_t num_frames;            //缓冲池帧数
+    bool use_mmap;                  //只读页访问走 mmap
+    uint32_t wal_group_window_us;   //组提交等待窗口，0 表示每条记录立即 fdatasync
+    uint32_t wal_group_max_records; //一组攒够这么多条记录立即提交
+    uint32_t scan_threads;          //全表扫描的工作线程数，1 表示不并行
+    uint32_t read_ahead_pages;      //连续缺页时多读后面的页数，0 表示不预读
+    bool use_io_uring;              //页读写走 io_uring，内核不支持时自动用同步读写
+    bool compress_pages;            //新建的文件按页压缩存放；已有的文件按文件里记录的方式打开
+} DbOptions;
+
+//一种操作的耗时分布
+typedef struct {
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t buckets[STATS_LATENCY_BUCKETS];
+} LatencyStats;
+
+//运行时计数，都是打开或上次 db_reset_stats 之后的累计值
+typedef struct {
+    uint64_t page_hits;             //取页时在缓冲池里
+    uint64_t page_misses;           //取页时不在缓冲池里，从文件读或是新页
+    uint64_t page_evictions;        //为了放别的页淘汰掉的帧
+    uint64_t page_map_reads;        //只读取页直接用 mmap 映射，不经过缓冲池
+    uint64_t flush_calls;           //写回数据文件的次数：淘汰和写文件头时的单页写回、检查点、批量导入
+    uint64_t flush_pages;
+    uint64_t flush_bytes;           //压缩文件按压缩后的字节计
+    uint64_t statement_cache_hits;  //db_prepare 直接取到缓存的解析结果
+    LatencyStats prepare;           //db_prepare 的耗时，包括查缓存
+    LatencyStats statements[STATEMENT_CREATE_INDEX + 1];    //按 StatementType 分开的执行耗时
+} DbStats;
+
+//表和游标的内部结构只在 db.c 里可见
+typedef struct Table Table;
+typedef struct Cursor Cursor;
+
+/*
+* 函数: db_open
+* 功能: 打开数据库文件，文件不存在时创建；行数、根页和空闲页链表直接从页0 的文件头读出，
+*      上次没有正常关闭时沿叶子链表重新统计，再重放留下的日志
+*/
+Table *db_open(const char *filename, const DbOptions *options);
+
+/*
+* 函数: db_close
+* 功能: checkpoint 后关闭表，释放所有资源
+*/
+void db_close(Table *table);
+
+/*
+* 函数: db_checkpoint
+* 功能: 脏页刷盘并清空日志
+*/
+void db_checkpoint(Table *table);
+
+/*
+* 函数: db_prepare
+* 功能: 解析语句文本，最近用过的文本直接取缓存的解析结果
+* 返回: PREPARE_SUCCESS，或解析错误
+*/
+PrepareResult db_prepare(Table *table, const char *text, PreparedStatement *prepared);
+
+/*
+* 函数: db_bind_int / db_bind_text
+* 功能: 给第 index 个 ? 绑定值，从 1 开始编号
+* 返回: 编号不存在或类型不对时 PREPARE_INVALID_PARAMETER
+*/
+PrepareResult db_bind_int(PreparedStatement *prepared, uint32_t index, int64_t value);
+PrepareResult db_bind_text(PreparedStatement *prepared, uint32_t index, const char *value);
+
+/*
+* 函数: db_execute
+* 功能: 执行预编译语句，select 的结果按当前输出格式写到标准输出
+*/
+ExecuteResult db_execute(Table *table, PreparedStatement *prepared);
+
+/*
+* 函数: execute_insert / execute_select / execute_delete / execute_update / execute_create_index
+* 功能: 直接执行已经填好的 Statement，不经过解析
+*      insert/delete/update 等到日志记录所在的提交组落盘才返回
+*/
+ExecuteResult execute_insert(Statement *statement, Table *table);
+ExecuteResult execute_select(Statement *statement, Table *table);
+ExecuteResult execute_delete(Statement *statement, Table *table);
+ExecuteResult execute_update(Statement *statement, Table *table);
+ExecuteResult execute_create_index(Statement *statement, Table *table);
+
+/*
+* 函数: db_insert_batch
+* 功能: 按数组顺序插入多行，落在同一个叶子里的行不再从根查找，日志一次追加，落盘后返回
+* 参数: inserted 返回成功插入的行数，可以为 NULL
+* 返回: 遇到重复 id 或表满时停止，之前的行保留
+*/
+ExecuteResult db_insert_batch(Table *table, const Row *rows, uint32_t count, uint32_t *inserted);
+
+/*
+* 函数: db_scan / db_cursor_next / db_cursor_close
+* 功能: 从第一个 id >= first_id 的行开始按 id 顺序遍历，db_cursor_next 到末尾返回 false
+*      游标看到的是打开时刻的快照，之后提交的行不出现；游标不钉页，打开期间写者和同一线程都可以写
+*/
+Cursor *db_scan(Table *table, uint32_t first_id);
+bool db_cursor_next(Cursor *cursor, Row *row);
+void db_cursor_close(Cursor *cursor);
+
+/*
+* 函数: db_import
+* 功能: 从 csv/tsv 文件批量导入
+*/
+void db_import(Table *table, const char *filename);
+
+/*
+* 函数: db_vacuum
+* 功能: 清掉已删除的行，合并同一父节点下稀疏的相邻叶子，空出来的页放进空闲页链表供之后分配；
+*      再清掉哈希索引里指向已删除或已修改的行的项。每处理完一个父节点或一个桶就放掉写者锁，期间读写照常进行
+* 返回: 释放的页数
+*/
+uint32_t db_vacuum(Table *table);
+
+/*
+* 函数: db_get_stats / db_reset_stats
+* 功能: 取出运行时计数，或全部清零；计数时不加锁，和正在进行的操作同时读到的值可能差一两次
+*/
+void db_get_stats(Table *table, DbStats *stats);
+void db_reset_stats(Table *table);
+
+/*
+* 函数: db_set_output_mode
+* 功能: 设置 select 的输出格式
+*/
+void db_set_output_mode(Table *table, OutputMode mode);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //_DB_H_